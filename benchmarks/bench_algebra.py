@@ -0,0 +1,122 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_algebra
+----------------------------------
+
+Union, intersection and difference of eight `bcse.collections.orderedset`
+operands, chained pairwise (``a | b | c ...``) against one N-ary call
+(``a.union(b, c, ...)``), with the builtin set's N-ary methods as the floor.
+Every operand holds a shared half and a half of its own. The expr_*
+benchmarks answer 1000 lookups or take the first 100 keys of ``(a | b) - c``,
+computed eagerly or as a lazy expression::
+
+    python benchmarks/bench_algebra.py -o algebra.json
+    python benchmarks/bench_algebra.py --sizes 100000 --key-types int -o algebra.json
+"""
+
+import functools
+import itertools
+import operator
+
+import pyperf
+
+from bcse.collections import orderedset
+from benchdata import make_keys, SEED
+
+
+SIZES = '1000000'
+KEY_TYPES = 'int,str'
+OPERANDS = 8
+
+
+_data = {}
+
+
+def data(kind, n):
+    try:
+        return _data[kind, n]
+    except KeyError:
+        pass
+    core = make_keys(kind, n // 2, SEED)
+    operands = [core + make_keys(kind, n - n // 2, SEED + 1 + i, base=(i + 1) * n * 2)
+                for i in range(OPERANDS)]
+    _data[kind, n] = operands
+    return operands
+
+
+CONTAINERS = {
+    'orderedset': orderedset,
+    'set': set,
+}
+
+OPERATORS = {
+    'union': operator.or_,
+    'intersection': operator.and_,
+    'difference': operator.sub,
+}
+
+
+def bench_chained(loops, name, kind, n, op):
+    sets = [CONTAINERS[name](keys) for keys in data(kind, n)]
+    func = OPERATORS[op]
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        functools.reduce(func, sets)
+    return pyperf.perf_counter() - t0
+
+
+def bench_nary(loops, name, kind, n, op):
+    sets = [CONTAINERS[name](keys) for keys in data(kind, n)]
+    func = getattr(sets[0], op)
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        func(*sets[1:])
+    return pyperf.perf_counter() - t0
+
+
+def bench_expr(loops, kind, n, lazy, use):
+    a, b, c = [orderedset(keys) for keys in data(kind, n)[:3]]
+    probes = data(kind, n)[1][-1000:]
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        expr = ((a.lazy() if lazy else a) | b) - c
+        if use == 'contains':
+            for k in probes:
+                k in expr
+        else:
+            list(itertools.islice(expr, 100))
+    return pyperf.perf_counter() - t0
+
+
+def add_cmdline_args(cmd, args):
+    cmd.extend(('--sizes', args.sizes, '--key-types', args.key_types))
+
+
+def main():
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    runner.metadata['description'] = 'N-ary orderedset algebra over %d operands' % OPERANDS
+    runner.argparser.add_argument('--sizes', default=SIZES,
+                                  help='comma separated operand sizes (default: %s)' % SIZES)
+    runner.argparser.add_argument('--key-types', default=KEY_TYPES,
+                                  help='comma separated key types (default: %s)' % KEY_TYPES)
+    args = runner.parse_args()
+
+    for n in [int(size) for size in args.sizes.split(',')]:
+        for kind in args.key_types.split(','):
+            for op in sorted(OPERATORS):
+                runner.bench_time_func('orderedset/%s/%d/%s_chained' % (kind, n, op),
+                                       bench_chained, 'orderedset', kind, n, op)
+                for name in ('orderedset', 'set'):
+                    runner.bench_time_func('%s/%s/%d/%s' % (name, kind, n, op),
+                                           bench_nary, name, kind, n, op)
+            for use in ('contains', 'first'):
+                for lazy in (False, True):
+                    name = 'orderedset_lazy' if lazy else 'orderedset'
+                    runner.bench_time_func('%s/%s/%d/expr_%s' % (name, kind, n, use),
+                                           bench_expr, kind, n, lazy, use)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,82 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_calls
+----------------------------------
+
+Per-call latency of constructing `bcse.collections.orderedset` and of
+pop(), index() and the other methods taking several arguments, on sets
+small enough that argument passing dominates the work. The builtin set and
+list give the floor::
+
+    python benchmarks/bench_calls.py -o calls.json
+"""
+
+import pyperf
+
+from bcse.collections import orderedset
+
+
+CALLS = 10000
+SMALL = list(range(8))
+
+
+def bench_construct(loops, factory, *args, **kwargs):
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        for _ in range(CALLS):
+            factory(*args, **kwargs)
+    return pyperf.perf_counter() - t0
+
+
+def bench_pop(loops, factory, *args):
+    elapsed = 0
+    for _ in range(loops):
+        pop = factory(range(CALLS)).pop
+        t0 = pyperf.perf_counter()
+        for _ in range(CALLS):
+            pop(*args)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_method(loops, c, name, *args):
+    method = getattr(c, name)
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        for _ in range(CALLS):
+            method(*args)
+    return pyperf.perf_counter() - t0
+
+
+def main():
+    runner = pyperf.Runner()
+    runner.metadata['description'] = 'per-call overhead of small orderedset calls'
+    runner.parse_args()
+
+    def bench(name, func, *args, **kwargs):
+        runner.bench_time_func(name, func, *args, inner_loops=CALLS, **kwargs)
+
+    bench('orderedset()', bench_construct, orderedset)
+    bench('set()', bench_construct, set)
+    bench('orderedset(small)', bench_construct, orderedset, SMALL)
+    bench('set(small)', bench_construct, set, SMALL)
+    bench('orderedset(small, maxlen=16)', bench_construct, orderedset, SMALL, maxlen=16)
+
+    bench('orderedset.pop()', bench_pop, orderedset)
+    bench('orderedset.pop(-1)', bench_pop, orderedset, -1)
+    bench('list.pop()', bench_pop, list)
+
+    small = orderedset(SMALL)
+    bench('orderedset.index(k)', bench_method, small, 'index', 4)
+    bench('list.index(k)', bench_method, list(SMALL), 'index', 4)
+    bench('orderedset.get(k)', bench_method, small, 'get', 4)
+    bench('orderedset.get(k, default)', bench_method, small, 'get', 100, None)
+    bench('orderedset.move(k, i)', bench_method, small, 'move', 4, 4)
+    bench('orderedset.move_to_end(k)', bench_method, small, 'move_to_end', 7)
+    bench('orderedset.irange(lo, hi)', bench_method, small, 'irange', 2, 5)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_diff
+----------------------------------
+
+diff() between two mostly similar `bcse.collections.orderedset`, the second
+a copy of the first with some keys moved, added and discarded, and bringing
+a copy of the first up to date with apply_delta() on the result. Sending the
+whole set, as orderedset(list(b)), is the baseline::
+
+    python benchmarks/bench_diff.py -o diff.json
+    python benchmarks/bench_diff.py --sizes 100000 --edits 100 -o diff.json
+"""
+
+import random
+
+import pyperf
+
+from bcse.collections import orderedset
+from benchdata import make_keys, SEED
+
+
+SIZES = '1000000'
+EDITS = 1000
+
+
+_data = {}
+
+
+def data(n, edits):
+    try:
+        return _data[n, edits]
+    except KeyError:
+        pass
+    keys = make_keys('int', n + edits)
+    a = orderedset(keys[:n])
+    b = a.copy()
+    rng = random.Random(SEED)
+    for _ in range(edits):
+        b.move(b[rng.randrange(n)], rng.randrange(n))
+    for i in range(edits):
+        b.discard(keys[rng.randrange(n)])
+        b.insert(rng.randrange(len(b)), keys[n + i])
+    _data[n, edits] = a, b
+    return a, b
+
+
+def bench_sync(loops, n, edits, how):
+    a, b = data(n, edits)
+    elapsed = 0
+    for _ in range(loops):
+        replica = a.copy()
+        t0 = pyperf.perf_counter()
+        if how == 'diff':
+            a.diff(b)
+        elif how == 'apply':
+            replica.apply_delta(a.diff(b))
+        else:
+            replica = orderedset(list(b))
+        elapsed += pyperf.perf_counter() - t0
+    if how != 'diff':
+        assert list(replica) == list(b)
+    return elapsed
+
+
+def add_cmdline_args(cmd, args):
+    cmd.extend(('--sizes', args.sizes, '--edits', str(args.edits)))
+
+
+def main():
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    runner.metadata['description'] = 'orderedset diff() against sending the whole set'
+    runner.argparser.add_argument('--sizes', default=SIZES,
+                                  help='comma separated set sizes (default: %s)' % SIZES)
+    runner.argparser.add_argument('--edits', type=int, default=EDITS,
+                                  help='moves, adds and discards each (default: %d)' % EDITS)
+    args = runner.parse_args()
+
+    for n in [int(size) for size in args.sizes.split(',')]:
+        for how in ('diff', 'apply', 'rebuild'):
+            runner.bench_time_func('%s/%d' % (how, n), bench_sync, n, args.edits, how)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,108 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_growth
+----------------------------------
+
+Latency of single add() calls while `bcse.collections.orderedset` grows
+from empty to n keys, as percentiles rather than a mean: outgrowing the
+bucket array moves the keys to the new one a few buckets per add().
+'orderedset_reserved' calls reserve(n) first. The builtin set and dict
+grow the same way and are shown for comparison. Every run uses a fresh
+interpreter and the results are written as JSON::
+
+    python benchmarks/bench_growth.py -o growth.json
+    python benchmarks/bench_growth.py --sizes 20000000 --key-types int
+"""
+
+import argparse
+import json
+import subprocess
+import sys
+import time
+
+from bcse.collections import orderedset
+from benchdata import make_keys
+
+
+def reserved(n):
+    s = orderedset()
+    s.reserve(n)
+    return s.add
+
+
+CONTAINERS = {
+    'orderedset': lambda n: orderedset().add,
+    'orderedset_reserved': reserved,
+    'set': lambda n: set().add,
+    'dict': lambda n: dict().setdefault,
+}
+
+PERCENTILES = (50, 99, 99.9, 99.99)
+
+
+def measure(name, kind, n):
+    keys = make_keys(kind, n)
+    add = CONTAINERS[name](n)
+    clock = getattr(time, 'perf_counter_ns', None)
+    scale = 1
+    if clock is None:
+        clock, scale = time.perf_counter, 1e9
+    latencies = []
+    record = latencies.append
+
+    t0 = time.perf_counter()
+    for key in keys:
+        t = clock()
+        add(key)
+        record(clock() - t)
+    total = time.perf_counter() - t0
+
+    latencies.sort()
+    result = {
+        'container': name,
+        'key_type': kind,
+        'size': n,
+        'total_time': total,
+        'max_ns': latencies[-1] * scale,
+    }
+    for p in PERCENTILES:
+        result['p%s_ns' % str(p).replace('.', '')] = latencies[int(n * p / 100)] * scale
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[-1])
+    parser.add_argument('--sizes', default='1000000,10000000')
+    parser.add_argument('--key-types', default='int,str')
+    parser.add_argument('-o', '--output', help='write JSON results here')
+    parser.add_argument('--worker', nargs=3, help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.worker:
+        name, kind, n = args.worker
+        json.dump(measure(name, kind, int(n)), sys.stdout)
+        return
+
+    results = []
+    for n in args.sizes.split(','):
+        for kind in args.key_types.split(','):
+            for name in CONTAINERS:
+                out = subprocess.check_output(
+                    [sys.executable, __file__, '--worker', name, kind, n])
+                result = json.loads(out.decode('utf-8'))
+                results.append(result)
+                sys.stderr.write('%(container)s/%(key_type)s/%(size)d: '
+                                 'p50 %(p50_ns)dns, p99 %(p99_ns)dns, p999 %(p999_ns)dns, '
+                                 'max %(max_ns).0fns\n' % result)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+    else:
+        json.dump(results, sys.stdout, indent=2)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,117 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_lru
+----------------------------------
+
+Steady-state throughput of a full dedup window: every operation adds one
+ID from a stream in which a fraction of IDs repeat recently seen ones.
+Compares `orderedset(maxlen=...)` with the add() + pop(0) idiom it
+replaces and an OrderedDict with popitem(last=False)::
+
+    python benchmarks/bench_lru.py -o lru.json
+    python benchmarks/bench_lru.py --capacity 1000000 --ops 100000 -o lru.json
+"""
+
+import random
+from collections import OrderedDict
+
+import pyperf
+
+from bcse.collections import orderedset
+from benchdata import SEED
+
+
+CAPACITY = 1000000
+OPS = 100000
+HIT_RATIO = 0.3
+
+
+def make_stream(capacity, ops, hit_ratio):
+    rng = random.Random(SEED)
+    stream = []
+    new = capacity
+    for _ in range(ops):
+        if rng.random() < hit_ratio:
+            # A recent ID, recent enough to still be in every window.
+            stream.append(new - 1 - rng.randrange(capacity // 2))
+        else:
+            stream.append(new)
+            new += 1
+    return stream
+
+
+def bench_bounded(loops, capacity, stream, touch):
+    elapsed = 0
+    for _ in range(loops):
+        s = orderedset(range(capacity), maxlen=capacity, touch=touch)
+        add = s.add
+        t0 = pyperf.perf_counter()
+        for x in stream:
+            add(x)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_pop0(loops, capacity, stream):
+    elapsed = 0
+    for _ in range(loops):
+        s = orderedset(range(capacity))
+        add, pop = s.add, s.pop
+        t0 = pyperf.perf_counter()
+        for x in stream:
+            if x not in s:
+                add(x)
+                if len(s) > capacity:
+                    pop(0)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_ordereddict(loops, capacity, stream):
+    elapsed = 0
+    for _ in range(loops):
+        d = OrderedDict.fromkeys(range(capacity))
+        popitem = d.popitem
+        t0 = pyperf.perf_counter()
+        for x in stream:
+            if x in d:
+                d.move_to_end(x)
+            else:
+                d[x] = None
+                if len(d) > capacity:
+                    popitem(last=False)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def add_cmdline_args(cmd, args):
+    cmd.extend(('--capacity', str(args.capacity), '--ops', str(args.ops),
+                '--hit-ratio', str(args.hit_ratio), '--pop0-ops', str(args.pop0_ops)))
+
+
+def main():
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    runner.argparser.add_argument('--capacity', type=int, default=CAPACITY)
+    runner.argparser.add_argument('--ops', type=int, default=OPS)
+    runner.argparser.add_argument('--hit-ratio', type=float, default=HIT_RATIO)
+    runner.argparser.add_argument('--pop0-ops', type=int, default=OPS // 10,
+                                  help='operations for the O(n) pop(0) baseline')
+    args = runner.parse_args()
+
+    n = args.capacity
+    stream = make_stream(n, args.ops, args.hit_ratio)
+    runner.bench_time_func('orderedset/%d/maxlen' % n, bench_bounded, n, stream, False,
+                           inner_loops=len(stream))
+    runner.bench_time_func('orderedset/%d/maxlen_touch' % n, bench_bounded, n, stream, True,
+                           inner_loops=len(stream))
+    runner.bench_time_func('OrderedDict/%d/move_to_end' % n, bench_ordereddict, n, stream,
+                           inner_loops=len(stream))
+    stream = stream[:args.pop0_ops]
+    runner.bench_time_func('orderedset/%d/pop0' % n, bench_pop0, n, stream,
+                           inner_loops=len(stream))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,109 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_memory
+----------------------------------
+
+Build time, traced allocations and resident memory of
+`bcse.collections.orderedset` against the builtin set, dict and
+OrderedDict. Every measurement runs in a fresh interpreter and the results
+are written as JSON::
+
+    python benchmarks/bench_memory.py -o memory.json
+"""
+
+import argparse
+import json
+import subprocess
+import sys
+import time
+import tracemalloc
+from collections import OrderedDict
+
+from bcse.collections import orderedset
+from benchdata import make_keys
+
+
+CONTAINERS = {
+    'orderedset': orderedset,
+    'set': set,
+    'dict': dict.fromkeys,
+    'OrderedDict': OrderedDict.fromkeys,
+}
+
+
+def rss():
+    try:
+        with open('/proc/self/statm') as f:
+            return int(f.read().split()[1]) * 4096
+    except (IOError, OSError):
+        return 0
+
+
+def measure(name, kind, n):
+    keys = make_keys(kind, n)
+    factory = CONTAINERS[name]
+
+    tracemalloc.start()
+    c = factory(keys)
+    current, peak = tracemalloc.get_traced_memory()
+    blocks = sum(stat.count for stat in tracemalloc.take_snapshot().statistics('filename'))
+    tracemalloc.stop()
+    del c
+
+    r0 = rss()
+    t0 = time.perf_counter()
+    c = factory(keys)
+    build = time.perf_counter() - t0
+    r1 = rss()
+    c.clear()
+    r2 = rss()
+    return {
+        'container': name,
+        'key_type': kind,
+        'size': n,
+        'build_time': build,
+        'traced_blocks': blocks,
+        'traced_bytes': current,
+        'traced_peak': peak,
+        'rss_built': r1 - r0,
+        'rss_cleared': r2 - r0,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[-1])
+    parser.add_argument('--sizes', default='1000,100000,1000000')
+    parser.add_argument('--key-types', default='int,str,tuple')
+    parser.add_argument('-o', '--output', help='write JSON results here')
+    parser.add_argument('--worker', nargs=3, help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.worker:
+        name, kind, n = args.worker
+        json.dump(measure(name, kind, int(n)), sys.stdout)
+        return
+
+    results = []
+    for n in args.sizes.split(','):
+        for kind in args.key_types.split(','):
+            for name in CONTAINERS:
+                out = subprocess.check_output(
+                    [sys.executable, __file__, '--worker', name, kind, n])
+                result = json.loads(out.decode('utf-8'))
+                results.append(result)
+                sys.stderr.write('%(container)s/%(key_type)s/%(size)d: '
+                                 'build %(build_time).6fs, %(traced_blocks)d blocks, '
+                                 'RSS +%(rss_built)d, after clear +%(rss_cleared)d\n'
+                                 % result)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+    else:
+        json.dump(results, sys.stdout, indent=2)
+
+
+if __name__ == '__main__':
+    main()
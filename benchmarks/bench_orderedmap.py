@@ -0,0 +1,109 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_orderedmap
+----------------------------------
+
+Traced memory and positional access time of `bcse.collections.orderedmap`
+against keeping an orderedset next to a dict, and against OrderedDict,
+which has to walk to reach position i. Results are written as JSON::
+
+    python benchmarks/bench_orderedmap.py -o orderedmap.json
+"""
+
+import argparse
+import itertools
+import json
+import random
+import sys
+import time
+import tracemalloc
+from collections import OrderedDict
+
+from bcse.collections import orderedmap, orderedset
+from benchdata import make_keys
+
+
+def build_orderedmap(keys):
+    return orderedmap(zip(keys, keys))
+
+
+def build_pair(keys):
+    return orderedset(keys), dict(zip(keys, keys))
+
+
+def build_ordereddict(keys):
+    return OrderedDict(zip(keys, keys))
+
+
+def at_orderedmap(m, i):
+    return m.item_at(i)
+
+
+def at_pair(pair, i):
+    key = pair[0][i]
+    return key, pair[1][key]
+
+
+def at_ordereddict(d, i):
+    return next(itertools.islice(d.items(), i, None))
+
+
+APPROACHES = {
+    'orderedmap': (build_orderedmap, at_orderedmap),
+    'orderedset+dict': (build_pair, at_pair),
+    'OrderedDict': (build_ordereddict, at_ordereddict),
+}
+
+
+def measure(name, kind, n, lookups):
+    build, at = APPROACHES[name]
+    keys = make_keys(kind, n)
+
+    tracemalloc.start()
+    c = build(keys)
+    traced = tracemalloc.get_traced_memory()[0]
+    tracemalloc.stop()
+
+    rnd = random.Random(n)
+    positions = [rnd.randrange(n) for _ in range(lookups)]
+    t0 = time.perf_counter()
+    for i in positions:
+        at(c, i)
+    elapsed = time.perf_counter() - t0
+    return {
+        'approach': name,
+        'key_type': kind,
+        'size': n,
+        'traced_bytes': traced,
+        'positional_access': elapsed / lookups,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[-1])
+    parser.add_argument('--sizes', default='1000,100000,1000000')
+    parser.add_argument('--key-types', default='int,str')
+    parser.add_argument('--lookups', type=int, default=1000)
+    parser.add_argument('-o', '--output', help='write JSON results here')
+    args = parser.parse_args()
+
+    results = []
+    for n in args.sizes.split(','):
+        for kind in args.key_types.split(','):
+            for name in APPROACHES:
+                result = measure(name, kind, int(n), args.lookups)
+                results.append(result)
+                sys.stderr.write('%(approach)s/%(key_type)s/%(size)d: %(traced_bytes)d bytes, '
+                                 '%(positional_access).9fs per item_at\n' % result)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+    else:
+        json.dump(results, sys.stdout, indent=2)
+
+
+if __name__ == '__main__':
+    main()
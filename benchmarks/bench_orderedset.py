@@ -0,0 +1,353 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_orderedset
+----------------------------------
+
+pyperf benchmarks for `bcse.collections.orderedset`, with the builtin set,
+dict, OrderedDict and list as baselines wherever they offer the same
+operation. All data is generated from fixed seeds, so runs are comparable::
+
+    python benchmarks/bench_orderedset.py -o orderedset.json
+    python benchmarks/bench_orderedset.py --sizes 1000,100000,10000000 -o full.json
+    python -m pyperf compare_to baseline.json orderedset.json
+
+Benchmark names read ``<container>/<key type>/<size>/<operation>``.
+"""
+
+import operator
+import pickle
+import random
+from collections import OrderedDict
+
+import pyperf
+
+from bcse.collections import orderedset
+from benchdata import SEED, make_keys
+
+
+SIZES = '1000,100000'
+KEY_TYPES = 'int,str,tuple'
+
+# Per element benchmarks (lookups, deletions, indexing) run this many
+# operations per loop, or half the container size if that is smaller.
+OPS = 1000
+
+
+_data = {}
+
+
+def data(kind, n):
+    """Keys, a half overlapping second operand and probe lists, built once
+    per worker process."""
+    try:
+        return _data[kind, n]
+    except KeyError:
+        pass
+    ops = min(OPS, n // 2)
+    keys = make_keys(kind, n, SEED)
+    extra = make_keys(kind, n, SEED + 1, base=n * 4)
+    rng = random.Random(SEED + 2)
+    d = {
+        'keys': keys,
+        'other': keys[n // 2:] + extra[:n - n // 2],
+        # Equal keys as distinct objects, and the same with the last one
+        # changed, as a reloaded configuration would produce.
+        'copies': make_keys(kind, n, SEED),
+        'changed': make_keys(kind, n, SEED)[:-1] + extra[:1],
+        'hits': rng.sample(keys, ops),
+        'misses': extra[:ops],
+        'positions': [rng.randrange(n - ops) for _ in range(ops)],
+    }
+    _data[kind, n] = d
+    return d
+
+
+CONTAINERS = {
+    'orderedset': orderedset,
+    'orderedset_bloom': lambda keys: orderedset(keys, bloom=True),
+    'set': set,
+    'dict': dict.fromkeys,
+    'OrderedDict': OrderedDict.fromkeys,
+    'list': list,
+}
+
+
+def copy(c):
+    return c.copy() if not isinstance(c, list) else c[:]
+
+
+# Time functions: pyperf passes the loop count and expects the elapsed time.
+
+def bench_construct(loops, name, kind, n):
+    factory = CONTAINERS[name]
+    keys = data(kind, n)['keys']
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        factory(keys)
+    return pyperf.perf_counter() - t0
+
+
+def bench_contains(loops, name, kind, n, probes):
+    c = CONTAINERS[name](data(kind, n)['keys'])
+    probes = data(kind, n)[probes]
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        for k in probes:
+            k in c
+    return pyperf.perf_counter() - t0
+
+
+def bench_binary(loops, name, kind, n, op):
+    factory = CONTAINERS[name]
+    a = factory(data(kind, n)['keys'])
+    b = factory(data(kind, n)['other'])
+    op = getattr(operator, op)
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        op(a, b)
+    return pyperf.perf_counter() - t0
+
+
+def bench_equal(loops, name, kind, n, other):
+    factory = CONTAINERS[name]
+    a = factory(data(kind, n)['keys'])
+    b = factory(data(kind, n)[other])
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        a == b
+    return pyperf.perf_counter() - t0
+
+
+def bench_isdisjoint(loops, name, kind, n):
+    # The worst case: nothing in common, so every probe is a miss.
+    a = CONTAINERS[name](data(kind, n)['keys'])
+    misses = data(kind, n)['misses']
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        a.isdisjoint(misses)
+    return pyperf.perf_counter() - t0
+
+
+def bench_inplace(loops, name, kind, n, op):
+    factory = CONTAINERS[name]
+    a = factory(data(kind, n)['keys'])
+    b = factory(data(kind, n)['other'])
+    op = getattr(operator, op)
+    elapsed = 0
+    for _ in range(loops):
+        c = copy(a)
+        t0 = pyperf.perf_counter()
+        op(c, b)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_add(loops, name, kind, n):
+    keys = data(kind, n)['keys']
+    elapsed = 0
+    for _ in range(loops):
+        c = CONTAINERS[name](())
+        add = c.add if hasattr(c, 'add') else c.setdefault
+        t0 = pyperf.perf_counter()
+        for k in keys:
+            add(k)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_getitem(loops, name, kind, n):
+    c = CONTAINERS[name](data(kind, n)['keys'])
+    positions = data(kind, n)['positions']
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        for i in positions:
+            c[i]
+    return pyperf.perf_counter() - t0
+
+
+def bench_index(loops, name, kind, n):
+    c = CONTAINERS[name](data(kind, n)['keys'])
+    hits = data(kind, n)['hits']
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        for k in hits:
+            c.index(k)
+    return pyperf.perf_counter() - t0
+
+
+def bench_slice(loops, name, kind, n, step):
+    c = CONTAINERS[name](data(kind, n)['keys'])
+    positions = data(kind, n)['positions'][:100]
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        if step == 1:
+            for i in positions:
+                c[i:i + OPS]
+        else:
+            c[::step]
+    return pyperf.perf_counter() - t0
+
+
+def bench_page(loops, name, kind, n, view):
+    c = CONTAINERS[name](data(kind, n)['keys'])
+    positions = data(kind, n)['positions'][:100]
+    pages = c.view if view else c
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        for i in positions:
+            for _ in pages[i:i + OPS]:
+                pass
+    return pyperf.perf_counter() - t0
+
+
+def bench_delete(loops, name, kind, n, pattern):
+    c0 = CONTAINERS[name](data(kind, n)['keys'])
+    hits = data(kind, n)['hits']
+    positions = data(kind, n)['positions']
+    ops = len(positions)
+    elapsed = 0
+    for _ in range(loops):
+        c = copy(c0)
+        if pattern == 'pop':
+            pop = c.popitem if isinstance(c, dict) else c.pop
+            t0 = pyperf.perf_counter()
+            for _ in range(ops):
+                pop()
+        elif pattern == 'pop0':
+            if isinstance(c, OrderedDict):
+                t0 = pyperf.perf_counter()
+                for _ in range(ops):
+                    c.popitem(last=False)
+            else:
+                t0 = pyperf.perf_counter()
+                for _ in range(ops):
+                    c.pop(0)
+        elif pattern == 'discard':
+            discard = c.discard if hasattr(c, 'discard') else c.pop
+            if isinstance(c, dict):
+                t0 = pyperf.perf_counter()
+                for k in hits:
+                    discard(k, None)
+            else:
+                t0 = pyperf.perf_counter()
+                for k in hits:
+                    discard(k)
+        elif pattern == 'delitem':
+            t0 = pyperf.perf_counter()
+            for i in positions:
+                del c[i]
+        elif pattern == 'delslice':
+            t0 = pyperf.perf_counter()
+            del c[n // 4:n // 4 + n // 2]
+        elif pattern == 'delslice_step2':
+            t0 = pyperf.perf_counter()
+            del c[::2]
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_iterate(loops, name, kind, n):
+    c = CONTAINERS[name](data(kind, n)['keys'])
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        for _ in c:
+            pass
+    return pyperf.perf_counter() - t0
+
+
+def bench_reversed(loops, name, kind, n):
+    c = CONTAINERS[name](data(kind, n)['keys'])
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        for _ in reversed(c):
+            pass
+    return pyperf.perf_counter() - t0
+
+
+def bench_list(loops, name, kind, n):
+    c = CONTAINERS[name](data(kind, n)['keys'])
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        list(c)
+    return pyperf.perf_counter() - t0
+
+
+def bench_pickle(loops, name, kind, n):
+    c = CONTAINERS[name](data(kind, n)['keys'])
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        pickle.loads(pickle.dumps(c, pickle.HIGHEST_PROTOCOL))
+    return pyperf.perf_counter() - t0
+
+
+ORDERED = ('orderedset', 'dict', 'OrderedDict')
+SETS = ('orderedset', 'set')
+BLOOM = ('orderedset', 'orderedset_bloom', 'set')
+
+# (operation, time function, extra arguments, containers)
+BENCHMARKS = [
+    ('construct', bench_construct, (), ORDERED + ('set',)),
+    ('contains_hit', bench_contains, ('hits',), ORDERED + ('set', 'orderedset_bloom')),
+    ('contains_miss', bench_contains, ('misses',), ORDERED + ('set', 'orderedset_bloom')),
+    ('isdisjoint', bench_isdisjoint, (), BLOOM),
+    ('add', bench_add, (), ORDERED + ('set',)),
+    ('or', bench_binary, ('or_',), SETS),
+    ('and', bench_binary, ('and_',), SETS),
+    ('sub', bench_binary, ('sub',), BLOOM),
+    ('xor', bench_binary, ('xor',), SETS),
+    ('eq_equal', bench_equal, ('copies',), ORDERED + ('set', 'list')),
+    ('eq_changed', bench_equal, ('changed',), ORDERED + ('set', 'list')),
+    ('ior', bench_inplace, ('ior',), SETS),
+    ('iand', bench_inplace, ('iand',), SETS),
+    ('isub', bench_inplace, ('isub',), SETS),
+    ('ixor', bench_inplace, ('ixor',), SETS),
+    ('getitem', bench_getitem, (), ('orderedset', 'list')),
+    ('index', bench_index, (), ('orderedset', 'list')),
+    ('slice', bench_slice, (1,), ('orderedset', 'list')),
+    ('slice_step2', bench_slice, (2,), ('orderedset', 'list')),
+    ('page', bench_page, (False,), ('orderedset', 'list')),
+    ('page_view', bench_page, (True,), ('orderedset',)),
+    ('pop', bench_delete, ('pop',), ORDERED + ('set',)),
+    ('pop0', bench_delete, ('pop0',), ('orderedset', 'OrderedDict', 'list')),
+    ('discard', bench_delete, ('discard',), ORDERED + ('set',)),
+    ('delitem', bench_delete, ('delitem',), ('orderedset', 'list')),
+    ('delslice', bench_delete, ('delslice',), ('orderedset', 'list')),
+    ('delslice_step2', bench_delete, ('delslice_step2',), ('orderedset', 'list')),
+    ('iterate', bench_iterate, (), ORDERED + ('set',)),
+    ('reversed', bench_reversed, (), ORDERED + ('list',)),
+    ('list', bench_list, (), ORDERED + ('set', 'list')),
+    ('pickle', bench_pickle, (), ORDERED + ('set',)),
+]
+
+
+def add_cmdline_args(cmd, args):
+    cmd.extend(('--sizes', args.sizes, '--key-types', args.key_types))
+    if args.filter:
+        cmd.extend(('--filter', args.filter))
+
+
+def main():
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    runner.metadata['description'] = 'bcse.collections.orderedset benchmarks'
+    runner.argparser.add_argument('--sizes', default=SIZES,
+                                  help='comma separated container sizes (default: %s)' % SIZES)
+    runner.argparser.add_argument('--key-types', default=KEY_TYPES,
+                                  help='comma separated key types (default: %s)' % KEY_TYPES)
+    runner.argparser.add_argument('--filter', default='',
+                                  help='only run benchmarks whose name contains this')
+    args = runner.parse_args()
+
+    for n in [int(size) for size in args.sizes.split(',')]:
+        for kind in args.key_types.split(','):
+            for op, func, extra, containers in BENCHMARKS:
+                for name in containers:
+                    bench = '%s/%s/%d/%s' % (name, kind, n, op)
+                    if args.filter not in bench:
+                        continue
+                    runner.bench_time_func(bench, func, name, kind, n, *extra)
+
+
+if __name__ == '__main__':
+    main()
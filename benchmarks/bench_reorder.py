@@ -0,0 +1,179 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_reorder
+----------------------------------
+
+Positional insert and relocation on `bcse.collections.orderedset` against a
+list (remove + insert) and OrderedDict.move_to_end, and whole-set sort(),
+reverse() and shuffle() against rebuilding the set from a sorted, reversed
+or shuffled list::
+
+    python benchmarks/bench_reorder.py -o reorder.json
+    python benchmarks/bench_reorder.py --sizes 1000000 --moves 1000000 -o reorder.json
+"""
+
+import random
+from collections import OrderedDict
+
+import pyperf
+
+from bcse.collections import orderedset
+from benchdata import make_keys
+
+
+SIZES = '1000,100000'
+MOVES = 10000
+
+
+_data = {}
+
+
+def data(n, moves):
+    try:
+        return _data[n, moves]
+    except KeyError:
+        pass
+    keys = make_keys('int', n)
+    rng = random.Random(n)
+    d = {
+        'keys': keys,
+        'moves': [(keys[rng.randrange(n)], rng.randrange(n)) for _ in range(moves)],
+        'new': make_keys('int', moves, base=n * 4),
+    }
+    _data[n, moves] = d
+    return d
+
+
+def bench_move(loops, n, moves, kind):
+    d = data(n, moves)
+    elapsed = 0
+    for _ in range(loops):
+        if kind == 'orderedset':
+            s = orderedset(d['keys'])
+            move = s.move
+            t0 = pyperf.perf_counter()
+            for k, i in d['moves']:
+                move(k, i)
+        else:
+            s = list(d['keys'])
+            t0 = pyperf.perf_counter()
+            for k, i in d['moves']:
+                s.remove(k)
+                s.insert(i, k)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_move_to_end(loops, n, moves, kind):
+    d = data(n, moves)
+    elapsed = 0
+    for _ in range(loops):
+        if kind == 'orderedset':
+            s = orderedset(d['keys'])
+        elif kind == 'OrderedDict':
+            s = OrderedDict.fromkeys(d['keys'])
+        else:
+            s = list(d['keys'])
+        t0 = pyperf.perf_counter()
+        if kind == 'list':
+            for k, i in d['moves']:
+                s.remove(k)
+                s.append(k)
+        else:
+            move_to_end = s.move_to_end
+            for k, i in d['moves']:
+                move_to_end(k)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_insert(loops, n, moves, kind):
+    d = data(n, moves)
+    positions = [i for k, i in d['moves']]
+    elapsed = 0
+    for _ in range(loops):
+        s = orderedset(d['keys']) if kind == 'orderedset' else list(d['keys'])
+        t0 = pyperf.perf_counter()
+        for k, i in zip(d['new'], positions):
+            s.insert(i, k)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_permute(loops, n, moves, kind, op):
+    d = data(n, moves)
+    elapsed = 0
+    for _ in range(loops):
+        s = orderedset(d['keys'])
+        t0 = pyperf.perf_counter()
+        if kind == 'orderedset':
+            if op == 'sort':
+                s.sort()
+            elif op == 'sort_key':
+                s.sort(key=abs, reverse=True)
+            elif op == 'reverse':
+                s.reverse()
+            else:
+                s.shuffle(random.Random(n))
+        else:
+            if op == 'sort':
+                s = orderedset(sorted(s))
+            elif op == 'sort_key':
+                s = orderedset(sorted(s, key=abs, reverse=True))
+            elif op == 'reverse':
+                s = orderedset(reversed(s))
+            else:
+                keys = list(s)
+                random.Random(n).shuffle(keys)
+                s = orderedset(keys)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_sort(loops, n, moves, kind):
+    return bench_permute(loops, n, moves, kind, 'sort')
+
+
+def bench_sort_key(loops, n, moves, kind):
+    return bench_permute(loops, n, moves, kind, 'sort_key')
+
+
+def bench_reverse(loops, n, moves, kind):
+    return bench_permute(loops, n, moves, kind, 'reverse')
+
+
+def bench_shuffle(loops, n, moves, kind):
+    return bench_permute(loops, n, moves, kind, 'shuffle')
+
+
+BENCHMARKS = [
+    ('move', bench_move, ('orderedset', 'list')),
+    ('move_to_end', bench_move_to_end, ('orderedset', 'OrderedDict', 'list')),
+    ('insert', bench_insert, ('orderedset', 'list')),
+    ('sort', bench_sort, ('orderedset', 'rebuild')),
+    ('sort_key', bench_sort_key, ('orderedset', 'rebuild')),
+    ('reverse', bench_reverse, ('orderedset', 'rebuild')),
+    ('shuffle', bench_shuffle, ('orderedset', 'rebuild')),
+]
+
+
+def add_cmdline_args(cmd, args):
+    cmd.extend(('--sizes', args.sizes, '--moves', str(args.moves)))
+
+
+def main():
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    runner.argparser.add_argument('--sizes', default=SIZES)
+    runner.argparser.add_argument('--moves', type=int, default=MOVES)
+    args = runner.parse_args()
+
+    for n in [int(size) for size in args.sizes.split(',')]:
+        for op, func, kinds in BENCHMARKS:
+            for kind in kinds:
+                runner.bench_time_func('%s/%d/%s' % (kind, n, op), func, n, args.moves, kind)
+
+
+if __name__ == '__main__':
+    main()
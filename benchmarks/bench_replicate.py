@@ -0,0 +1,91 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_replicate
+----------------------------------
+
+Bringing a replica of a `bcse.collections.orderedset` up to date after a
+batch of adds and discards: pickling the whole set against shipping
+delta_since() and replaying it with apply_delta(). The add benchmarks show
+what track_changes() costs the set being changed::
+
+    python benchmarks/bench_replicate.py -o replicate.json
+    python benchmarks/bench_replicate.py --sizes 100000 --changes 100 -o replicate.json
+"""
+
+import pickle
+
+import pyperf
+
+from bcse.collections import orderedset
+from benchdata import make_keys
+
+
+SIZES = '1000000'
+CHANGES = 1000
+
+
+def changed(n, changes, track):
+    keys = make_keys('int', n + changes)
+    primary = orderedset(keys[:n])
+    version = primary.track_changes() if track else None
+    for i in range(changes // 2):
+        primary.add(keys[n + i])
+        primary.discard(keys[i])
+    return primary, version, keys[:n]
+
+
+def bench_sync(loops, n, changes, how):
+    primary, version, keys = changed(n, changes, how == 'delta')
+    elapsed = 0
+    for _ in range(loops):
+        replica = orderedset(keys)
+        t0 = pyperf.perf_counter()
+        if how == 'delta':
+            replica.apply_delta(pickle.loads(pickle.dumps(primary.delta_since(version), -1)))
+        else:
+            replica = pickle.loads(pickle.dumps(primary, -1))
+        elapsed += pyperf.perf_counter() - t0
+    assert list(replica) == list(primary)
+    return elapsed
+
+
+def bench_add(loops, n, track):
+    keys = make_keys('int', n)
+    elapsed = 0
+    for _ in range(loops):
+        s = orderedset()
+        if track:
+            s.track_changes()
+        add = s.add
+        t0 = pyperf.perf_counter()
+        for key in keys:
+            add(key)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def add_cmdline_args(cmd, args):
+    cmd.extend(('--sizes', args.sizes, '--changes', str(args.changes)))
+
+
+def main():
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    runner.metadata['description'] = 'orderedset replication by delta against pickling'
+    runner.argparser.add_argument('--sizes', default=SIZES,
+                                  help='comma separated set sizes (default: %s)' % SIZES)
+    runner.argparser.add_argument('--changes', type=int, default=CHANGES,
+                                  help='changes between syncs (default: %d)' % CHANGES)
+    args = runner.parse_args()
+
+    for n in [int(size) for size in args.sizes.split(',')]:
+        for how in ('pickle', 'delta'):
+            runner.bench_time_func('%s/%d/sync' % (how, n), bench_sync, n, args.changes, how)
+        for track in (False, True):
+            runner.bench_time_func('%s/%d/add' % ('tracked' if track else 'orderedset', n),
+                                   bench_add, n, track, inner_loops=n)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,155 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_sorted
+----------------------------------
+
+Sorted queries on `bcse.collections.orderedset` against the usual
+alternative of keeping a sorted list next to the set and querying it with
+the bisect module::
+
+    python benchmarks/bench_sorted.py -o sorted.json
+"""
+
+import bisect
+import random
+
+import pyperf
+
+from bcse.collections import orderedset
+from benchdata import make_keys
+
+
+SIZES = '1000,100000,1000000'
+QUERIES = 1000
+WIDTH = 100
+
+
+_data = {}
+
+
+def data(n):
+    try:
+        return _data[n]
+    except KeyError:
+        pass
+    keys = make_keys('int', n)
+    rng = random.Random(n)
+    s = orderedset(keys)
+    s.bisect_left(0)  # build the sorted index outside of the timings
+    d = {
+        'keys': keys,
+        'set': s,
+        'list': sorted(keys),
+        'queries': [rng.randrange(n * 4) for _ in range(QUERIES)],
+        'updates': make_keys('int', QUERIES, base=n * 4),
+    }
+    _data[n] = d
+    return d
+
+
+def bench_bisect(loops, n, kind):
+    d = data(n)
+    queries = d['queries']
+    t0 = pyperf.perf_counter()
+    if kind == 'orderedset':
+        bisect_left = d['set'].bisect_left
+        for _ in range(loops):
+            for q in queries:
+                bisect_left(q)
+    else:
+        lst = d['list']
+        for _ in range(loops):
+            for q in queries:
+                bisect.bisect_left(lst, q)
+    return pyperf.perf_counter() - t0
+
+
+def bench_irange(loops, n, kind):
+    d = data(n)
+    queries = d['queries']
+    t0 = pyperf.perf_counter()
+    if kind == 'orderedset':
+        irange = d['set'].irange
+        for _ in range(loops):
+            for q in queries:
+                for x in irange(q, q + WIDTH):
+                    pass
+    else:
+        lst = d['list']
+        for _ in range(loops):
+            for q in queries:
+                lo = bisect.bisect_left(lst, q)
+                hi = bisect.bisect_right(lst, q + WIDTH)
+                for x in lst[lo:hi]:
+                    pass
+    return pyperf.perf_counter() - t0
+
+
+def bench_sorted_iter(loops, n, kind):
+    d = data(n)
+    s = d['set']
+    t0 = pyperf.perf_counter()
+    if kind == 'orderedset':
+        for _ in range(loops):
+            for x in s.sorted_iter():
+                pass
+    else:
+        for _ in range(loops):
+            for x in sorted(s):
+                pass
+    return pyperf.perf_counter() - t0
+
+
+def bench_maintain(loops, n, kind):
+    """Add then discard keys while keeping the sorted view current."""
+    d = data(n)
+    updates = d['updates']
+    s = d['set']
+    elapsed = 0
+    for _ in range(loops):
+        if kind == 'orderedset':
+            t0 = pyperf.perf_counter()
+            for k in updates:
+                s.add(k)
+            for k in updates:
+                s.discard(k)
+        else:
+            lst = d['list']
+            t0 = pyperf.perf_counter()
+            for k in updates:
+                s.add(k)
+                bisect.insort(lst, k)
+            for k in updates:
+                s.discard(k)
+                del lst[bisect.bisect_left(lst, k)]
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+BENCHMARKS = [
+    ('bisect_left', bench_bisect),
+    ('irange', bench_irange),
+    ('sorted_iter', bench_sorted_iter),
+    ('maintain', bench_maintain),
+]
+
+
+def add_cmdline_args(cmd, args):
+    cmd.extend(('--sizes', args.sizes))
+
+
+def main():
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    runner.argparser.add_argument('--sizes', default=SIZES)
+    args = runner.parse_args()
+
+    for n in [int(size) for size in args.sizes.split(',')]:
+        for op, func in BENCHMARKS:
+            for kind in ('orderedset', 'sorted+bisect'):
+                runner.bench_time_func('%s/%d/%s' % (kind, n, op), func, n, kind)
+
+
+if __name__ == '__main__':
+    main()
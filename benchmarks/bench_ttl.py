@@ -0,0 +1,99 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_ttl
+----------------------------------
+
+Streaming dedup with expiry: every event adds one ID and the logical clock
+advances by one. Compares `orderedset(ttl=...)` with a sidecar dict of
+timestamps that is scanned for expired IDs every `--scan-every` events::
+
+    python benchmarks/bench_ttl.py -o ttl.json
+"""
+
+import random
+
+import pyperf
+
+from bcse.collections import orderedset
+from benchdata import SEED
+
+
+TTL = 100000
+EVENTS = 200000
+SCAN_EVERY = 10000
+HIT_RATIO = 0.3
+
+
+def make_stream(ttl, events, hit_ratio):
+    rng = random.Random(SEED)
+    stream = []
+    new = 0
+    for _ in range(events):
+        if new and rng.random() < hit_ratio:
+            stream.append(new - 1 - rng.randrange(min(new, 2 * ttl)))
+        else:
+            stream.append(new)
+            new += 1
+    return stream
+
+
+def bench_orderedset(loops, ttl, stream):
+    elapsed = 0
+    for _ in range(loops):
+        now = [0]
+        s = orderedset(ttl=ttl, clock=lambda: now[0])
+        add = s.add
+        t0 = pyperf.perf_counter()
+        for t, x in enumerate(stream):
+            now[0] = t
+            add(x)
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def bench_sidecar(loops, ttl, stream, scan_every):
+    elapsed = 0
+    for _ in range(loops):
+        s = orderedset()
+        stamps = {}
+        t0 = pyperf.perf_counter()
+        for t, x in enumerate(stream):
+            if x in stamps and stamps[x] <= t - ttl:
+                s.discard(x)
+                del stamps[x]
+            if x not in stamps:
+                s.add(x)
+                stamps[x] = t
+            if t % scan_every == 0:
+                expired = [k for k, v in stamps.items() if v <= t - ttl]
+                for k in expired:
+                    s.discard(k)
+                    del stamps[k]
+        elapsed += pyperf.perf_counter() - t0
+    return elapsed
+
+
+def add_cmdline_args(cmd, args):
+    cmd.extend(('--ttl', str(args.ttl), '--events', str(args.events),
+                '--scan-every', str(args.scan_every), '--hit-ratio', str(args.hit_ratio)))
+
+
+def main():
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    runner.argparser.add_argument('--ttl', type=int, default=TTL)
+    runner.argparser.add_argument('--events', type=int, default=EVENTS)
+    runner.argparser.add_argument('--scan-every', type=int, default=SCAN_EVERY)
+    runner.argparser.add_argument('--hit-ratio', type=float, default=HIT_RATIO)
+    args = runner.parse_args()
+
+    stream = make_stream(args.ttl, args.events, args.hit_ratio)
+    runner.bench_time_func('orderedset/%d/ttl' % args.ttl, bench_orderedset,
+                           args.ttl, stream, inner_loops=len(stream))
+    runner.bench_time_func('sidecar/%d/scan' % args.ttl, bench_sidecar,
+                           args.ttl, stream, args.scan_every, inner_loops=len(stream))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,91 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+bench_unique
+----------------------------------
+
+Time to the first item, time to exhaust and traced peak memory of
+`bcse.collections.unique` against iterating `orderedset(stream)`. The
+stream is a generator yielding every key twice. Results are written as
+JSON::
+
+    python benchmarks/bench_unique.py -o unique.json
+"""
+
+import argparse
+import json
+import sys
+import time
+import tracemalloc
+
+from bcse.collections import orderedset, unique
+from benchdata import make_keys
+
+
+def stream(keys):
+    for k in keys:
+        yield k
+        yield k
+
+
+APPROACHES = {
+    'orderedset': lambda s, maxmemory: iter(orderedset(s)),
+    'unique': lambda s, maxmemory: unique(s),
+    'unique_bounded': lambda s, maxmemory: unique(s, maxmemory=maxmemory),
+}
+
+
+def measure(name, kind, n, maxmemory):
+    keys = make_keys(kind, n)
+
+    t0 = time.perf_counter()
+    it = APPROACHES[name](stream(keys), maxmemory)
+    next(it)
+    first = time.perf_counter() - t0
+    for _ in it:
+        pass
+    total = time.perf_counter() - t0
+
+    tracemalloc.start()
+    for _ in APPROACHES[name](stream(keys), maxmemory):
+        pass
+    peak = tracemalloc.get_traced_memory()[1]
+    tracemalloc.stop()
+    return {
+        'approach': name,
+        'key_type': kind,
+        'size': n,
+        'first_item': first,
+        'total_time': total,
+        'traced_peak': peak,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[-1])
+    parser.add_argument('--sizes', default='100000,1000000')
+    parser.add_argument('--key-types', default='int,str')
+    parser.add_argument('--maxmemory', type=int, default=1 << 20,
+                        help='byte budget for unique_bounded')
+    parser.add_argument('-o', '--output', help='write JSON results here')
+    args = parser.parse_args()
+
+    results = []
+    for n in args.sizes.split(','):
+        for kind in args.key_types.split(','):
+            for name in APPROACHES:
+                result = measure(name, kind, int(n), args.maxmemory)
+                results.append(result)
+                sys.stderr.write('%(approach)s/%(key_type)s/%(size)d: first %(first_item).6fs, '
+                                 'total %(total_time).6fs, peak %(traced_peak)d\n' % result)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+    else:
+        json.dump(results, sys.stdout, indent=2)
+
+
+if __name__ == '__main__':
+    main()
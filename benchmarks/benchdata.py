@@ -0,0 +1,22 @@
+# -*- coding: utf-8 -*-
+
+"""Deterministic key generation shared by the benchmark scripts."""
+
+import random
+
+
+SEED = 20131231
+
+
+def make_keys(kind, n, seed=SEED, base=0):
+    """Return n distinct keys of the given kind ('int', 'str' or 'tuple') in
+    a random but reproducible order, drawn from [base, base + 4 * n)."""
+    rng = random.Random(seed)
+    ints = [base + i for i in rng.sample(range(n * 4), n)]
+    if kind == 'int':
+        return ints
+    elif kind == 'str':
+        return ['key:%d' % i for i in ints]
+    elif kind == 'tuple':
+        return [(i, 'key:%d' % i) for i in ints]
+    raise ValueError('unknown key type %r' % kind)
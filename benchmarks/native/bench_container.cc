@@ -0,0 +1,335 @@
+/*
+ * Native microbenchmarks for the ordered_set container in orderedsetobject.h.
+ *
+ * The interpreter is embedded only to provide real PyLong keys; the
+ * benchmarks drive the container directly so the costs measured are
+ * those of the storage engine, not of argument parsing or method dispatch.
+ * Where perf_event_open is available each benchmark also reports cycles,
+ * cache misses and branch misses per iteration.
+ *
+ * Build and run with `make bench-native`.
+ */
+#include <Python.h>
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "orderedsetobject.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+/***** Hardware counters ***********************************************/
+
+class perf_counters {
+public:
+    enum { CYCLES, CACHE_MISSES, BRANCH_MISSES, NCOUNTERS };
+
+    perf_counters()
+    {
+        for (int i = 0; i < NCOUNTERS; i++) {
+            fds[i] = -1;
+            values[i] = 0;
+        }
+#ifdef __linux__
+        static const unsigned long long configs[NCOUNTERS] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+        for (int i = 0; i < NCOUNTERS; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+    }
+
+    ~perf_counters()
+    {
+#ifdef __linux__
+        for (int i = 0; i < NCOUNTERS; i++)
+            if (fds[i] != -1)
+                close(fds[i]);
+#endif
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        for (int i = 0; i < NCOUNTERS; i++) {
+            if (fds[i] != -1) {
+                ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void stop()
+    {
+#ifdef __linux__
+        for (int i = 0; i < NCOUNTERS; i++) {
+            if (fds[i] != -1) {
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fds[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+                    values[i] = 0;
+            }
+        }
+#endif
+    }
+
+    // Attach the counts to the benchmark, averaged over its iterations.
+    void report(benchmark::State &state) const
+    {
+        static const char *names[NCOUNTERS] = {
+            "cycles", "cache_misses", "branch_misses"
+        };
+        for (int i = 0; i < NCOUNTERS; i++) {
+            if (fds[i] != -1)
+                state.counters[names[i]] = benchmark::Counter(
+                    (double)values[i], benchmark::Counter::kAvgIterations);
+        }
+    }
+
+private:
+    int fds[NCOUNTERS];
+    unsigned long long values[NCOUNTERS];
+};
+
+/***** Fixtures ********************************************************/
+
+// n distinct PyLong keys in a fixed pseudo random order.
+static std::vector<PyObject *>
+make_keys(Py_ssize_t n, unsigned seed = 20131231)
+{
+    std::vector<PyObject *> keys;
+    std::mt19937_64 rng(seed);
+
+    keys.reserve(n);
+    for (Py_ssize_t i = 0; i < n; i++)
+        keys.push_back(PyLong_FromLongLong((long long)(rng() >> 2)));
+    return keys;
+}
+
+static void
+release_keys(std::vector<PyObject *> &keys)
+{
+    for (size_t i = 0; i < keys.size(); i++)
+        Py_DECREF(keys[i]);
+}
+
+static void
+fill(ordered_set &oset, const std::vector<PyObject *> &keys)
+{
+    for (size_t i = 0; i < keys.size(); i++)
+        oset.push_back(ordered_set::value_type(keys[i], PyObject_Hash(keys[i])));
+}
+
+/***** Benchmarks ******************************************************/
+
+static void
+BM_Build(benchmark::State &state)
+{
+    std::vector<PyObject *> keys = make_keys(state.range(0));
+    perf_counters perf;
+
+    perf.start();
+    for (auto _ : state) {
+        ordered_set oset;
+        fill(oset, keys);
+        benchmark::DoNotOptimize(oset.size());
+    }
+    perf.stop();
+    perf.report(state);
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    release_keys(keys);
+}
+BENCHMARK(BM_Build)->Range(1 << 10, 1 << 20);
+
+static void
+BM_FindHit(benchmark::State &state)
+{
+    std::vector<PyObject *> keys = make_keys(state.range(0));
+    ordered_set oset;
+    fill(oset, keys);
+    std::vector<ordered_set_probe> probes;
+    for (size_t i = 0; i < keys.size(); i++) {
+        ordered_set_probe probe = {keys[i], PyObject_Hash(keys[i])};
+        probes.push_back(probe);
+    }
+    std::shuffle(probes.begin(), probes.end(), std::mt19937_64(1));
+    perf_counters perf;
+    size_t i = 0;
+
+    perf.start();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(oset.find(probes[i], ordered_set_hash(), ordered_set_equal()));
+        if (++i == probes.size())
+            i = 0;
+    }
+    perf.stop();
+    perf.report(state);
+    oset.clear();
+    release_keys(keys);
+}
+BENCHMARK(BM_FindHit)->Range(1 << 10, 1 << 22);
+
+static void
+BM_FindMiss(benchmark::State &state)
+{
+    std::vector<PyObject *> keys = make_keys(state.range(0));
+    std::vector<PyObject *> misses = make_keys(4096, 7);
+    ordered_set oset;
+    fill(oset, keys);
+    std::vector<ordered_set_probe> probes;
+    for (size_t i = 0; i < misses.size(); i++) {
+        ordered_set_probe probe = {misses[i], PyObject_Hash(misses[i])};
+        probes.push_back(probe);
+    }
+    perf_counters perf;
+    size_t i = 0;
+
+    perf.start();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(oset.find(probes[i], ordered_set_hash(), ordered_set_equal()));
+        if (++i == probes.size())
+            i = 0;
+    }
+    perf.stop();
+    perf.report(state);
+    oset.clear();
+    release_keys(misses);
+    release_keys(keys);
+}
+BENCHMARK(BM_FindMiss)->Range(1 << 10, 1 << 22);
+
+static void
+BM_RandomIndex(benchmark::State &state)
+{
+    std::vector<PyObject *> keys = make_keys(state.range(0));
+    ordered_set oset;
+    fill(oset, keys);
+    ordered_set &set = oset;
+    std::vector<size_t> positions;
+    std::mt19937_64 rng(2);
+    for (int i = 0; i < 4096; i++)
+        positions.push_back(rng() % keys.size());
+    perf_counters perf;
+    size_t i = 0;
+
+    perf.start();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(set[positions[i]].key);
+        if (++i == positions.size())
+            i = 0;
+    }
+    perf.stop();
+    perf.report(state);
+    oset.clear();
+    release_keys(keys);
+}
+BENCHMARK(BM_RandomIndex)->Range(1 << 10, 1 << 22);
+
+static void
+BM_Iterate(benchmark::State &state)
+{
+    std::vector<PyObject *> keys = make_keys(state.range(0));
+    ordered_set oset;
+    fill(oset, keys);
+    ordered_set &set = oset;
+    perf_counters perf;
+
+    perf.start();
+    for (auto _ : state) {
+        for (ordered_set::iterator it = set.begin(); it != set.end(); ++it)
+            benchmark::DoNotOptimize(it->key);
+    }
+    perf.stop();
+    perf.report(state);
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    oset.clear();
+    release_keys(keys);
+}
+BENCHMARK(BM_Iterate)->Range(1 << 10, 1 << 22);
+
+// Erase one element at the given relative position and put it back at the
+// end, which measures the shift within the leaf it is erased from.
+static void
+BM_EraseReinsert(benchmark::State &state)
+{
+    std::vector<PyObject *> keys = make_keys(state.range(0));
+    ordered_set oset;
+    fill(oset, keys);
+    ordered_set &set = oset;
+    size_t pos = set.size() * state.range(1) / 100;
+    perf_counters perf;
+
+    if (pos == set.size())
+        pos--;
+    perf.start();
+    for (auto _ : state) {
+        PyObject *key = set[pos].key;
+        Py_INCREF(key);
+        set.erase(pos);
+        set.push_back(ordered_set::value_type(key, PyObject_Hash(key)));
+        Py_DECREF(key);
+    }
+    perf.stop();
+    perf.report(state);
+    oset.clear();
+    release_keys(keys);
+}
+BENCHMARK(BM_EraseReinsert)
+    ->ArgsProduct({benchmark::CreateRange(1 << 10, 1 << 20, 32), {0, 50, 100}});
+
+// Move a random element to a random position, as orderedset.move() does.
+static void
+BM_Move(benchmark::State &state)
+{
+    std::vector<PyObject *> keys = make_keys(state.range(0));
+    ordered_set oset;
+    fill(oset, keys);
+    std::vector<std::pair<size_t, size_t> > moves;
+    std::mt19937_64 rng(3);
+    for (int i = 0; i < 4096; i++)
+        moves.push_back(std::make_pair(rng() % keys.size(), rng() % keys.size()));
+    perf_counters perf;
+    size_t i = 0;
+
+    perf.start();
+    for (auto _ : state) {
+        oset.move(moves[i].first, moves[i].second);
+        if (++i == moves.size())
+            i = 0;
+    }
+    perf.stop();
+    perf.report(state);
+    oset.clear();
+    release_keys(keys);
+}
+BENCHMARK(BM_Move)->Range(1 << 10, 1 << 22);
+
+int
+main(int argc, char **argv)
+{
+    Py_Initialize();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    Py_Finalize();
+    return 0;
+}
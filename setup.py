@@ -13,6 +13,11 @@ except ImportError:
 
 BOOST_PATH = os.environ.get('BOOST_PATH', '.')
 
+# Build with hot path counters, see bcse.collections.profile()
+DEFINE_MACROS = []
+if os.environ.get('ORDEREDSET_PROFILE'):
+    DEFINE_MACROS.append(('ORDEREDSET_PROFILE', None))
+
 
 if sys.argv[-1] == 'publish':
     os.system('python setup.py sdist upload')
@@ -33,9 +38,12 @@ setup(
     package_dir={'bcse': 'bcse'},
     ext_modules=[
         Extension('bcse.collections',
-            sources=['src/collectionsmodule.cc', 'src/orderedsetobject.cc'],
-            depends=['src/orderedsetobject.h'],
-            include_dirs=[BOOST_PATH]),
+            sources=['src/collectionsmodule.cc', 'src/orderedsetobject.cc',
+                     'src/orderedmapobject.cc'],
+            depends=['src/arenaallocator.h', 'src/orderedindex.h',
+                     'src/orderedmapobject.h', 'src/orderedsetobject.h'],
+            include_dirs=[BOOST_PATH],
+            define_macros=DEFINE_MACROS),
     ],
     include_package_data=True,
     install_requires=[
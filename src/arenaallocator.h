@@ -0,0 +1,303 @@
+#ifndef orderedset_arenaallocator_h
+#define orderedset_arenaallocator_h
+
+#include <Python.h>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#ifndef ORDEREDSET_COUNT
+#define ORDEREDSET_COUNT(counter) ((void)0)
+#endif
+
+#if PY_VERSION_HEX < 0x03040000
+#define PyMem_RawMalloc malloc
+#define PyMem_RawFree free
+#endif
+#if PY_VERSION_HEX < 0x03050000
+#define PyMem_RawCalloc calloc
+#endif
+
+/*
+ * Raw memory sources. Arena blocks and the index arrays (hash buckets,
+ * random access pointers, leaves of the order) are requested from one of
+ * these.
+ */
+struct pymem_raw_backend {
+    static void *malloc(std::size_t n) { return PyMem_RawMalloc(n); }
+    static void *calloc(std::size_t n) { return PyMem_RawCalloc(n, 1); }
+    static void free(void *p) { PyMem_RawFree(p); }
+};
+
+struct pyobject_backend {
+    static void *malloc(std::size_t n) { return PyObject_Malloc(n); }
+#if PY_VERSION_HEX < 0x03050000
+    static void *calloc(std::size_t n)
+    {
+        void *p = PyObject_Malloc(n);
+        return p != NULL ? std::memset(p, 0, n) : NULL;
+    }
+#else
+    static void *calloc(std::size_t n) { return PyObject_Calloc(n, 1); }
+#endif
+    static void free(void *p) { PyObject_Free(p); }
+};
+
+/*
+ * Slab arena shared by every rebound copy of an arena_allocator.
+ *
+ * Small requests (container nodes) are carved from blocks that grow
+ * geometrically and are recycled through per-size free lists; they are
+ * only given back to the backend when the arena itself dies, i.e. when the
+ * last container using it is cleared or deallocated. Larger requests are
+ * passed straight to the backend.
+ */
+template <typename Backend>
+class arena {
+public:
+    enum {
+        align = sizeof(void *),
+        max_chunk = 128,
+        nclasses = max_chunk / align,
+        first_block = 1024,
+        max_block = 1024 * 1024
+    };
+
+    static arena *create()
+    {
+        void *p = Backend::malloc(sizeof(arena));
+        if (p == NULL)
+            throw std::bad_alloc();
+        return new (p) arena();
+    }
+
+    void incref() { refcnt++; }
+
+    void decref()
+    {
+        if (--refcnt == 0) {
+            this->~arena();
+            Backend::free(this);
+        }
+    }
+
+    void *allocate(std::size_t n)
+    {
+        void *p;
+
+        allocations++;
+        ORDEREDSET_COUNT(allocations);
+        if (n > max_chunk) {
+            p = Backend::malloc(n);
+            if (p == NULL)
+                throw std::bad_alloc();
+            large_bytes += n;
+            return p;
+        }
+
+        std::size_t cls = (n + align - 1) / align - 1;
+        if (free_lists[cls] != NULL) {
+            p = free_lists[cls];
+            free_lists[cls] = free_lists[cls]->next;
+        }
+        else {
+            std::size_t size = (cls + 1) * align;
+            if (cursor + size > limit)
+                grow(size);
+            p = cursor;
+            cursor += size;
+        }
+        used_bytes += (cls + 1) * align;
+        return p;
+    }
+
+    /* Zeroed memory. Large requests get it from the backend's calloc,
+     * which for big arrays maps fresh pages the kernel zeroes as they are
+     * first touched, rather than clearing them all up front. */
+    void *allocate_zeroed(std::size_t n)
+    {
+        if (n <= max_chunk)
+            return std::memset(allocate(n), 0, n);
+        allocations++;
+        ORDEREDSET_COUNT(allocations);
+        void *p = Backend::calloc(n);
+        if (p == NULL)
+            throw std::bad_alloc();
+        large_bytes += n;
+        return p;
+    }
+
+    void deallocate(void *p, std::size_t n)
+    {
+        if (n > max_chunk) {
+            Backend::free(p);
+            large_bytes -= n;
+            return;
+        }
+
+        std::size_t cls = (n + align - 1) / align - 1;
+        chunk *c = static_cast<chunk *>(p);
+        c->next = free_lists[cls];
+        free_lists[cls] = c;
+        used_bytes -= (cls + 1) * align;
+    }
+
+    /* Bytes held in slab blocks, whether in use or not. */
+    std::size_t reserved() const { return block_bytes; }
+    /* Bytes of slab chunks currently handed out. */
+    std::size_t used() const { return used_bytes; }
+    /* Bytes handed out directly by the backend (index arrays). */
+    std::size_t large() const { return large_bytes; }
+    std::size_t nblocks() const { return block_count; }
+    std::size_t nallocations() const { return allocations; }
+
+private:
+    struct chunk { chunk *next; };
+    struct block { block *next; std::size_t size; };
+
+    arena()
+        : refcnt(1), blocks(NULL), cursor(NULL), limit(NULL),
+          next_block(first_block), block_count(0), block_bytes(0),
+          used_bytes(0), large_bytes(0), allocations(0)
+    {
+        for (int i = 0; i < nclasses; i++)
+            free_lists[i] = NULL;
+    }
+
+    ~arena()
+    {
+        while (blocks != NULL) {
+            block *next = blocks->next;
+            Backend::free(blocks);
+            blocks = next;
+        }
+    }
+
+    arena(const arena &);
+    arena &operator=(const arena &);
+
+    void grow(std::size_t size)
+    {
+        std::size_t header = (sizeof(block) + align - 1) / align * align;
+        std::size_t bytes = next_block;
+        if (bytes < header + size)
+            bytes = header + size;
+
+        block *b = static_cast<block *>(Backend::malloc(bytes));
+        if (b == NULL)
+            throw std::bad_alloc();
+        b->next = blocks;
+        b->size = bytes;
+        blocks = b;
+        cursor = reinterpret_cast<char *>(b) + header;
+        limit = reinterpret_cast<char *>(b) + bytes;
+
+        block_count++;
+        block_bytes += bytes;
+        if (next_block < max_block)
+            next_block *= 2;
+    }
+
+    Py_ssize_t refcnt;
+    chunk *free_lists[nclasses];
+    block *blocks;
+    char *cursor;
+    char *limit;
+    std::size_t next_block;
+    std::size_t block_count;
+    std::size_t block_bytes;
+    std::size_t used_bytes;
+    std::size_t large_bytes;
+    std::size_t allocations;
+};
+
+/*
+ * Stateful allocator handing out memory from a reference counted arena.
+ *
+ * Containers built with a default constructed allocator get an arena of
+ * their own; copy construction selects a fresh arena as well, while swaps
+ * and moves carry the arena along with the nodes it owns.
+ */
+template <typename T, typename Backend = pymem_raw_backend>
+class arena_allocator {
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef ::arena<Backend> arena_type;
+
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
+    template <typename U>
+    struct rebind {
+        typedef arena_allocator<U, Backend> other;
+    };
+
+    arena_allocator() : a(arena_type::create()) {}
+
+    arena_allocator(const arena_allocator &x) : a(x.a)
+    {
+        a->incref();
+    }
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U, Backend> &x) : a(x.get_arena())
+    {
+        a->incref();
+    }
+
+    ~arena_allocator()
+    {
+        a->decref();
+    }
+
+    arena_allocator &operator=(const arena_allocator &x)
+    {
+        x.a->incref();
+        a->decref();
+        a = x.a;
+        return *this;
+    }
+
+    pointer allocate(size_type n)
+    {
+        return static_cast<pointer>(a->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(pointer p, size_type n)
+    {
+        a->deallocate(p, n * sizeof(T));
+    }
+
+    arena_allocator select_on_container_copy_construction() const
+    {
+        return arena_allocator();
+    }
+
+    arena_type *get_arena() const { return a; }
+
+    template <typename U>
+    bool operator==(const arena_allocator<U, Backend> &x) const
+    {
+        return a == x.get_arena();
+    }
+
+    template <typename U>
+    bool operator!=(const arena_allocator<U, Backend> &x) const
+    {
+        return a != x.get_arena();
+    }
+
+private:
+    arena_type *a;
+};
+
+#endif
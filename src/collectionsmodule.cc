@@ -1,7 +1,19 @@
 #include <Python.h>
 #include "orderedsetobject.h"
+#include "orderedmapobject.h"
+
+#ifdef ORDEREDSET_PROFILE
+PyDoc_STRVAR(profile_doc,
+"profile(reset=False) -> dict\n\
+\n\
+Return the orderedset hot path counters and latency histograms. Bin i of\n\
+each histogram counts calls that took about 2**i nanoseconds.");
+#endif
 
 static PyMethodDef module_methods[] = {
+#ifdef ORDEREDSET_PROFILE
+    {"profile", (PyCFunction)PyOrderedSet_Profile, METH_VARARGS, profile_doc},
+#endif
     {NULL}  /* Sentinel */
 };
 
@@ -34,6 +46,10 @@ initcollections(void)
 
     if (PyType_Ready(&PyOrderedSet_Type) < 0)
         goto done;
+    if (PyType_Ready(&PyOrderedSetUnique_Type) < 0)
+        goto done;
+    if (PyType_Ready(&PyOrderedMap_Type) < 0)
+        goto done;
 
 #if PY_MAJOR_VERSION > 2
     m = PyModule_Create(&collections_module);
@@ -46,6 +62,10 @@ initcollections(void)
 
     Py_INCREF(&PyOrderedSet_Type);
     PyModule_AddObject(m, "orderedset", (PyObject *)&PyOrderedSet_Type);
+    Py_INCREF(&PyOrderedSetUnique_Type);
+    PyModule_AddObject(m, "unique", (PyObject *)&PyOrderedSetUnique_Type);
+    Py_INCREF(&PyOrderedMap_Type);
+    PyModule_AddObject(m, "orderedmap", (PyObject *)&PyOrderedMap_Type);
 
 done:
 #if PY_MAJOR_VERSION > 2
@@ -0,0 +1,1033 @@
+#ifndef orderedset_orderedindex_h
+#define orderedset_orderedindex_h
+
+#include <Python.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <vector>
+
+#include "arenaallocator.h"
+
+/*
+ * Hash index over entries kept in an order of their own, the container
+ * behind orderedset.
+ *
+ * Entries live in nodes carved from the container's arena and are chained
+ * into a prime sized bucket array for lookups. The array grows
+ * incrementally: a new one takes every insert while each insert or erase
+ * moves a few buckets of the old one over, and lookups check both until
+ * the old one is empty, so no single change rehashes every entry.
+ *
+ * The order is a counted B+ tree: leaves hold up to leaf_size node
+ * pointers in order, inner nodes up to fanout children along with the
+ * number of entries under each. Reaching, inserting, erasing or moving the
+ * entry at any position walks one root to leaf path and shifts pointers
+ * within one leaf, O(fanout * log(n) + leaf_size), where a flat pointer
+ * array would shift up to n pointers. It grows a leaf at a time. Nodes
+ * know their leaf and tree nodes their parent, so the position of an entry
+ * found by hash is one leaf scan plus the counts left of its path.
+ *
+ * Iterators are positions: they stay valid across changes the way indices
+ * do, and may end up on another entry.
+ */
+template <typename Entry, typename Hash, typename Backend>
+class ordered_index {
+public:
+    typedef Entry value_type;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef ::arena<Backend> arena_type;
+
+    enum {
+        leaf_size = 256,
+        fanout = 64,
+        // Old buckets moved per insert or erase during a rehash. With the
+        // array at least doubling, the move ends well before the next one
+        // is due.
+        rehash_step = 4
+    };
+
+private:
+    struct leaf;
+    struct inner;
+
+    struct node {
+        Entry entry;
+        // Next node in the same bucket.
+        node *next;
+        // Leaf holding the node.
+        leaf *owner;
+
+        explicit node(const Entry &x) : entry(x), next(NULL), owner(NULL) {}
+    };
+
+    struct tree_node {
+        inner *parent;
+        // Position among the children of parent.
+        uint32_t index;
+    };
+
+    struct leaf : tree_node {
+        // Neighbours in the order; spare leaves are chained through next.
+        leaf *prev, *next;
+        uint32_t size;
+        node *items[leaf_size];
+    };
+
+    struct inner : tree_node {
+        uint32_t n;
+        // Entries under each child.
+        size_type counts[fanout];
+        tree_node *children[fanout];
+    };
+
+    // A bucket array and what reducing hashes modulo its size takes.
+    struct table {
+        node **buckets;
+        // A prime from bucket_size_for().
+        size_type size;
+        // ceil(2**64 / size), for slot().
+        uint64_t magic;
+
+        void init(node **p, size_type n)
+        {
+            buckets = p;
+            size = n;
+            magic = n != 0 ? ~(uint64_t)0 / n + 1 : 0;
+        }
+
+        // Hashes are folded to 32 bits and taken modulo the prime size, so
+        // consecutive ints land in consecutive buckets while strided ones
+        // still spread out.
+        node **slot(std::size_t hash) const
+        {
+            uint32_t h = (uint32_t)((uint64_t)hash ^ ((uint64_t)hash >> 32));
+#ifdef __SIZEOF_INT128__
+            // Lemire's fastmod: the remainder from the fraction h / n.
+            uint64_t frac = magic * h;
+            return &buckets[((unsigned __int128)frac * size) >> 64];
+#else
+            return &buckets[h % size];
+#endif
+        }
+
+        void chain_stats(size_type &used, size_type &longest) const
+        {
+            for (size_type i = 0; i < size; i++) {
+                size_type len = 0;
+                for (node *p = buckets[i]; p != NULL; p = p->next)
+                    len++;
+                if (len > 0)
+                    used++;
+                if (len > longest)
+                    longest = len;
+            }
+        }
+    };
+
+    typedef arena_allocator<node, Backend> node_allocator;
+
+public:
+    class iterator {
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef Entry value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Entry *pointer;
+        typedef const Entry &reference;
+
+        iterator() : c(NULL), pos(0) {}
+        iterator(const ordered_index *c, difference_type pos) : c(c), pos(pos) {}
+
+        reference operator*() const { return (*c)[pos]; }
+        pointer operator->() const { return &(*c)[pos]; }
+        reference operator[](difference_type n) const { return (*c)[pos + n]; }
+
+        iterator &operator++() { pos++; return *this; }
+        iterator &operator--() { pos--; return *this; }
+        iterator operator++(int) { iterator it(*this); pos++; return it; }
+        iterator operator--(int) { iterator it(*this); pos--; return it; }
+        iterator &operator+=(difference_type n) { pos += n; return *this; }
+        iterator &operator-=(difference_type n) { pos -= n; return *this; }
+        iterator operator+(difference_type n) const { return iterator(c, pos + n); }
+        iterator operator-(difference_type n) const { return iterator(c, pos - n); }
+        difference_type operator-(const iterator &x) const { return pos - x.pos; }
+
+        bool operator==(const iterator &x) const { return pos == x.pos; }
+        bool operator!=(const iterator &x) const { return pos != x.pos; }
+        bool operator<(const iterator &x) const { return pos < x.pos; }
+        bool operator>(const iterator &x) const { return pos > x.pos; }
+        bool operator<=(const iterator &x) const { return pos <= x.pos; }
+        bool operator>=(const iterator &x) const { return pos >= x.pos; }
+
+        difference_type index() const { return pos; }
+
+    private:
+        const ordered_index *c;
+        difference_type pos;
+    };
+
+    typedef iterator const_iterator;
+
+    ordered_index()
+    {
+        init();
+    }
+
+    // Copies get an arena of their own.
+    ordered_index(const ordered_index &x)
+    {
+        init();
+        reserve(x.count);
+        for (const leaf *l = x.head; l != NULL; l = l->next) {
+            for (size_type i = 0; i < l->size; i++)
+                push_back(l->items[i]->entry);
+        }
+    }
+
+    ordered_index &operator=(const ordered_index &x)
+    {
+        if (this != &x) {
+            ordered_index copy(x);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    ~ordered_index()
+    {
+        for (leaf *l = head; l != NULL; l = l->next) {
+            for (size_type i = 0; i < l->size; i++)
+                destroy(l->items[i]);
+        }
+        release_tree();
+        while (spare != NULL) {
+            leaf *l = spare;
+            spare = l->next;
+            get_arena()->deallocate(l, sizeof(leaf));
+        }
+        if (old.buckets != NULL)
+            get_arena()->deallocate(old.buckets, old.size * sizeof(node *));
+        get_arena()->deallocate(cur.buckets, cur.size * sizeof(node *));
+    }
+
+    void swap(ordered_index &x)
+    {
+        std::swap(alloc, x.alloc);
+        std::swap(cur, x.cur);
+        std::swap(old, x.old);
+        std::swap(migrated, x.migrated);
+        std::swap(count, x.count);
+        std::swap(root, x.root);
+        std::swap(height, x.height);
+        std::swap(head, x.head);
+        std::swap(tail, x.tail);
+        std::swap(spare, x.spare);
+        std::swap(nleaves, x.nleaves);
+        std::swap(nspare, x.nspare);
+        std::swap(ninner, x.ninner);
+        std::swap(finger, x.finger);
+        std::swap(finger_start, x.finger_start);
+    }
+
+    void clear()
+    {
+        ordered_index empty;
+        swap(empty);
+    }
+
+    size_type size() const { return count; }
+    bool empty() const { return count == 0; }
+    // Pointer slots held by leaves, in use or spare.
+    size_type capacity() const { return (nleaves + nspare) * leaf_size; }
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, count); }
+
+    const Entry &operator[](size_type pos) const
+    {
+        size_type off;
+        const leaf *l = locate(pos, off);
+        return l->items[off]->entry;
+    }
+
+    const Entry &back() const { return tail->items[tail->size - 1]->entry; }
+
+    // Position of an entry of this container.
+    size_type index_of(const Entry &x) const
+    {
+        const node *n = to_node(x);
+        const leaf *l = n->owner;
+        size_type pos = 0;
+        while (l->items[pos] != n)
+            pos++;
+        if (l == finger)
+            return finger_start + pos;
+        for (const tree_node *p = l; p->parent != NULL; p = p->parent) {
+            for (uint32_t i = 0; i < p->index; i++)
+                pos += p->parent->counts[i];
+        }
+        return pos;
+    }
+
+    size_type index_of(const Entry *x) const { return index_of(*x); }
+
+    // The entry equal to key, or NULL. Comparisons that fail count as
+    // unequal, as with any other pred.
+    template <typename Key, typename KeyHash, typename Pred>
+    const Entry *find(const Key &key, const KeyHash &hash, const Pred &eq) const
+    {
+        std::size_t h = hash(key);
+        for (node *n = *cur.slot(h); n != NULL; n = n->next) {
+            if (eq(key, n->entry))
+                return &n->entry;
+        }
+        if (old.buckets == NULL)
+            return NULL;
+        for (node *n = *old.slot(h); n != NULL; n = n->next) {
+            if (eq(key, n->entry))
+                return &n->entry;
+        }
+        return NULL;
+    }
+
+    // Append an entry whose key is not in the container yet.
+    void push_back(const Entry &x)
+    {
+        insert(count, x);
+    }
+
+    // Insert an entry whose key is not in the container yet at pos.
+    void insert(size_type pos, const Entry &x)
+    {
+        node *n = create(x);
+        hash_link(n);
+        link_at(pos, n);
+    }
+
+    void erase(size_type pos)
+    {
+        size_type off;
+        leaf *l = locate(pos, off);
+        node *n = l->items[off];
+        unlink_at(l, off, pos);
+        hash_unlink(n);
+        destroy(n);
+    }
+
+    void erase(iterator it) { erase(it.index()); }
+
+    void erase(iterator first, iterator last)
+    {
+        erase(first.index(), last.index());
+    }
+
+    // Erase the entries from first up to last, a leaf at a time.
+    void erase(size_type first, size_type last)
+    {
+        std::vector<node *> dead;
+
+        if (first >= last)
+            return;
+        dead.reserve(last - first);
+        while (first < last) {
+            size_type off;
+            leaf *l = locate(first, off);
+            size_type k = std::min<size_type>(last - first, l->size - off);
+            for (size_type i = off; i < off + k; i++) {
+                hash_unlink(l->items[i]);
+                dead.push_back(l->items[i]);
+            }
+            std::memmove(l->items + off, l->items + off + k,
+                         (l->size - off - k) * sizeof(node *));
+            shrink_leaf(l, k, first);
+            last -= k;
+        }
+        for (size_type i = 0; i < dead.size(); i++)
+            destroy(dead[i]);
+    }
+
+    // Erase the entries pred holds for, visiting every entry in order.
+    template <typename Pred>
+    void remove_if(Pred pred)
+    {
+        std::vector<node *> kept, dead;
+
+        kept.reserve(count);
+        for (leaf *l = head; l != NULL; l = l->next) {
+            for (size_type i = 0; i < l->size; i++) {
+                node *n = l->items[i];
+                if (pred(n->entry)) {
+                    hash_unlink(n);
+                    dead.push_back(n);
+                }
+                else
+                    kept.push_back(n);
+            }
+        }
+        if (!dead.empty())
+            layout(kept);
+        for (size_type i = 0; i < dead.size(); i++)
+            destroy(dead[i]);
+    }
+
+    // Move the entry at from so that it ends up at position to.
+    void move(size_type from, size_type to)
+    {
+        size_type off;
+
+        if (from == to)
+            return;
+        leaf *l = locate(from, off);
+        node *n = l->items[off];
+        unlink_at(l, off, from);
+        link_at(to, n);
+    }
+
+    // Put the entries in the order given, every entry once.
+    void rearrange(const std::vector<const Entry *> &entries)
+    {
+        std::vector<node *> nodes;
+        nodes.reserve(entries.size());
+        for (size_type i = 0; i < entries.size(); i++)
+            nodes.push_back(const_cast<node *>(to_node(*entries[i])));
+        layout(nodes);
+    }
+
+    void reverse()
+    {
+        std::vector<node *> nodes;
+        nodes.reserve(count);
+        for (leaf *l = tail; l != NULL; l = l->prev) {
+            for (size_type i = l->size; i > 0; i--)
+                nodes.push_back(l->items[i - 1]);
+        }
+        layout(nodes);
+    }
+
+    // Make room for n entries without growing either the buckets or the
+    // order. The rehash this takes, and any one under way, is done at once.
+    void reserve(size_type n)
+    {
+        if (n > cur.size) {
+            start_rehash(bucket_size_for(n));
+            migrate(old.size);
+        }
+        while (capacity() < n) {
+            leaf *l = static_cast<leaf *>(get_arena()->allocate(sizeof(leaf)));
+            l->next = spare;
+            spare = l;
+            nspare++;
+        }
+    }
+
+    size_type bucket_count() const { return cur.size; }
+
+    // The number of non-empty chains and the length of the longest. During
+    // a rehash the chains of both arrays count, so every entry is in one.
+    void chain_stats(size_type &used, size_type &longest) const
+    {
+        used = longest = 0;
+        cur.chain_stats(used, longest);
+        if (old.buckets != NULL)
+            old.chain_stats(used, longest);
+    }
+
+    float load_factor() const { return (float)count / cur.size; }
+    float max_load_factor() const { return 1.0f; }
+
+    // Bytes of the order: the leaves, spare ones included, and the inner
+    // nodes over them.
+    size_type order_bytes() const
+    {
+        return (nleaves + nspare) * sizeof(leaf) + ninner * sizeof(inner);
+    }
+
+    // Bytes of the bucket arrays, both while a rehash is under way.
+    size_type bucket_bytes() const
+    {
+        return (cur.size + (old.buckets != NULL ? old.size : 0)) * sizeof(node *);
+    }
+
+    // Entries after pos in its leaf, the pointers erasing it shifts.
+    size_type shift_cost(size_type pos) const
+    {
+        size_type off;
+        const leaf *l = locate(pos, off);
+        return l->size - off - 1;
+    }
+
+    arena_type *get_arena() const { return alloc.get_arena(); }
+
+private:
+    static const node *to_node(const Entry &x)
+    {
+        return reinterpret_cast<const node *>(&x);
+    }
+
+    void init()
+    {
+        count = 0;
+        cur.init(alloc_buckets(bucket_size_for(0)), bucket_size_for(0));
+        old.init(NULL, 0);
+        migrated = 0;
+        spare = NULL;
+        nleaves = nspare = ninner = 0;
+        head = tail = new_leaf();
+        root = head;
+        height = 0;
+        finger = NULL;
+        finger_start = 0;
+    }
+
+    node *create(const Entry &x)
+    {
+        void *p = get_arena()->allocate(sizeof(node));
+        return new (p) node(x);
+    }
+
+    void destroy(node *n)
+    {
+        n->~node();
+        get_arena()->deallocate(n, sizeof(node));
+    }
+
+    node **alloc_buckets(size_type n)
+    {
+        return static_cast<node **>(get_arena()->allocate_zeroed(n * sizeof(node *)));
+    }
+
+    /* Hash table */
+
+    // The smallest bucket count in the table holding n entries.
+    static size_type bucket_size_for(size_type n)
+    {
+        static const uint32_t primes[] = {
+            13UL, 29UL, 53UL, 97UL, 193UL, 389UL, 769UL, 1543UL, 3079UL, 6151UL,
+            12289UL, 24593UL, 49157UL, 98317UL, 196613UL, 393241UL, 786433UL,
+            1572869UL, 3145739UL, 6291469UL, 12582917UL, 25165843UL, 50331653UL,
+            100663319UL, 201326611UL, 402653189UL, 805306457UL, 1610612741UL,
+            3221225473UL, 4294967291UL
+        };
+        const std::size_t nprimes = sizeof(primes) / sizeof(primes[0]);
+        const uint32_t *p = std::lower_bound(primes, primes + nprimes - 1, n);
+        return *p;
+    }
+
+    // Start moving the entries to a new array of n buckets, a few buckets
+    // per change, finishing any move still under way first. Growing in one
+    // go would stall the insert that crosses the limit for as long as it
+    // takes to rehash every entry.
+    void start_rehash(size_type n)
+    {
+        if (old.buckets != NULL)
+            migrate(old.size);
+        ORDEREDSET_COUNT(rehashes);
+        old = cur;
+        migrated = 0;
+        cur.init(alloc_buckets(n), n);
+    }
+
+    // Move the entries of the next k buckets of the old array to the
+    // current one, and drop the old array once it is empty.
+    void migrate(size_type k)
+    {
+        for (; k > 0 && migrated < old.size; k--, migrated++) {
+            node *p = old.buckets[migrated];
+            while (p != NULL) {
+                node *next = p->next;
+                node **head = cur.slot(Hash()(p->entry));
+                p->next = *head;
+                *head = p;
+                p = next;
+            }
+            old.buckets[migrated] = NULL;
+        }
+        if (migrated == old.size) {
+            get_arena()->deallocate(old.buckets, old.size * sizeof(node *));
+            old.init(NULL, 0);
+        }
+    }
+
+    void hash_link(node *n)
+    {
+        if (old.buckets != NULL)
+            migrate(rehash_step);
+        else if (count >= cur.size)
+            start_rehash(bucket_size_for(count + 1));
+        node **head = cur.slot(Hash()(n->entry));
+        n->next = *head;
+        *head = n;
+    }
+
+    void hash_unlink(node *n)
+    {
+        std::size_t h = Hash()(n->entry);
+        node **p = cur.slot(h);
+        while (*p != n && *p != NULL)
+            p = &(*p)->next;
+        if (*p == NULL) {
+            p = old.slot(h);
+            while (*p != n)
+                p = &(*p)->next;
+        }
+        *p = n->next;
+        if (old.buckets != NULL)
+            migrate(rehash_step);
+    }
+
+    /* Tree nodes */
+
+    leaf *new_leaf()
+    {
+        leaf *l;
+        if (spare != NULL) {
+            l = spare;
+            spare = l->next;
+            nspare--;
+        }
+        else
+            l = static_cast<leaf *>(get_arena()->allocate(sizeof(leaf)));
+        l->parent = NULL;
+        l->index = 0;
+        l->prev = l->next = NULL;
+        l->size = 0;
+        nleaves++;
+        return l;
+    }
+
+    // Leaves are kept for reuse until the container dies.
+    void release_leaf(leaf *l)
+    {
+        l->next = spare;
+        spare = l;
+        nleaves--;
+        nspare++;
+    }
+
+    inner *new_inner()
+    {
+        inner *in = static_cast<inner *>(get_arena()->allocate(sizeof(inner)));
+        in->parent = NULL;
+        in->index = 0;
+        in->n = 0;
+        ninner++;
+        return in;
+    }
+
+    void release_inner(inner *in)
+    {
+        get_arena()->deallocate(in, sizeof(inner));
+        ninner--;
+    }
+
+    // Release the inner nodes under p, h levels of them.
+    void release_inner_tree(tree_node *p, int h)
+    {
+        if (h == 0)
+            return;
+        inner *in = static_cast<inner *>(p);
+        for (uint32_t i = 0; i < in->n; i++)
+            release_inner_tree(in->children[i], h - 1);
+        release_inner(in);
+    }
+
+    // Release the whole tree, leaving no leaf in the order.
+    void release_tree()
+    {
+        release_inner_tree(root, height);
+        while (head != NULL) {
+            leaf *next = head->next;
+            release_leaf(head);
+            head = next;
+        }
+        root = NULL;
+        tail = NULL;
+        height = 0;
+        finger = NULL;
+    }
+
+    // Add delta to the counts on the path from p up to the root.
+    static void add_count(tree_node *p, difference_type delta)
+    {
+        for (; p->parent != NULL; p = p->parent)
+            p->parent->counts[p->index] += delta;
+    }
+
+    // Put a new root over the old one, total entries under it.
+    void grow(tree_node *p, size_type total)
+    {
+        inner *in = new_inner();
+        in->n = 1;
+        in->counts[0] = total;
+        in->children[0] = p;
+        p->parent = in;
+        p->index = 0;
+        root = in;
+        height++;
+    }
+
+    // Make child the i-th child of in. The counts above in already include
+    // the total entries under child: callers move entries under in, they do
+    // not add any.
+    void insert_child(inner *in, uint32_t i, tree_node *child, size_type total)
+    {
+        if (in->n == fanout) {
+            inner *right = split_inner(in, total);
+            if (i > in->n) {
+                i -= in->n;
+                add_count(in, -(difference_type)total);
+                add_count(right, total);
+                in = right;
+            }
+        }
+        std::memmove(in->children + i + 1, in->children + i,
+                     (in->n - i) * sizeof(tree_node *));
+        std::memmove(in->counts + i + 1, in->counts + i, (in->n - i) * sizeof(size_type));
+        in->n++;
+        in->children[i] = child;
+        in->counts[i] = total;
+        child->parent = in;
+        for (uint32_t j = i; j < in->n; j++)
+            in->children[j]->index = j;
+    }
+
+    void remove_child(inner *in, uint32_t i)
+    {
+        std::memmove(in->children + i, in->children + i + 1,
+                     (in->n - i - 1) * sizeof(tree_node *));
+        std::memmove(in->counts + i, in->counts + i + 1, (in->n - i - 1) * sizeof(size_type));
+        in->n--;
+        for (uint32_t j = i; j < in->n; j++)
+            in->children[j]->index = j;
+
+        if (in->parent == NULL) {
+            // A root left with one child hands over to it.
+            while (height > 0 && static_cast<inner *>(root)->n == 1) {
+                inner *old = static_cast<inner *>(root);
+                root = old->children[0];
+                root->parent = NULL;
+                root->index = 0;
+                height--;
+                release_inner(old);
+            }
+        }
+        else if (in->n == 0) {
+            remove_child(in->parent, in->index);
+            release_inner(in);
+        }
+        else
+            maybe_merge_inner(in);
+    }
+
+    // Move the upper half of the children of a full inner node to a new
+    // node after it. pending entries are about to go under either half.
+    inner *split_inner(inner *in, size_type pending)
+    {
+        inner *right = new_inner();
+        uint32_t half = in->n / 2, moved = in->n - half;
+        size_type total = 0;
+
+        std::memcpy(right->children, in->children + half, moved * sizeof(tree_node *));
+        std::memcpy(right->counts, in->counts + half, moved * sizeof(size_type));
+        for (uint32_t j = 0; j < moved; j++) {
+            right->children[j]->parent = right;
+            right->children[j]->index = j;
+            total += right->counts[j];
+        }
+        right->n = moved;
+        if (in->parent == NULL) {
+            size_type rest = 0;
+            for (uint32_t j = 0; j < half; j++)
+                rest += in->counts[j];
+            grow(in, rest + total + pending);
+        }
+        in->n = half;
+        in->parent->counts[in->index] -= total;
+        insert_child(in->parent, in->index + 1, right, total);
+        return right;
+    }
+
+    // Append the children of b to its left sibling a.
+    void merge_inner(inner *a, inner *b)
+    {
+        inner *p = a->parent;
+        uint32_t i = b->index;
+
+        for (uint32_t j = 0; j < b->n; j++) {
+            a->children[a->n] = b->children[j];
+            a->counts[a->n] = b->counts[j];
+            a->children[a->n]->parent = a;
+            a->children[a->n]->index = a->n;
+            a->n++;
+        }
+        p->counts[a->index] += p->counts[i];
+        release_inner(b);
+        remove_child(p, i);
+    }
+
+    // Merge an inner node that ran low with a sibling, so that the height
+    // stays logarithmic in the number of leaves.
+    void maybe_merge_inner(inner *in)
+    {
+        inner *p = in->parent;
+
+        if (in->n >= fanout / 4)
+            return;
+        if (in->index + 1 < p->n) {
+            inner *right = static_cast<inner *>(p->children[in->index + 1]);
+            if (in->n + right->n <= fanout / 2) {
+                merge_inner(in, right);
+                return;
+            }
+        }
+        if (in->index > 0) {
+            inner *left = static_cast<inner *>(p->children[in->index - 1]);
+            if (left->n + in->n <= fanout / 2)
+                merge_inner(left, in);
+        }
+    }
+
+    void link_leaf_after(leaf *l, leaf *r)
+    {
+        r->prev = l;
+        r->next = l->next;
+        if (l->next != NULL)
+            l->next->prev = r;
+        else
+            tail = r;
+        l->next = r;
+    }
+
+    // Put an empty leaf after l, in the order and in the tree.
+    leaf *add_leaf_after(leaf *l)
+    {
+        leaf *r = new_leaf();
+        link_leaf_after(l, r);
+        if (l->parent == NULL)
+            grow(l, l->size);
+        insert_child(l->parent, l->index + 1, r, 0);
+        return r;
+    }
+
+    // Move the upper half of a full leaf to a new leaf after it.
+    void split_leaf(leaf *l)
+    {
+        leaf *r = add_leaf_after(l);
+        size_type half = l->size / 2, moved = l->size - half;
+
+        std::memcpy(r->items, l->items + half, moved * sizeof(node *));
+        for (size_type i = 0; i < moved; i++)
+            r->items[i]->owner = r;
+        l->size = half;
+        r->size = moved;
+        add_count(l, -(difference_type)moved);
+        add_count(r, moved);
+    }
+
+    // Unlink an empty leaf from the order and the tree.
+    void remove_leaf(leaf *l)
+    {
+        if (l->prev != NULL)
+            l->prev->next = l->next;
+        else
+            head = l->next;
+        if (l->next != NULL)
+            l->next->prev = l->prev;
+        else
+            tail = l->prev;
+        if (finger == l)
+            finger = NULL;
+        remove_child(l->parent, l->index);
+        release_leaf(l);
+    }
+
+    // Append leaf b to its predecessor a, both under the same parent.
+    void merge_leaves(leaf *a, leaf *b)
+    {
+        std::memcpy(a->items + a->size, b->items, b->size * sizeof(node *));
+        for (size_type i = 0; i < b->size; i++)
+            b->items[i]->owner = a;
+        a->parent->counts[a->index] += b->size;
+        b->parent->counts[b->index] = 0;
+        a->size += b->size;
+        b->size = 0;
+        remove_leaf(b);
+    }
+
+    // Merge a leaf that ran low with a neighbour under the same parent, so
+    // that leaves stay within a constant factor of full.
+    void maybe_merge(leaf *l)
+    {
+        if (l->size >= leaf_size / 4 || l->parent == NULL)
+            return;
+        if (l->next != NULL && l->next->parent == l->parent &&
+            l->size + l->next->size <= leaf_size / 2)
+            merge_leaves(l, l->next);
+        else if (l->prev != NULL && l->prev->parent == l->parent &&
+                 l->prev->size + l->size <= leaf_size / 2)
+            merge_leaves(l->prev, l);
+    }
+
+    // Find the leaf and offset of pos. The leaf found last is kept as a
+    // finger, so walking the order costs O(1) a step.
+    leaf *locate(size_type pos, size_type &off) const
+    {
+        if (finger != NULL) {
+            size_type end = finger_start + finger->size;
+            if (pos >= finger_start && pos < end) {
+                off = pos - finger_start;
+                return finger;
+            }
+            if (pos >= end && finger->next != NULL && pos < end + finger->next->size) {
+                finger = finger->next;
+                finger_start = end;
+                off = pos - end;
+                return finger;
+            }
+        }
+
+        const tree_node *p = root;
+        size_type rest = pos;
+        for (int h = height; h > 0; h--) {
+            const inner *in = static_cast<const inner *>(p);
+            uint32_t i = 0;
+            while (i + 1 < in->n && rest >= in->counts[i]) {
+                rest -= in->counts[i];
+                i++;
+            }
+            p = in->children[i];
+        }
+        finger = const_cast<leaf *>(static_cast<const leaf *>(p));
+        finger_start = pos - rest;
+        off = rest;
+        return finger;
+    }
+
+    void link_at(size_type pos, node *n)
+    {
+        leaf *l;
+        size_type off;
+
+        if (pos == count) {
+            l = tail;
+            if (l->size == leaf_size)
+                l = add_leaf_after(l);
+            off = l->size;
+        }
+        else {
+            l = locate(pos, off);
+            if (l->size == leaf_size) {
+                split_leaf(l);
+                if (off > l->size) {
+                    off -= l->size;
+                    l = l->next;
+                }
+            }
+        }
+        std::memmove(l->items + off + 1, l->items + off, (l->size - off) * sizeof(node *));
+        l->items[off] = n;
+        l->size++;
+        n->owner = l;
+        count++;
+        add_count(l, 1);
+        if (finger != NULL && finger != l && pos <= finger_start)
+            finger_start++;
+    }
+
+    void unlink_at(leaf *l, size_type off, size_type pos)
+    {
+        std::memmove(l->items + off, l->items + off + 1, (l->size - off - 1) * sizeof(node *));
+        shrink_leaf(l, 1, pos);
+    }
+
+    // Account for k entries taken out of l at position pos.
+    void shrink_leaf(leaf *l, size_type k, size_type pos)
+    {
+        l->size -= k;
+        count -= k;
+        add_count(l, -(difference_type)k);
+        if (finger != NULL && finger != l && pos < finger_start)
+            finger_start -= k;
+        // The last leaf stays, empty, as the root.
+        if (l->size == 0 && count > 0)
+            remove_leaf(l);
+        else
+            maybe_merge(l);
+    }
+
+    // Lay the nodes out anew in full leaves, in the order given, and build
+    // the inner levels over them bottom up.
+    void layout(const std::vector<node *> &nodes)
+    {
+        std::vector<tree_node *> level;
+        std::vector<size_type> totals;
+
+        release_tree();
+        count = nodes.size();
+        for (size_type i = 0; i < nodes.size() || level.empty(); ) {
+            leaf *l = new_leaf();
+            size_type n = std::min<size_type>(nodes.size() - i, leaf_size);
+            for (size_type k = 0; k < n; k++) {
+                l->items[k] = nodes[i + k];
+                nodes[i + k]->owner = l;
+            }
+            l->size = n;
+            if (tail != NULL)
+                link_leaf_after(tail, l);
+            else
+                head = tail = l;
+            level.push_back(l);
+            totals.push_back(n);
+            i += n;
+        }
+        while (level.size() > 1) {
+            size_type up = 0;
+            for (size_type i = 0; i < level.size(); i += fanout) {
+                inner *in = new_inner();
+                size_type total = 0;
+                in->n = std::min<size_type>(level.size() - i, fanout);
+                for (uint32_t j = 0; j < in->n; j++) {
+                    in->children[j] = level[i + j];
+                    in->counts[j] = totals[i + j];
+                    level[i + j]->parent = in;
+                    level[i + j]->index = j;
+                    total += totals[i + j];
+                }
+                level[up] = in;
+                totals[up] = total;
+                up++;
+            }
+            level.resize(up);
+            totals.resize(up);
+            height++;
+        }
+        root = level[0];
+    }
+
+    node_allocator alloc;
+    table cur;
+    // The array entries are moving out of during a rehash; no buckets
+    // otherwise. Its buckets below migrated are empty.
+    table old;
+    size_type migrated;
+    size_type count;
+    // A leaf, or an inner node with height levels of inner nodes under it
+    // counting itself.
+    tree_node *root;
+    int height;
+    // The leaves in order.
+    leaf *head, *tail;
+    // Leaves not in the tree, reserved or left over, chained through next.
+    leaf *spare;
+    size_type nleaves, nspare, ninner;
+    // The leaf found last and the position of its first entry.
+    mutable leaf *finger;
+    mutable size_type finger_start;
+};
+
+#endif
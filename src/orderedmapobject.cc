@@ -0,0 +1,827 @@
+#include <Python.h>
+#include "orderedmapobject.h"
+
+#if PY_MAJOR_VERSION > 2
+#define PyString_FromFormat PyUnicode_FromFormat
+#define PyString_AS_STRING PyUnicode_AS_UNICODE
+#endif
+#ifndef Py_TYPE
+#define Py_TYPE(ob) (((PyObject*)(ob))->ob_type)
+#endif
+#ifndef PyVarObject_HEAD_INIT
+#define PyVarObject_HEAD_INIT(type, size) \
+    PyObject_HEAD_INIT(type) size,
+#endif
+
+static void
+map_set_key_error(PyObject *key)
+{
+    // Wrap the key so tuples are not taken for the exception arguments.
+    PyObject *tup = PyTuple_Pack(1, key);
+    if (tup == NULL)
+        return;
+    PyErr_SetObject(PyExc_KeyError, tup);
+    Py_DECREF(tup);
+}
+
+/* Locate key in the order index. Returns 1 and sets *pos if found, 0 if
+ * not and -1 on error. */
+static int
+map_find(PyOrderedMapObject *self, PyObject *key, ordered_map_by_key::iterator *pos,
+         Py_hash_t *hash)
+{
+    ordered_set_probe probe;
+
+    probe.key = key;
+    probe.hash = PyObject_Hash(key);
+    if (probe.hash == -1)
+        return -1;
+    if (hash != NULL)
+        *hash = probe.hash;
+
+    ordered_map_by_hash &hashmap = self->omap.get<hash_index>();
+    ordered_map_by_hash::iterator it = hashmap.find(probe, ordered_set_hash(),
+                                                    ordered_set_equal());
+    if (it == hashmap.end())
+        return PyErr_Occurred() ? -1 : 0;
+    *pos = self->omap.project<key_index>(it);
+    return 1;
+}
+
+static int
+map_setitem(PyOrderedMapObject *self, PyObject *key, PyObject *value)
+{
+    ordered_map_by_key::iterator pos;
+    Py_hash_t hash;
+
+    int found = map_find(self, key, &pos, &hash);
+    if (found == -1)
+        return -1;
+    if (found == 1) {
+        PyObject *old = pos->value;
+        Py_INCREF(value);
+        pos->value = value;
+        Py_DECREF(old);
+        return 0;
+    }
+    self->omap.get<key_index>().push_back(ordered_map_entry(key, hash, value));
+    self->version++;
+    return 0;
+}
+
+static void
+map_erase(PyOrderedMapObject *self, ordered_map_by_key::iterator pos)
+{
+    self->version++;
+    self->omap.get<key_index>().erase(pos);
+}
+
+static int
+map_delitem(PyOrderedMapObject *self, PyObject *key)
+{
+    ordered_map_by_key::iterator pos;
+
+    int found = map_find(self, key, &pos, NULL);
+    if (found == -1)
+        return -1;
+    if (found == 0) {
+        map_set_key_error(key);
+        return -1;
+    }
+    map_erase(self, pos);
+    return 0;
+}
+
+static int
+map_update_internal(PyOrderedMapObject *self, PyObject *other)
+{
+    PyObject *it, *item, *keys, *key, *value;
+    int rv = 0;
+
+    if (PyOrderedMap_Check(other)) {
+        ordered_map_by_key &map = ((PyOrderedMapObject *)other)->omap.get<key_index>();
+        for (Py_ssize_t i = 0; i < (Py_ssize_t)map.size(); i++) {
+            if (map_setitem(self, map[i].key, map[i].value) == -1)
+                return -1;
+        }
+        return 0;
+    }
+
+    keys = PyObject_GetAttrString(other, "keys");
+    if (keys != NULL) {
+        // A mapping: copy other[k] for k in other.keys().
+        it = PyObject_CallObject(keys, NULL);
+        Py_DECREF(keys);
+        if (it == NULL)
+            return -1;
+        keys = it;
+        it = PyObject_GetIter(keys);
+        Py_DECREF(keys);
+        if (it == NULL)
+            return -1;
+        while (rv == 0 && (key = PyIter_Next(it)) != NULL) {
+            value = PyObject_GetItem(other, key);
+            if (value == NULL)
+                rv = -1;
+            else {
+                rv = map_setitem(self, key, value);
+                Py_DECREF(value);
+            }
+            Py_DECREF(key);
+        }
+        Py_DECREF(it);
+        return PyErr_Occurred() ? -1 : rv;
+    }
+    if (!PyErr_ExceptionMatches(PyExc_AttributeError))
+        return -1;
+    PyErr_Clear();
+
+    // Otherwise an iterable of key, value pairs.
+    it = PyObject_GetIter(other);
+    if (it == NULL)
+        return -1;
+    while (rv == 0 && (item = PyIter_Next(it)) != NULL) {
+        PyObject *pair = PySequence_Fast(item, "cannot convert orderedmap update "
+                                         "sequence element to a sequence");
+        Py_DECREF(item);
+        if (pair == NULL) {
+            rv = -1;
+            break;
+        }
+        if (PySequence_Fast_GET_SIZE(pair) != 2) {
+            PyErr_Format(PyExc_ValueError, "orderedmap update sequence element "
+                         "has length %zd; 2 is required", PySequence_Fast_GET_SIZE(pair));
+            rv = -1;
+        }
+        else
+            rv = map_setitem(self, PySequence_Fast_GET_ITEM(pair, 0),
+                             PySequence_Fast_GET_ITEM(pair, 1));
+        Py_DECREF(pair);
+    }
+    Py_DECREF(it);
+    return PyErr_Occurred() ? -1 : rv;
+}
+
+static int
+map_update_common(PyOrderedMapObject *self, PyObject *args, PyObject *kwds,
+                  const char *methname)
+{
+    PyObject *other = NULL;
+
+    if (!PyArg_UnpackTuple(args, methname, 0, 1, &other))
+        return -1;
+    if (other != NULL && map_update_internal(self, other) == -1)
+        return -1;
+    if (kwds != NULL)
+        return map_update_internal(self, kwds);
+    return 0;
+}
+
+static PyObject *
+map_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    PyOrderedMapObject *mo;
+
+    mo = (PyOrderedMapObject *)type->tp_alloc(type, 0);
+    if (mo == NULL)
+        return NULL;
+    // tp_alloc only hands out zeroed memory, construct the container in place.
+    new (&mo->omap) ordered_map();
+    mo->version = 0;
+    return (PyObject *)mo;
+}
+
+static int
+map_init(PyOrderedMapObject *self, PyObject *args, PyObject *kwds)
+{
+    return map_update_common(self, args, kwds, "orderedmap");
+}
+
+static int
+map_clear_internal(PyOrderedMapObject *self)
+{
+    // Swap in an empty container with an arena of its own, so the old
+    // nodes are released together with their arena when `old` goes away.
+    ordered_map old;
+    self->version++;
+    self->omap.swap(old);
+    return 0;
+}
+
+static void
+map_dealloc(PyOrderedMapObject *self)
+{
+    PyObject_GC_UnTrack(self);
+    self->omap.~ordered_map();
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int
+map_traverse(PyOrderedMapObject *self, visitproc visit, void *arg)
+{
+    ordered_map_by_key &map = self->omap.get<key_index>();
+    for (ordered_map_by_key::iterator it = map.begin(); it != map.end(); ++it) {
+        Py_VISIT(it->key);
+        Py_VISIT(it->value);
+    }
+    return 0;
+}
+
+static Py_ssize_t
+map_len(PyOrderedMapObject *self)
+{
+    return self->omap.size();
+}
+
+static PyObject *
+map_subscript(PyOrderedMapObject *self, PyObject *key)
+{
+    ordered_map_by_key::iterator pos;
+
+    int found = map_find(self, key, &pos, NULL);
+    if (found == -1)
+        return NULL;
+    if (found == 0) {
+        map_set_key_error(key);
+        return NULL;
+    }
+    Py_INCREF(pos->value);
+    return pos->value;
+}
+
+static int
+map_ass_subscript(PyOrderedMapObject *self, PyObject *key, PyObject *value)
+{
+    if (value == NULL)
+        return map_delitem(self, key);
+    return map_setitem(self, key, value);
+}
+
+static int
+map_contains(PyOrderedMapObject *self, PyObject *key)
+{
+    ordered_map_by_key::iterator pos;
+
+    return map_find(self, key, &pos, NULL);
+}
+
+/* Resolve a possibly negative index, raising IndexError if out of range. */
+static int
+map_position(PyOrderedMapObject *self, Py_ssize_t *i)
+{
+    Py_ssize_t len = map_len(self);
+
+    if (*i < 0)
+        *i += len;
+    if (*i < 0 || *i >= len) {
+        PyErr_SetString(PyExc_IndexError, "orderedmap index out of range");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+map_item_pair(const ordered_map_entry &entry)
+{
+    return PyTuple_Pack(2, entry.key, entry.value);
+}
+
+/***** Iteration *******************************************************/
+
+enum { MAP_KEYS, MAP_VALUES, MAP_ITEMS };
+
+typedef struct {
+    PyObject_HEAD
+    PyOrderedMapObject *mi_map; /* Set to NULL when iterator is exhausted */
+    unsigned long mi_version;
+    Py_ssize_t mi_pos;
+    int mi_kind;
+} mapiterobject;
+
+static void
+mapiter_dealloc(mapiterobject *mi)
+{
+    Py_XDECREF(mi->mi_map);
+    PyObject_Del(mi);
+}
+
+static PyObject *
+mapiter_len(mapiterobject *mi)
+{
+    Py_ssize_t len = 0;
+    if (mi->mi_map != NULL && mi->mi_version == mi->mi_map->version)
+        len = map_len(mi->mi_map) - mi->mi_pos;
+    return PyLong_FromSsize_t(len);
+}
+
+PyDoc_STRVAR(length_hint_doc, "Private method returning an estimate of len(list(it)).");
+
+static PyMethodDef mapiter_methods[] = {
+    {"__length_hint__", (PyCFunction)mapiter_len, METH_NOARGS, length_hint_doc},
+    {NULL, NULL} /* sentinel */
+};
+
+static PyObject *
+mapiter_iternext(mapiterobject *mi)
+{
+    PyOrderedMapObject *mo = mi->mi_map;
+
+    if (mo == NULL)
+        return NULL;
+    if (mi->mi_version != mo->version) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "orderedmap changed size during iteration");
+        Py_DECREF(mo);
+        mi->mi_map = NULL; /* Make this state sticky */
+        return NULL;
+    }
+    if (mi->mi_pos >= map_len(mo)) {
+        Py_DECREF(mo);
+        mi->mi_map = NULL;
+        return NULL;
+    }
+
+    const ordered_map_entry &entry = mo->omap.get<key_index>()[mi->mi_pos++];
+    switch (mi->mi_kind) {
+    case MAP_KEYS:
+        Py_INCREF(entry.key);
+        return entry.key;
+    case MAP_VALUES:
+        Py_INCREF(entry.value);
+        return entry.value;
+    default:
+        return map_item_pair(entry);
+    }
+}
+
+static PyTypeObject PyOrderedMapIter_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "orderedmapiterator",       /* tp_name */
+    sizeof(mapiterobject),      /* tp_basicsize */
+    0,                          /* tp_itemsize */
+    /* methods */
+    (destructor)mapiter_dealloc, /* tp_dealloc */
+    0,                          /* tp_print */
+    0,                          /* tp_getattr */
+    0,                          /* tp_setattr */
+    0,                          /* tp_compare */
+    0,                          /* tp_repr */
+    0,                          /* tp_as_number */
+    0,                          /* tp_as_sequence */
+    0,                          /* tp_as_mapping */
+    0,                          /* tp_hash */
+    0,                          /* tp_call */
+    0,                          /* tp_str */
+    PyObject_GenericGetAttr,    /* tp_getattro */
+    0,                          /* tp_setattro */
+    0,                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,         /* tp_flags */
+    0,                          /* tp_doc */
+    0,                          /* tp_traverse */
+    0,                          /* tp_clear */
+    0,                          /* tp_richcompare */
+    0,                          /* tp_weaklistoffset */
+    PyObject_SelfIter,          /* tp_iter */
+    (iternextfunc)mapiter_iternext, /* tp_iternext */
+    mapiter_methods,            /* tp_methods */
+    0,
+};
+
+static PyObject *
+make_map_iter(PyOrderedMapObject *self, int kind)
+{
+    mapiterobject *mi = PyObject_New(mapiterobject, &PyOrderedMapIter_Type);
+    if (mi == NULL)
+        return NULL;
+    Py_INCREF(self);
+    mi->mi_map = self;
+    mi->mi_version = self->version;
+    mi->mi_pos = 0;
+    mi->mi_kind = kind;
+    return (PyObject *)mi;
+}
+
+static PyObject *
+map_iter(PyOrderedMapObject *self)
+{
+    return make_map_iter(self, MAP_KEYS);
+}
+
+/* keys(), values() and items() as lists of exactly the right size. */
+static PyObject *
+map_list(PyOrderedMapObject *self, int kind)
+{
+    ordered_map_by_key &map = self->omap.get<key_index>();
+    Py_ssize_t n = map.size();
+    PyObject *list, *v;
+
+    list = PyList_New(n);
+    if (list == NULL)
+        return NULL;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        const ordered_map_entry &entry = map[i];
+        if (kind == MAP_ITEMS) {
+            v = map_item_pair(entry);
+            if (v == NULL) {
+                Py_DECREF(list);
+                return NULL;
+            }
+        }
+        else {
+            v = kind == MAP_KEYS ? entry.key : entry.value;
+            Py_INCREF(v);
+        }
+        PyList_SET_ITEM(list, i, v);
+    }
+    return list;
+}
+
+/***** Methods *********************************************************/
+
+static PyObject *
+map_keys(PyOrderedMapObject *self)
+{
+    return map_list(self, MAP_KEYS);
+}
+
+PyDoc_STRVAR(keys_doc, "Return a list of the keys, in order.");
+
+static PyObject *
+map_values(PyOrderedMapObject *self)
+{
+    return map_list(self, MAP_VALUES);
+}
+
+PyDoc_STRVAR(values_doc, "Return a list of the values, in key order.");
+
+static PyObject *
+map_items(PyOrderedMapObject *self)
+{
+    return map_list(self, MAP_ITEMS);
+}
+
+PyDoc_STRVAR(items_doc, "Return a list of the (key, value) pairs, in order.");
+
+static PyObject *
+map_key_at(PyOrderedMapObject *self, PyObject *arg)
+{
+    Py_ssize_t i = PyNumber_AsSsize_t(arg, PyExc_IndexError);
+
+    if (i == -1 && PyErr_Occurred())
+        return NULL;
+    if (map_position(self, &i) == -1)
+        return NULL;
+    PyObject *key = self->omap.get<key_index>()[i].key;
+    Py_INCREF(key);
+    return key;
+}
+
+PyDoc_STRVAR(key_at_doc, "Return the key at index.");
+
+static PyObject *
+map_item_at(PyOrderedMapObject *self, PyObject *arg)
+{
+    Py_ssize_t i = PyNumber_AsSsize_t(arg, PyExc_IndexError);
+
+    if (i == -1 && PyErr_Occurred())
+        return NULL;
+    if (map_position(self, &i) == -1)
+        return NULL;
+    return map_item_pair(self->omap.get<key_index>()[i]);
+}
+
+PyDoc_STRVAR(item_at_doc, "Return the (key, value) pair at index.");
+
+static PyObject *
+map_index(PyOrderedMapObject *self, PyObject *key)
+{
+    ordered_map_by_key::iterator pos;
+
+    int found = map_find(self, key, &pos, NULL);
+    if (found == -1)
+        return NULL;
+    if (found == 0) {
+        PyErr_SetString(PyExc_ValueError, "x is not in orderedmap");
+        return NULL;
+    }
+    return PyLong_FromSsize_t(pos - self->omap.get<key_index>().begin());
+}
+
+PyDoc_STRVAR(index_doc,
+"Return the index of key.\n\
+Raises ValueError if the key is not present.");
+
+static PyObject *
+map_get(PyOrderedMapObject *self, PyObject *args)
+{
+    PyObject *key, *failobj = Py_None;
+    ordered_map_by_key::iterator pos;
+
+    if (!PyArg_UnpackTuple(args, "get", 1, 2, &key, &failobj))
+        return NULL;
+    int found = map_find(self, key, &pos, NULL);
+    if (found == -1)
+        return NULL;
+    if (found == 1)
+        failobj = pos->value;
+    Py_INCREF(failobj);
+    return failobj;
+}
+
+PyDoc_STRVAR(get_doc, "D.get(k[,d]) -> D[k] if k in D, else d.  d defaults to None.");
+
+static PyObject *
+map_setdefault(PyOrderedMapObject *self, PyObject *args)
+{
+    PyObject *key, *failobj = Py_None;
+    ordered_map_by_key::iterator pos;
+    Py_hash_t hash;
+
+    if (!PyArg_UnpackTuple(args, "setdefault", 1, 2, &key, &failobj))
+        return NULL;
+    int found = map_find(self, key, &pos, &hash);
+    if (found == -1)
+        return NULL;
+    if (found == 1)
+        failobj = pos->value;
+    else {
+        self->omap.get<key_index>().push_back(ordered_map_entry(key, hash, failobj));
+        self->version++;
+    }
+    Py_INCREF(failobj);
+    return failobj;
+}
+
+PyDoc_STRVAR(setdefault_doc,
+"D.setdefault(k[,d]) -> D.get(k,d), also set D[k]=d if k not in D");
+
+static PyObject *
+map_pop(PyOrderedMapObject *self, PyObject *args)
+{
+    PyObject *key, *failobj = NULL, *value;
+    ordered_map_by_key::iterator pos;
+
+    if (!PyArg_UnpackTuple(args, "pop", 1, 2, &key, &failobj))
+        return NULL;
+    int found = map_find(self, key, &pos, NULL);
+    if (found == -1)
+        return NULL;
+    if (found == 0) {
+        if (failobj == NULL) {
+            map_set_key_error(key);
+            return NULL;
+        }
+        Py_INCREF(failobj);
+        return failobj;
+    }
+    value = pos->value;
+    Py_INCREF(value);
+    map_erase(self, pos);
+    return value;
+}
+
+PyDoc_STRVAR(pop_doc,
+"D.pop(k[,d]) -> v, remove specified key and return the corresponding value.\n\
+If key is not found, d is returned if given, otherwise KeyError is raised");
+
+static PyObject *
+map_popitem(PyOrderedMapObject *self, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = {"last", NULL};
+    int last = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:popitem", (char **)kwlist, &last))
+        return NULL;
+    if (map_len(self) == 0) {
+        PyErr_SetString(PyExc_KeyError, "orderedmap is empty");
+        return NULL;
+    }
+    ordered_map_by_key &map = self->omap.get<key_index>();
+    ordered_map_by_key::iterator pos = last ? map.end() - 1 : map.begin();
+    PyObject *item = map_item_pair(*pos);
+    if (item != NULL)
+        map_erase(self, pos);
+    return item;
+}
+
+PyDoc_STRVAR(popitem_doc,
+"Remove and return a (key, value) pair, the last one or with last=False\n\
+the first one.");
+
+static PyObject *
+map_update(PyOrderedMapObject *self, PyObject *args, PyObject *kwds)
+{
+    if (map_update_common(self, args, kwds, "update") == -1)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(update_doc,
+"D.update([E, ]**F) -> None.  Update D from mapping or iterable E and F.");
+
+static PyObject *
+map_clear(PyOrderedMapObject *self)
+{
+    map_clear_internal(self);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(clear_doc, "Remove all items from this orderedmap.");
+
+static PyObject *
+map_copy(PyOrderedMapObject *self)
+{
+    PyOrderedMapObject *mo = (PyOrderedMapObject *)map_new(Py_TYPE(self), NULL, NULL);
+    if (mo == NULL)
+        return NULL;
+    mo->omap = self->omap; // Shallow copy into the new map's own arena.
+    return (PyObject *)mo;
+}
+
+PyDoc_STRVAR(copy_doc, "Return a shallow copy of an orderedmap.");
+
+static PyObject *
+map_reduce(PyOrderedMapObject *self)
+{
+    PyObject *items, *result;
+
+    items = map_list(self, MAP_ITEMS);
+    if (items == NULL)
+        return NULL;
+    result = Py_BuildValue("O(N)", Py_TYPE(self), items);
+    return result;
+}
+
+PyDoc_STRVAR(reduce_doc, "Return state information for pickling.");
+
+static PyObject *
+map_sizeof(PyOrderedMapObject *self)
+{
+    ordered_map::allocator_type::arena_type *arena = self->omap.get_allocator().get_arena();
+    Py_ssize_t res;
+
+    res = Py_TYPE(self)->tp_basicsize + sizeof(*arena);
+    res += arena->reserved() + arena->large();
+    return PyLong_FromSsize_t(res);
+}
+
+PyDoc_STRVAR(sizeof_doc, "D.__sizeof__() -> size of D in memory, in bytes");
+
+static PyObject *
+map_repr(PyOrderedMapObject *self)
+{
+    PyObject *items, *result = NULL, *listrepr;
+    int status = Py_ReprEnter((PyObject *)self);
+
+    if (status != 0) {
+        if (status < 0)
+            return NULL;
+        return PyString_FromFormat("%s(...)", Py_TYPE(self)->tp_name);
+    }
+
+    items = map_list(self, MAP_ITEMS);
+    if (items == NULL)
+        goto done;
+    listrepr = PyObject_Repr(items);
+    Py_DECREF(items);
+    if (listrepr == NULL)
+        goto done;
+
+#if PY_MAJOR_VERSION > 2
+    result = PyString_FromFormat("%s(%U)", Py_TYPE(self)->tp_name, listrepr);
+#else
+    result = PyString_FromFormat("%s(%s)", Py_TYPE(self)->tp_name,
+                                 PyString_AS_STRING(listrepr));
+#endif
+    Py_DECREF(listrepr);
+done:
+    Py_ReprLeave((PyObject *)self);
+    return result;
+}
+
+static PyObject *
+map_richcompare(PyObject *v, PyObject *w, int op)
+{
+    if (!PyOrderedMap_Check(v) || !PyOrderedMap_Check(w) || (op != Py_EQ && op != Py_NE)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+
+    // Equal if the same items come in the same order.
+    ordered_map_by_key &a = ((PyOrderedMapObject *)v)->omap.get<key_index>();
+    ordered_map_by_key &b = ((PyOrderedMapObject *)w)->omap.get<key_index>();
+    int equal = a.size() == b.size();
+    for (Py_ssize_t i = 0; equal == 1 && i < (Py_ssize_t)a.size(); i++) {
+        // __eq__ may change either map, so hold on to both items and check
+        // the sizes again after every comparison.
+        if (i >= (Py_ssize_t)b.size()) {
+            equal = 0;
+            break;
+        }
+        const ordered_map_entry &x = a[i], &y = b[i];
+        PyObject *xkey = x.key, *xvalue = x.value, *ykey = y.key, *yvalue = y.value;
+        Py_INCREF(xkey);
+        Py_INCREF(xvalue);
+        Py_INCREF(ykey);
+        Py_INCREF(yvalue);
+        equal = PyObject_RichCompareBool(xkey, ykey, Py_EQ);
+        if (equal == 1)
+            equal = PyObject_RichCompareBool(xvalue, yvalue, Py_EQ);
+        Py_DECREF(xkey);
+        Py_DECREF(xvalue);
+        Py_DECREF(ykey);
+        Py_DECREF(yvalue);
+    }
+    if (equal == 1 && a.size() != b.size())
+        equal = 0;
+    if (equal == -1)
+        return NULL;
+    if ((op == Py_EQ) == (equal == 1))
+        Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
+}
+
+static PyMappingMethods map_as_mapping = {
+    (lenfunc)map_len,           /* mp_length */
+    (binaryfunc)map_subscript,  /* mp_subscript */
+    (objobjargproc)map_ass_subscript, /* mp_ass_subscript */
+};
+
+static PySequenceMethods map_as_sequence = {
+    0,                          /* sq_length */
+    0,                          /* sq_concat */
+    0,                          /* sq_repeat */
+    0,                          /* sq_item */
+    0,                          /* sq_slice */
+    0,                          /* sq_ass_item */
+    0,                          /* sq_ass_slice */
+    (objobjproc)map_contains,   /* sq_contains */
+};
+
+static PyMethodDef orderedmap_methods[] = {
+    {"clear", (PyCFunction)map_clear, METH_NOARGS, clear_doc},
+    {"copy", (PyCFunction)map_copy, METH_NOARGS, copy_doc},
+    {"get", (PyCFunction)map_get, METH_VARARGS, get_doc},
+    {"index", (PyCFunction)map_index, METH_O, index_doc},
+    {"item_at", (PyCFunction)map_item_at, METH_O, item_at_doc},
+    {"items", (PyCFunction)map_items, METH_NOARGS, items_doc},
+    {"key_at", (PyCFunction)map_key_at, METH_O, key_at_doc},
+    {"keys", (PyCFunction)map_keys, METH_NOARGS, keys_doc},
+    {"pop", (PyCFunction)map_pop, METH_VARARGS, pop_doc},
+    {"popitem", (PyCFunction)map_popitem, METH_VARARGS | METH_KEYWORDS, popitem_doc},
+    {"__reduce__", (PyCFunction)map_reduce, METH_NOARGS, reduce_doc},
+    {"setdefault", (PyCFunction)map_setdefault, METH_VARARGS, setdefault_doc},
+    {"__sizeof__", (PyCFunction)map_sizeof, METH_NOARGS, sizeof_doc},
+    {"update", (PyCFunction)map_update, METH_VARARGS | METH_KEYWORDS, update_doc},
+    {"values", (PyCFunction)map_values, METH_NOARGS, values_doc},
+    {NULL, NULL} /* sentinel */
+};
+
+PyDoc_STRVAR(orderedmap_doc,
+"orderedmap([mapping or iterable], **kwargs) --> orderedmap object\n\
+\n\
+Build an insertion ordered mapping. Besides lookups by key, key_at(i),\n\
+item_at(i) and index(key) give constant time access by position.");
+
+PyTypeObject PyOrderedMap_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "bcse.collections.orderedmap", /* tp_name */
+    sizeof(PyOrderedMapObject), /* tp_basicsize */
+    0,                          /* tp_itemsize */
+    /* methods */
+    (destructor)map_dealloc,    /* tp_dealloc */
+    0,                          /* tp_print */
+    0,                          /* tp_getattr */
+    0,                          /* tp_setattr */
+    0,                          /* tp_compare */
+    (reprfunc)map_repr,         /* tp_repr */
+    0,                          /* tp_as_number */
+    &map_as_sequence,           /* tp_as_sequence */
+    &map_as_mapping,            /* tp_as_mapping */
+    PyObject_HashNotImplemented, /* tp_hash */
+    0,                          /* tp_call */
+    0,                          /* tp_str */
+    PyObject_GenericGetAttr,    /* tp_getattro */
+    0,                          /* tp_setattro */
+    0,                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_BASETYPE, /* tp_flags */
+    orderedmap_doc,             /* tp_doc */
+    (traverseproc)map_traverse, /* tp_traverse */
+    (inquiry)map_clear_internal, /* tp_clear */
+    (richcmpfunc)map_richcompare, /* tp_richcompare */
+    0,                          /* tp_weaklistoffset */
+    (getiterfunc)map_iter,      /* tp_iter */
+    0,                          /* tp_iternext */
+    orderedmap_methods,         /* tp_methods */
+    0,                          /* tp_members */
+    0,                          /* tp_getset */
+    0,                          /* tp_base */
+    0,                          /* tp_dict */
+    0,                          /* tp_descr_get */
+    0,                          /* tp_descr_set */
+    0,                          /* tp_dictoffset */
+    (initproc)map_init,         /* tp_init */
+    PyType_GenericAlloc,        /* tp_alloc */
+    map_new,                    /* tp_new */
+    PyObject_GC_Del,            /* tp_free */
+};
@@ -0,0 +1,77 @@
+#ifndef orderedset_orderedmapobject_h
+#define orderedset_orderedmapobject_h
+
+#include <Python.h>
+#include "orderedsetobject.h"
+
+struct ordered_map_entry {
+    PyObject *key;
+    Py_hash_t hash;
+    // Replaced in place when an existing key is assigned to.
+    mutable PyObject *value;
+
+    ordered_map_entry(PyObject *key, Py_hash_t hash, PyObject *value)
+        : key(key), hash(hash), value(value)
+    {
+        Py_INCREF(key);
+        Py_INCREF(value);
+    }
+
+    ordered_map_entry(ordered_map_entry const & x)
+        : key(x.key), hash(x.hash), value(x.value)
+    {
+        Py_INCREF(key);
+        Py_INCREF(value);
+    }
+
+    ~ordered_map_entry()
+    {
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
+
+    PyObject *lookup_key() const
+    {
+        return key;
+    }
+};
+
+// Index tags of the container below.
+struct key_index{};
+struct hash_index{};
+
+// The orderedset container with a value next to each key.
+typedef multi_index_container<
+    ordered_map_entry,
+    indexed_by<
+        random_access<
+            tag<key_index>
+        >,
+        hashed_unique<
+            tag<hash_index>,
+            identity<ordered_map_entry>,
+            ordered_set_hash,
+            ordered_set_equal
+        >
+    >,
+    arena_allocator<ordered_map_entry, ordered_set_backend>
+> ordered_map;
+
+typedef ordered_map::index<key_index>::type ordered_map_by_key;
+typedef ordered_map::index<hash_index>::type ordered_map_by_hash;
+
+typedef struct _orderedmapobject {
+    PyObject_HEAD
+
+    ordered_map omap;
+    /* Bumped on every insertion and removal. */
+    unsigned long version;
+} PyOrderedMapObject;
+
+PyAPI_DATA(PyTypeObject) PyOrderedMap_Type;
+
+#define PyOrderedMap_Check(ob) \
+    (Py_TYPE(ob) == &PyOrderedMap_Type || \
+    PyType_IsSubtype(Py_TYPE(ob), &PyOrderedMap_Type))
+
+#endif
@@ -1,5 +1,9 @@
 #include <Python.h>
 #include <boost/tuple/tuple.hpp>
+#include <boost/ref.hpp>
+#include <algorithm>
+#include <chrono>
+#include <vector>
 #include "orderedsetobject.h"
 
 #define PyObject_IsIterable(ob) \
@@ -17,994 +21,3864 @@
     PyObject_HEAD_INIT(type) size,
 #endif
 
+#ifdef ORDEREDSET_PROFILE
+ordered_set_profile _PyOrderedSet_Profile;
+#endif
+
+/* Lazy set expressions, see below. Set operators leave expression operands
+ * to the expression's own slots. */
+extern PyTypeObject PyOrderedSetExpr_Type;
+#define PyOrderedSetExpr_Check(op) (Py_TYPE(op) == &PyOrderedSetExpr_Type)
+
+/***** Calling convention **********************************************/
+
+/*
+ * Methods taking more than one argument are written against METH_FASTCALL:
+ * they get the caller's argument array, plus a tuple of keyword names for
+ * METH_KEYWORDS, instead of a tuple and a dict built for every call. Before
+ * Python 3.7 SET_FASTCALL_ADAPTER(func) defines func_varargs to reach them
+ * the old way, and the method table entries pick whichever applies.
+ */
+typedef PyObject *(*set_fastcall_keywords)(PyOrderedSetObject *, PyObject *const *,
+                                           Py_ssize_t, PyObject *);
+
+#if PY_VERSION_HEX >= 0x03070000
+#define SET_FASTCALL_ADAPTER(func)
+#define SET_FASTCALL_KEYWORDS_ADAPTER(func)
+#define SET_FASTCALL(func) (PyCFunction)(void (*)(void))func, METH_FASTCALL
+#define SET_FASTCALL_KEYWORDS(func) \
+    (PyCFunction)(void (*)(void))func, METH_FASTCALL | METH_KEYWORDS
+#else
+#define SET_FASTCALL_ADAPTER(func) \
+    static PyObject * \
+    func##_varargs(PyOrderedSetObject *self, PyObject *args) \
+    { \
+        return func(self, &PyTuple_GET_ITEM(args, 0), PyTuple_GET_SIZE(args)); \
+    }
+#define SET_FASTCALL_KEYWORDS_ADAPTER(func) \
+    static PyObject * \
+    func##_varargs(PyOrderedSetObject *self, PyObject *args, PyObject *kwds) \
+    { \
+        return set_call_keywords(self, args, kwds, func); \
+    }
+#define SET_FASTCALL(func) (PyCFunction)func##_varargs, METH_VARARGS
+#define SET_FASTCALL_KEYWORDS(func) (PyCFunction)func##_varargs, METH_VARARGS | METH_KEYWORDS
+#endif
+
+/* Lay out a tuple and a dict of arguments the METH_FASTCALL way. *kwnames
+ * is left NULL without keywords and is a new reference otherwise. */
 static int
-set_contains(PyOrderedSetObject *self, PyObject *key)
+set_keywords_to_stack(PyObject *args, PyObject *kwds, std::vector<PyObject *> &stack,
+                      PyObject **kwnames)
 {
-    long hash;
+    PyObject *key, *value;
+    Py_ssize_t i = 0;
 
-    hash = PyObject_Hash(key);
-    if (hash == -1)
+    stack.assign(&PyTuple_GET_ITEM(args, 0),
+                 &PyTuple_GET_ITEM(args, 0) + PyTuple_GET_SIZE(args));
+    *kwnames = NULL;
+    if (kwds == NULL || PyDict_Size(kwds) == 0)
+        return 0;
+    *kwnames = PyTuple_New(PyDict_Size(kwds));
+    if (*kwnames == NULL)
         return -1;
-
-    ordered_set_by_hash &hashset = self->oset.get<hash_index>();
-    ordered_set_by_hash::iterator it = hashset.find(hash);
-    return it != hashset.end();
+    for (Py_ssize_t pos = 0; PyDict_Next(kwds, &pos, &key, &value); i++) {
+        Py_INCREF(key);
+        PyTuple_SET_ITEM(*kwnames, i, key);
+        stack.push_back(value);
+    }
+    return 0;
 }
 
+#if PY_VERSION_HEX < 0x03070000
+/* Call a METH_FASTCALL | METH_KEYWORDS function with a tuple and a dict. */
 static PyObject *
-set_index(PyOrderedSetObject *self, PyObject *key)
+set_call_keywords(PyOrderedSetObject *self, PyObject *args, PyObject *kwds,
+                  set_fastcall_keywords func)
 {
-    long hash;
+    std::vector<PyObject *> stack;
+    PyObject *kwnames, *result;
 
-    hash = PyObject_Hash(key);
-    if (hash == -1) {
-        PyErr_SetString(PyExc_TypeError, "unhashable type");
+    if (set_keywords_to_stack(args, kwds, stack, &kwnames) == -1)
         return NULL;
-    }
-
-    ordered_set_by_hash &hashset = self->oset.get<hash_index>();
-    ordered_set_by_hash::iterator it = hashset.find(hash);
+    result = func(self, stack.data(), PyTuple_GET_SIZE(args), kwnames);
+    Py_XDECREF(kwnames);
+    return result;
+}
+#endif
 
-    if (it != hashset.end()) {
-        ordered_set_by_key &set = self->oset.get<key_index>();
-        ordered_set_by_key::iterator it2 = self->oset.project<key_index>(it);
-        long n = std::distance(set.begin(), it2);
-        return PyLong_FromLong(n);
+static int
+set_check_nargs(const char *fname, Py_ssize_t nargs, Py_ssize_t min, Py_ssize_t max)
+{
+    if (nargs < min) {
+        PyErr_Format(PyExc_TypeError, "%s expected %s%zd argument%s, got %zd",
+                     fname, min == max ? "" : "at least ", min, min == 1 ? "" : "s", nargs);
+        return -1;
     }
-    PyErr_SetString(PyExc_ValueError, "x is not in set");
-    return NULL;
+    if (nargs > max) {
+        PyErr_Format(PyExc_TypeError, "%s expected %s%zd argument%s, got %zd",
+                     fname, min == max ? "" : "at most ", max, max == 1 ? "" : "s", nargs);
+        return -1;
+    }
+    return 0;
 }
 
-PyDoc_STRVAR(index_doc,
-"Return index of value.\n"
-"Raises ValueError if the value is not present.");
+static bool
+set_keyword_is(PyObject *name, const char *keyword)
+{
+#if PY_MAJOR_VERSION > 2
+    return PyUnicode_Check(name) && PyUnicode_CompareWithASCIIString(name, keyword) == 0;
+#else
+    return PyString_Check(name) && strcmp(PyString_AS_STRING(name), keyword) == 0;
+#endif
+}
 
+/* Sort arguments into slots[] in kwlist order, by position or by keyword,
+ * as PyArg_ParseTupleAndKeywords would. The first `required` slots must be
+ * given; the others keep their defaults unless passed. */
 static int
-set_add_key(PyOrderedSetObject *self, PyObject *key)
+set_parse_keywords(const char *fname, const char *const *kwlist, Py_ssize_t required,
+                   PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames,
+                   PyObject **slots)
 {
-    int contains = set_contains(self, key);
-    if (contains == -1) {
-        // key is not hashable
+    Py_ssize_t nslots = 0, nkw = kwnames != NULL ? PyTuple_GET_SIZE(kwnames) : 0;
+
+    while (kwlist[nslots] != NULL)
+        nslots++;
+    if (nargs > nslots) {
+        PyErr_Format(PyExc_TypeError, "%s() takes at most %zd arguments (%zd given)",
+                     fname, nslots, nargs + nkw);
         return -1;
     }
-    else if (contains == 1) {
-        // key is exists
-        return 0;
+    for (Py_ssize_t i = 0; i < nargs; i++)
+        slots[i] = args[i];
+    for (Py_ssize_t j = 0; j < nkw; j++) {
+        PyObject *name = PyTuple_GET_ITEM(kwnames, j);
+        Py_ssize_t i = 0;
+        while (i < nslots && !set_keyword_is(name, kwlist[i]))
+            i++;
+        if (i == nslots) {
+#if PY_MAJOR_VERSION > 2
+            PyErr_Format(PyExc_TypeError, "'%U' is an invalid keyword argument for %s()",
+                         name, fname);
+#else
+            PyErr_Format(PyExc_TypeError, "'%s' is an invalid keyword argument for %s()",
+                         PyString_AS_STRING(name), fname);
+#endif
+            return -1;
+        }
+        if (i < nargs) {
+            PyErr_Format(PyExc_TypeError, "argument for %s() given by name ('%s') "
+                         "and position (%zd)", fname, kwlist[i], i + 1);
+            return -1;
+        }
+        slots[i] = args[nargs + j];
     }
-    else {
-        // key is not exists
-        ordered_set_by_key &set = self->oset.get<key_index>();
-        set.push_back(ordered_set::value_type(key));
-        return 0;
+    for (Py_ssize_t i = 0; i < required; i++) {
+        if (slots[i] == NULL) {
+            PyErr_Format(PyExc_TypeError, "%s() missing required argument '%s' (pos %zd)",
+                         fname, kwlist[i], i + 1);
+            return -1;
+        }
     }
+    return 0;
 }
 
+/* The "n" and "i" conversions of PyArg_ParseTuple. */
 static int
-set_discard_key(PyOrderedSetObject *self, PyObject *key)
+set_arg_ssize(PyObject *obj, Py_ssize_t *value)
 {
-    long hash;
-
-    assert (PyOrderedSet_Check(self));
-    hash = PyObject_Hash(key);
-    if (hash == -1)
-        return -1;
-
-    ordered_set_by_hash &hashset = self->oset.get<hash_index>();
-    ordered_set::size_type status = hashset.erase(hash);
-    return status > 0;
+    *value = PyNumber_AsSsize_t(obj, PyExc_OverflowError);
+    return *value == -1 && PyErr_Occurred() ? -1 : 0;
 }
 
 static int
-set_clear_internal(PyOrderedSetObject *self)
+set_arg_flag(PyObject *obj, int *value)
 {
-    assert (PyOrderedSet_Check(self));
-    self->oset.clear();
+    Py_ssize_t v;
+
+    if (set_arg_ssize(obj, &v) == -1)
+        return -1;
+    *value = v != 0;
     return 0;
 }
 
 static void
-set_dealloc(PyOrderedSetObject *self)
+set_drop_sorted(PyOrderedSetObject *self)
 {
-    set_clear_internal(self);
-    Py_TYPE(self)->tp_free((PyObject *)self);
+    delete self->sorted;
+    self->sorted = NULL;
 }
 
-static int
-set_print(PyOrderedSetObject *self, FILE *fp, int flags)
+/* Rebuild the Bloom summary of a set that has one from its entries. It is
+ * sized for twice the current length, so the next rebuild is due after at
+ * least as many adds as there are keys now. */
+static void
+set_bloom_rebuild(PyOrderedSetObject *self)
 {
-    const char *emit = "";  /* No separator emitted on first pass */
-    const char *separator = ", ";
-    int status = Py_ReprEnter((PyObject*)self);
+    if (self->bloom == NULL)
+        return;
+    ordered_set &set = self->oset;
+    ordered_set_bloom *bloom = new ordered_set_bloom(2 * set.size());
+    for (ordered_set::iterator it = set.begin(); it != set.end(); it++)
+        bloom->add(it->hash);
+    delete self->bloom;
+    self->bloom = bloom;
+}
 
-    if (status != 0) {
-        if (status < 0)
-            return status;
-        fprintf(fp, "%s(...)", Py_TYPE(self)->tp_name);
-        return 0;
-    }
+/* Sets an error that is already pending aside while the sorted index is
+ * updated, so that set_sorted_check() only sees errors raised by the
+ * index's own comparisons, and restores it afterwards. */
+struct ordered_set_error_stash {
+    PyObject *type, *value, *traceback;
 
-    fprintf(fp, "%s([", Py_TYPE(self)->tp_name);
-    ordered_set_by_key &set = self->oset.get<key_index>();
-    ordered_set_by_key::iterator it;
-    for (it = set.begin(); it < set.end(); it++) {
-        ordered_set::value_type entry = *it;
-        fputs(emit, fp);
-        emit = separator;
-        if (PyObject_Print(entry.key, fp, 0) != 0) {
-            Py_ReprLeave((PyObject*)self);
-            return -1;
-        }
-    }
-    fputs("])", fp);
-    Py_ReprLeave((PyObject*)self);
-    return 0;
-}
+    ordered_set_error_stash() { PyErr_Fetch(&type, &value, &traceback); }
 
-static PyObject *
-set_repr(PyOrderedSetObject *self)
-{
-    PyObject *keys, *result=NULL, *listrepr;
-    int status = Py_ReprEnter((PyObject*)self);
+    ~ordered_set_error_stash() { PyErr_Restore(type, value, traceback); }
+};
 
-    if (status != 0) {
-        if (status < 0)
-            return NULL;
-        return PyString_FromFormat("%s(...)", Py_TYPE(self)->tp_name);
+static void
+set_sorted_check(PyOrderedSetObject *self)
+{
+    if (PyErr_Occurred()) {
+        // A key is not orderable against the others, give the sorted index
+        // up. The next sorted query rebuilds it and reports the error.
+        PyErr_Clear();
+        set_drop_sorted(self);
     }
+}
 
-    keys = PySequence_List((PyObject *)self);
-    if (keys == NULL)
-        goto done;
-    listrepr = PyObject_Repr(keys);
-    Py_DECREF(keys);
-    if (listrepr == NULL)
-        goto done;
+/* Spread the hash bits before summing, so that sets whose hashes cancel
+ * out in a plain sum (e.g. {1, 2} and {0, 3}) still get different
+ * fingerprints. The same shuffle frozenset hashing uses. */
+static inline Py_uhash_t
+set_fingerprint_mix(Py_hash_t hash)
+{
+    Py_uhash_t h = (Py_uhash_t)hash;
+    return ((h ^ 89869747UL) ^ (h << 16)) * 3644798167UL;
+}
 
-#if PY_MAJOR_VERSION > 2
-    result = PyString_FromFormat("%s(%U)", Py_TYPE(self)->tp_name, listrepr);
-#else
-    result = PyString_FromFormat("%s(%s)", Py_TYPE(self)->tp_name,
-                                 PyString_AS_STRING(listrepr));
-#endif
+/* Record a change in the log of a set that tracks them, at the version
+ * the change brought the set to. */
+static inline void
+set_log_change(PyOrderedSetObject *self, int op, PyObject *key, Py_ssize_t index = 0)
+{
+    if (self->changelog != NULL)
+        self->changelog->record(op, key, index, self->version);
+}
 
-    Py_DECREF(listrepr);
-done:
-    Py_ReprLeave((PyObject*)self);
-    return result;
+/* Called after entry has been appended to self->oset. */
+static void
+set_entry_added(PyOrderedSetObject *self, const ordered_set_entry &entry)
+{
+    PyObject *key = entry.key;
+
+    self->version++;
+    set_log_change(self, PyOrderedSet_CHANGE_ADD, key);
+    self->fingerprint += set_fingerprint_mix(entry.hash);
+    if (self->bloom != NULL) {
+        self->bloom->add(entry.hash);
+        if (self->bloom->full())
+            set_bloom_rebuild(self);
+    }
+    if (self->sorted != NULL) {
+        ordered_set_error_stash stash;
+        self->sorted->insert(sorted_set_entry(key));
+        set_sorted_check(self);
+    }
 }
 
-static Py_ssize_t
-set_len(PyOrderedSetObject *self)
+/* Called before entry is erased from self->oset. */
+static void
+set_entry_removed(PyOrderedSetObject *self, const ordered_set_entry &entry)
 {
-    return self->oset.size();
+    PyObject *key = entry.key;
+
+    self->version++;
+    set_log_change(self, PyOrderedSet_CHANGE_DISCARD, key);
+    self->fingerprint -= set_fingerprint_mix(entry.hash);
+    if (self->sorted != NULL) {
+        ordered_set_error_stash stash;
+        ordered_set_sorted::iterator it, last;
+        boost::tie(it, last) = self->sorted->equal_range(sorted_set_entry(key));
+        while (it != last && it->key != key)
+            ++it;
+        if (it != last)
+            self->sorted->erase(it);
+        else
+            set_drop_sorted(self);
+        set_sorted_check(self);
+    }
 }
 
-static PyObject *
-set_pop(PyOrderedSetObject *self, PyObject *args)
+/* Called before the contents of self->oset are replaced wholesale. */
+static void
+set_contents_replaced(PyOrderedSetObject *self)
 {
-    Py_ssize_t i = -1, len;
-    PyObject *v;
+    self->version++;
+    set_drop_sorted(self);
+}
 
-    if (!PyArg_ParseTuple(args, "|n:pop", &i))
-        return NULL;
+/* Current time on the clock of a set with a ttl. */
+static int
+set_now(PyOrderedSetObject *self, double *now)
+{
+    PyObject *t;
 
-    len = set_len(self);
-    if (len == 0) {
-        /* Special-case most common failure cause */
-        PyErr_SetString(PyExc_IndexError, "pop from empty set");
-        return NULL;
-    }
-    if (i < 0)
-        i += len;
-    if (i < 0 || i >= len) {
-        PyErr_SetString(PyExc_IndexError, "pop index out of range");
-        return NULL;
+    if (self->clock == NULL) {
+        // The steady clock time.monotonic() reads as well.
+        *now = std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        return 0;
     }
-    ordered_set_by_key &set = self->oset.get<key_index>();
-    v = set[i].key;
-    Py_INCREF(v);
-    set.erase(set.begin() + i);
-    return v;
+    t = PyObject_CallObject(self->clock, NULL);
+    if (t == NULL)
+        return -1;
+    *now = PyFloat_AsDouble(t);
+    Py_DECREF(t);
+    if (*now == -1.0 && PyErr_Occurred())
+        return -1;
+    return 0;
 }
 
-PyDoc_STRVAR(pop_doc,
-"Remove and return item at index (default last).\n\
-\n\
-Raises IndexError if set is empty or index is out of range.");
+static inline bool
+set_entry_live(PyOrderedSetObject *self, const ordered_set_entry &entry, double now)
+{
+    return self->ttl < 0.0 || entry.stamp > now - self->ttl;
+}
 
+/* Hash key for a lookup in self, passing it through the set's key function
+ * first unless it is projected already. probe->key is a new reference. */
 static int
-set_traverse(PyOrderedSetObject *self, visitproc visit, void *arg)
+set_probe(PyOrderedSetObject *self, PyObject *key, bool projected,
+          ordered_set_probe *probe)
 {
-    ordered_set_by_key &set = self->oset.get<key_index>();
-    ordered_set_by_key::iterator it;
-    for (it = set.begin(); it < set.end(); it++) {
-        ordered_set::value_type entry = *it;
-        Py_VISIT(entry.key);
+    if (self->keyfunc != NULL && !projected) {
+        probe->key = PyObject_CallFunctionObjArgs(self->keyfunc, key, NULL);
+        if (probe->key == NULL)
+            return -1;
+    }
+    else {
+        Py_INCREF(key);
+        probe->key = key;
+    }
+    probe->hash = PyObject_Hash(probe->key);
+    ORDEREDSET_COUNT(hash_calls);
+    if (probe->hash == -1) {
+        Py_CLEAR(probe->key);
+        return -1;
     }
     return 0;
 }
 
-static long
-set_nohash(PyObject *self)
+/* Locate a probed key in the order index. Returns 1 and sets *pos if found,
+ * 0 if not and -1 if comparing keys failed. */
+static int
+set_lookup(PyOrderedSetObject *self, const ordered_set_probe &probe,
+           const ordered_set_entry **pos)
 {
-    PyErr_SetString(PyExc_TypeError, "set objects are unhashable");
-    return -1;
+    if (self->bloom != NULL && !self->bloom->may_contain(probe.hash)) {
+        ORDEREDSET_COUNT(bloom_rejects);
+        return 0;
+    }
+    *pos = self->oset.find(probe, ordered_set_hash(), ordered_set_equal());
+    if (*pos == NULL)
+        return PyErr_Occurred() ? -1 : 0;
+    return 1;
 }
 
-/***** Set iterator type ***********************************************/
+/* Record the keys in self in order as one change. */
+static void
+set_log_order(PyOrderedSetObject *self)
+{
+    if (self->changelog == NULL)
+        return;
+    ordered_set &set = self->oset;
+    PyObject *keys = PyTuple_New(set.size());
+    if (keys == NULL) {
+        PyErr_Clear();
+        self->changelog->forget(self->version);
+        return;
+    }
+    for (Py_ssize_t i = 0; i < (Py_ssize_t)set.size(); i++) {
+        Py_INCREF(set[i].key);
+        PyTuple_SET_ITEM(keys, i, set[i].key);
+    }
+    set_log_change(self, PyOrderedSet_CHANGE_ORDER, keys);
+    Py_DECREF(keys);
+}
 
-typedef struct {
-    PyObject_HEAD
-    PyOrderedSetObject *si_set; /* Set to NULL when iterator is exhausted */
-    Py_ssize_t si_size;
-    Py_ssize_t si_pos;
-    Py_ssize_t len;
-} setiterobject;
+/* Record the contents of self replacing those of old as the keys removed
+ * and the keys appended. In place set algebra keeps the surviving keys in
+ * their order and appends new ones; anything else gets its order recorded
+ * on top. */
+static void
+set_log_replaced(PyOrderedSetObject *self, PyOrderedSetObject *old)
+{
+    ordered_set &set = self->oset;
+    ordered_set &old_set = old->oset;
+    const ordered_set_entry *pos = NULL;
+    Py_ssize_t last = -1;
+    bool appended = false, in_order = true;
+
+    if (self->changelog == NULL)
+        return;
+    for (ordered_set::iterator it = old_set.begin(); it != old_set.end(); ++it) {
+        ordered_set_probe probe = {it->lookup_key(), it->hash};
+        int found = set_lookup(self, probe, &pos);
+        if (found == -1)
+            goto error;
+        if (found == 0)
+            set_log_change(self, PyOrderedSet_CHANGE_DISCARD, it->key);
+    }
+    for (ordered_set::iterator it = set.begin(); it != set.end(); ++it) {
+        ordered_set_probe probe = {it->lookup_key(), it->hash};
+        int found = set_lookup(old, probe, &pos);
+        if (found == -1)
+            goto error;
+        if (found == 0) {
+            set_log_change(self, PyOrderedSet_CHANGE_ADD, it->key);
+            appended = true;
+        }
+        else {
+            if (appended || (Py_ssize_t)old_set.index_of(pos) < last)
+                in_order = false;
+            last = old_set.index_of(pos);
+        }
+    }
+    if (!in_order)
+        set_log_order(self);
+    return;
+
+error:
+    PyErr_Clear();
+    self->changelog->forget(self->version);
+}
 
 static void
-setiter_dealloc(setiterobject *si)
+set_swap_contents(PyOrderedSetObject *self, PyOrderedSetObject *other)
 {
-    Py_XDECREF(si->si_set);
-    PyObject_Del(si);
+    set_contents_replaced(self);
+    set_contents_replaced(other);
+    self->oset.swap(other->oset);
+    std::swap(self->fingerprint, other->fingerprint);
+    // In place operations build their result apart, keep the room reserved.
+    self->oset.reserve(self->reserved);
+    set_bloom_rebuild(self);
+    set_bloom_rebuild(other);
+    set_log_replaced(self, other);
 }
 
-static PyObject *
-setiter_len(setiterobject *si)
+/* Locate key, or a projected key if projected is set, in the order index.
+ * Returns 1 and sets *pos if found, 0 if not and -1 on error. */
+static int
+set_find_as(PyOrderedSetObject *self, PyObject *key, bool projected,
+            const ordered_set_entry **pos)
 {
-    Py_ssize_t len = 0;
-    if (si->si_set != NULL && si->si_size == set_len(si->si_set))
-        len = si->len;
-    return PyLong_FromLong(len);
+    ordered_set_probe probe;
+
+    if (set_probe(self, key, projected, &probe) == -1)
+        return -1;
+    int found = set_lookup(self, probe, pos);
+    Py_DECREF(probe.key);
+    return found;
 }
 
-PyDoc_STRVAR(length_hint_doc, "Private method returning an estimate of len(list(it)).");
+static int
+set_find(PyOrderedSetObject *self, PyObject *key, const ordered_set_entry **pos)
+{
+    return set_find_as(self, key, false, pos);
+}
 
-static PyMethodDef setiter_methods[] = {
-    {"__length_hint__", (PyCFunction)setiter_len, METH_NOARGS, length_hint_doc},
-    {NULL, NULL} /* sentinel */
-};
+/* The clock of a set with a ttl, read once by operations that probe it
+ * for many keys. 0 for sets without a ttl. */
+static int
+set_clock(PyOrderedSetObject *self, double *now)
+{
+    *now = 0.0;
+    return self->ttl < 0.0 ? 0 : set_now(self, now);
+}
 
-static PyObject *
-setiter_iternext(setiterobject *si)
+/* Hide a key found in a set with a ttl once it has expired at time now.
+ * Expired keys stay in the set until its front is swept. */
+static int
+set_found_live_at(PyOrderedSetObject *self, int found, const ordered_set_entry *pos,
+                  double now)
 {
-    PyObject *key;
-    Py_ssize_t i, mask;
-    PyOrderedSetObject *so = si->si_set;
+    if (found != 1 || self->ttl < 0.0)
+        return found;
+    return set_entry_live(self, *pos, now);
+}
 
-    if (so == NULL)
-        return NULL;
-    assert (PyOrderedSet_Check(so));
+/* set_found_live_at() on the current time. */
+static int
+set_found_live(PyOrderedSetObject *self, int found, const ordered_set_entry *pos)
+{
+    double now;
 
-    if (si->si_size != set_len(so)) {
-        PyErr_SetString(PyExc_RuntimeError,
-                        "Set changed size during iteration");
-        si->si_size = -1; /* Make this state sticky */
-        return NULL;
-    }
+    if (found != 1 || self->ttl < 0.0)
+        return found;
+    if (set_now(self, &now) == -1)
+        return -1;
+    return set_found_live_at(self, found, pos, now);
+}
 
-    i = si->si_pos;
-    assert (i >= 0);
-    mask = si->si_size - 1;
-    si->si_pos = i + 1;
+static int
+set_contains(PyOrderedSetObject *self, PyObject *key)
+{
+    const ordered_set_entry *pos = NULL;
 
-    if (i > mask) {
-        Py_DECREF(so);
-        si->si_set = NULL;
-        return NULL;
-    }
+    int found = set_find(self, key, &pos);
+    return set_found_live(self, found, pos);
+}
 
-    si->len--;
-    ordered_set_by_key &set = si->si_set->oset.get<key_index>();
-    key = set[i].key;
-    Py_INCREF(key);
-    return key;
+/* set_find() for an entry of another set. The cached hash and projection
+ * are reused when both sets project keys the same way. */
+static int
+set_find_entry(PyOrderedSetObject *self, PyOrderedSetObject *from,
+               const ordered_set_entry &entry, const ordered_set_entry **pos)
+{
+    if (self->keyfunc != from->keyfunc)
+        return set_find(self, entry.key, pos);
+    ordered_set_probe probe = {entry.lookup_key(), entry.hash};
+    return set_lookup(self, probe, pos);
 }
 
-static PyTypeObject PyOrderedSetIter_Type = {
-    PyVarObject_HEAD_INIT(&PyType_Type, 0)
-    "orderedsetiterator",       /* tp_name */
-    sizeof(setiterobject),      /* tp_basicsize */
-    0,                          /* tp_itemsize */
-    /* methods */
-    (destructor)setiter_dealloc, /* tp_dealloc */
-    0,                          /* tp_print */
-    0,                          /* tp_getattr */
-    0,                          /* tp_setattr */
-    0,                          /* tp_compare */
-    0,                          /* tp_repr */
-    0,                          /* tp_as_number */
-    0,                          /* tp_as_sequence */
-    0,                          /* tp_as_mapping */
-    0,                          /* tp_hash */
-    0,                          /* tp_call */
-    0,                          /* tp_str */
-    PyObject_GenericGetAttr,    /* tp_getattro */
-    0,                          /* tp_setattro */
-    0,                          /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,         /* tp_flags */
-    0,                          /* tp_doc */
-    0,                          /* tp_traverse */
-    0,                          /* tp_clear */
-    0,                          /* tp_richcompare */
-    0,                          /* tp_weaklistoffset */
-    PyObject_SelfIter,          /* tp_iter */
-    (iternextfunc)setiter_iternext, /* tp_iternext */
-    setiter_methods,            /* tp_methods */
-    0,
-};
+/* set_contains() for an entry of another set, at time now on the clock of
+ * self as read by set_clock(). */
+static int
+set_contains_entry(PyOrderedSetObject *self, PyOrderedSetObject *from,
+                   const ordered_set_entry &entry, double now)
+{
+    const ordered_set_entry *pos = NULL;
 
-static PyObject *
-set_iter(PyOrderedSetObject *self)
+    int found = set_find_entry(self, from, entry, &pos);
+    return set_found_live_at(self, found, pos, now);
+}
+
+/* Called after elements have been moved within self->oset. */
+static void
+set_order_changed(PyOrderedSetObject *self)
 {
-    setiterobject *si = PyObject_New(setiterobject, &PyOrderedSetIter_Type);
-    if (si == NULL)
-        return NULL;
-    Py_INCREF(self);
-    Py_ssize_t size = set_len(self);
-    si->si_set = self;
-    si->si_size = size;
-    si->si_pos = 0;
-    si->len = size;
-    return (PyObject *)si;
+    self->version++;
+}
+
+/* Move a key hit in touch mode to the end, where eviction reaches it
+ * last. */
+static void
+set_touch_entry(PyOrderedSetObject *self, const ordered_set_entry *entry)
+{
+    ordered_set &set = self->oset;
+    Py_ssize_t pos = set.index_of(entry), last = set.size() - 1;
+
+    if (pos == last)
+        return;
+    set.move(pos, last);
+    set_order_changed(self);
+    set_log_change(self, PyOrderedSet_CHANGE_MOVE, entry->key, last);
 }
 
+/* set_contains() that also moves a hit to the end for sets in touch mode. */
 static int
-set_update_internal(PyOrderedSetObject *self, PyObject *other)
+set_contains_touch(PyOrderedSetObject *self, PyObject *key)
 {
-    PyObject *key, *it;
+    const ordered_set_entry *pos = NULL;
+
+    if (!self->touch)
+        return set_contains(self, key);
+    int found = set_find(self, key, &pos);
+    if (found == 1)
+        set_touch_entry(self, pos);
+    return found;
+}
 
-    it = PyObject_GetIter(other);
-    if (it == NULL)
-        return -1;
+static void
+set_compact_internal(PyOrderedSetObject *self)
+{
+    ordered_set compacted;
+    ordered_set &old_set = self->oset;
+    Py_ssize_t n = std::max((Py_ssize_t)old_set.size(), self->reserved);
+
+    ORDEREDSET_COUNT(compactions);
+
+    // Rebuild into a fresh arena with arrays sized for the live elements,
+    // or for as many as reserve() made room for. Iterators point into the
+    // old arrays, so this counts as a change.
+    self->version++;
+    compacted.reserve(n);
+    for (ordered_set::iterator it = old_set.begin(); it != old_set.end(); ++it)
+        compacted.push_back(*it);
+    self->oset.swap(compacted);
+    // Drop the bits the discarded keys left behind as well.
+    set_bloom_rebuild(self);
+}
 
-//    Py_ssize_t set_size = PyObject_Length(other);
-//    ordered_set_by_key &set = self->oset.get<key_index>();
-//    set_size += set.size();
-//    set.reserve(set_size);
+static void
+set_maybe_shrink(PyOrderedSetObject *self)
+{
+    ordered_set &set = self->oset;
+    ordered_set::size_type capacity = set.capacity();
 
-    while ((key = PyIter_Next(it)) != NULL) {
-        if (set_add_key(self, key) == -1) {
-            Py_DECREF(it);
-            Py_DECREF(key);
-            return -1;
-        }
-        Py_DECREF(key);
-    }
-    Py_DECREF(it);
-    if (PyErr_Occurred())
-        return -1;
-    return 0;
+    if (capacity < PyOrderedSet_SHRINK_MINSIZE || (Py_ssize_t)capacity <= self->reserved)
+        return;
+    if (set.size() < capacity * self->shrink_ratio)
+        set_compact_internal(self);
 }
 
-static PyObject *
-set_update(PyOrderedSetObject *self, PyObject *other)
+/* Remove the first n keys in one pass over the order. */
+static void
+set_erase_front(PyOrderedSetObject *self, Py_ssize_t n)
 {
-    if (!PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
-    }
+    ordered_set &set = self->oset;
 
-    if (set_update_internal(self, other) == -1)
-        return NULL;
-    Py_RETURN_NONE;
+    for (Py_ssize_t i = 0; i < n; i++)
+        set_entry_removed(self, set[i]);
+    ORDEREDSET_COUNT_ERASE(set.shift_cost(n - 1));
+    set.erase(set.begin(), set.begin() + n);
 }
 
-PyDoc_STRVAR(update_doc, "Update a set with the union of itself and another.");
-
-static PyObject *
-make_new_set(PyTypeObject *type, PyObject *iterable)
+/* Make room for one more key in a bounded set by evicting the oldest. */
+static void
+set_make_room(PyOrderedSetObject *self)
 {
-    register PyOrderedSetObject *so = NULL;
-
-    if (type == &PyOrderedSet_Type) {
-        so = (PyOrderedSetObject *)type->tp_alloc(type, 0);
-        if (so == NULL)
-            return NULL;
+    Py_ssize_t len = self->oset.size();
 
-        ordered_set::ctor_args_list args_list = boost::make_tuple(
-            ordered_set_by_key::ctor_args(),
-            ordered_set_by_hash::ctor_args());
-        ordered_set set(args_list);
-        so->oset = set;
-    }
+    if (len >= self->maxlen && len > 0)
+        set_erase_front(self, len - self->maxlen + 1);
+}
 
-    if (iterable != NULL) {
-        if (set_update_internal(so, iterable) == -1) {
-            Py_DECREF(so);
-            return NULL;
-        }
+struct stamp_before {
+    bool operator()(double t, const ordered_set_entry &entry) const
+    {
+        return t < entry.stamp;
     }
+};
 
-    return (PyObject *)so;
-}
-
-static PyObject *
-set_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+/* Remove the keys of a set with a ttl that have expired by now. Stamps
+ * never decrease along the order, so these form a prefix of the set. Unless
+ * forced, wait for the prefix to reach a sixteenth of the set and erase it
+ * a leaf at a time; lookups hide expired keys meanwhile. */
+static Py_ssize_t
+set_expire_internal(PyOrderedSetObject *self, double now, bool force)
 {
-    if (type == &PySet_Type && !_PyArg_NoKeywords("orderedset()", kwds))
-        return NULL;
+    ordered_set &set = self->oset;
+    Py_ssize_t n = set.size();
+    double cutoff = now - self->ttl;
 
-    return make_new_set(type, NULL);
+    if (n == 0 || set[0].stamp > cutoff)
+        return 0;
+    if (!force && set[n >> PyOrderedSet_EXPIRE_SHIFT].stamp > cutoff)
+        return 0;
+    n = std::upper_bound(set.begin(), set.end(), cutoff, stamp_before()) - set.begin();
+    set_erase_front(self, n);
+    set_maybe_shrink(self);
+    return n;
 }
 
-static PyObject *
-set_copy(PyOrderedSetObject *self)
+/* Sweep every expired key of a set with a ttl, reading its clock once.
+ * Lookups hide expired keys on their own; whatever counts keys or reaches
+ * them by position calls this first, so it agrees with them. */
+static int
+set_expire_now(PyOrderedSetObject *self)
 {
-    PyOrderedSetObject *so = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), NULL);
-    ordered_set new_set(self->oset); // Use copy constructor to create a shallow copy.
-    so->oset = new_set;
+    double now;
 
-    return (PyObject *)so;
+    if (self->ttl < 0.0)
+        return 0;
+    if (set_now(self, &now) == -1)
+        return -1;
+    set_expire_internal(self, now, true);
+    return 0;
 }
 
-PyDoc_STRVAR(copy_doc, "Return a shallow copy of a set.");
-
-static PyObject *
-set_clear(PyOrderedSetObject *self)
+static int
+set_sq_contains(PyOrderedSetObject *self, PyObject *key)
 {
-    set_clear_internal(self);
-    Py_RETURN_NONE;
-}
+    const ordered_set_entry *pos = NULL;
+    double now;
 
-PyDoc_STRVAR(clear_doc, "Remove all elements from this set.");
+    ORDEREDSET_TIME(PyOrderedSet_OP_CONTAINS);
+    if (self->ttl < 0.0)
+        return set_contains_touch(self, key);
+    if (set_now(self, &now) == -1)
+        return -1;
+    set_expire_internal(self, now, false);
+    int found = set_find(self, key, &pos);
+    if (found == 1)
+        return set_entry_live(self, *pos, now);
+    return found;
+}
 
 static PyObject *
-set_union(PyOrderedSetObject *self, PyObject *other)
+set_index(PyOrderedSetObject *self, PyObject *key)
 {
-    if (!PyOrderedSet_Check(self) || !PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
-    }
-
-    PyObject *result;
+    const ordered_set_entry *pos = NULL;
 
-    result = set_copy(self);
-    if (result == NULL)
+    ORDEREDSET_TIME(PyOrderedSet_OP_INDEX);
+    if (set_expire_now(self) == -1)
         return NULL;
-    if (set_update_internal((PyOrderedSetObject *)result, other) == -1)
+    int found = set_find(self, key, &pos);
+    if (found == -1)
         return NULL;
-    return result;
+    if (found == 1)
+        return PyLong_FromSsize_t(self->oset.index_of(pos));
+    PyErr_SetString(PyExc_ValueError, "x is not in set");
+    return NULL;
 }
 
-PyDoc_STRVAR(union_doc,
-"Return the union of two sets as a new set.\n\
-\n\
-(i.e. all elements that are in either set.)");
-
-static PyObject *
-set_or(PyOrderedSetObject *self, PyObject *other)
-{
-    return set_union(self, other);
-}
+PyDoc_STRVAR(index_doc,
+"Return index of value.\n"
+"Raises ValueError if the value is not present.");
 
-static PyObject *
-set_ior(PyOrderedSetObject *self, PyObject *other)
+/* Append an entry whose key is not in self, evicting first if the set is
+ * full. */
+static void
+set_append(PyOrderedSetObject *self, const ordered_set_entry &entry)
 {
-    if (!PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
+    if (self->maxlen >= 0) {
+        if (self->maxlen == 0)
+            return;
+        set_make_room(self);
     }
-    if (set_update_internal(self, other) == -1)
-        return NULL;
-    Py_INCREF(self);
-    return (PyObject *)self;
+    self->oset.push_back(entry);
+    set_entry_added(self, entry);
 }
 
-static PyObject *
-set_intersection(PyOrderedSetObject *self, PyObject *other)
+/* Add key, already probed, unless it is present. Sets with a ttl sweep
+ * expired keys first and stamp the new one. */
+static int
+set_add_probe(PyOrderedSetObject *self, PyObject *key, const ordered_set_probe &probe)
 {
-    if (!PyOrderedSet_Check(self) || !PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
-    }
-
-    PyOrderedSetObject *otherset, *result;
+    const ordered_set_entry *pos = NULL;
+    double now = 0.0;
 
-    if (!PyOrderedSet_Check(other)) {
-        otherset = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), other);
-        if (otherset == NULL)
-            return NULL;
-        return set_intersection(self, (PyObject *)otherset);
+    if (self->ttl >= 0.0) {
+        if (set_now(self, &now) == -1)
+            return -1;
+        set_expire_internal(self, now, false);
     }
-
-    otherset = (PyOrderedSetObject *)other;
-    result = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), NULL);
-
-    ordered_set_by_key &set = self->oset.get<key_index>();
-    ordered_set_by_key::iterator it;
-    for (it = set.begin(); it < set.end(); it++) {
-        ordered_set::value_type entry = *it;
-        if (set_contains(otherset, entry.key)) {
-            set_add_key(result, entry.key);
+    int found = set_lookup(self, probe, &pos);
+    if (found == -1)
+        return -1;
+    if (found == 1) {
+        if (self->ttl < 0.0) {
+            if (self->touch)
+                set_touch_entry(self, pos);
+            return 0;
         }
+        if (set_entry_live(self, *pos, now))
+            return 0;
+        // An expired key comes back, drop the prefix it is part of.
+        set_expire_internal(self, now, true);
     }
-
-    if (PyErr_Occurred()) {
-        Py_DECREF(result);
-        return NULL;
+    if (self->ttl >= 0.0) {
+        // Keep stamps in order should a caller supplied clock step back.
+        ordered_set &set = self->oset;
+        if (!set.empty() && set.back().stamp > now)
+            now = set.back().stamp;
     }
-    return (PyObject *)result;
+    set_append(self, ordered_set_entry(key, probe.hash,
+                                       self->keyfunc != NULL ? probe.key : NULL, now));
+    return 0;
 }
 
-PyDoc_STRVAR(intersection_doc,
-"Return the intersection of two sets as a new set.\n\
-\n\
-(i.e. all elements that are in both sets.)");
-
-static PyObject *
-set_intersection_update(PyOrderedSetObject *self, PyObject *other)
+static int
+set_add_key(PyOrderedSetObject *self, PyObject *key)
 {
-    if (!PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
-    }
+    ordered_set_probe probe;
 
-    PyObject *tmp;
+    if (set_probe(self, key, false, &probe) == -1)
+        return -1;
+    int rv = set_add_probe(self, key, probe);
+    Py_DECREF(probe.key);
+    return rv;
+}
 
-    tmp = set_intersection(self, other);
-    if (tmp == NULL)
-        return NULL;
-    self->oset = ((PyOrderedSetObject *)tmp)->oset;
-    Py_DECREF(tmp);
-    Py_RETURN_NONE;
+/* Discard key, or a projected key if projected is set. Returns 1 if it was
+ * present, 0 if not and -1 on error. */
+static int
+set_discard_as(PyOrderedSetObject *self, PyObject *key, bool projected)
+{
+    const ordered_set_entry *pos = NULL;
+
+    assert (PyOrderedSet_Check(self));
+    int found = set_find_as(self, key, projected, &pos);
+    if (found != 1)
+        return found;
+    Py_ssize_t i = self->oset.index_of(pos);
+    ORDEREDSET_COUNT_ERASE(self->oset.shift_cost(i));
+    set_entry_removed(self, *pos);
+    self->oset.erase(i);
+    set_maybe_shrink(self);
+    return 1;
 }
 
-PyDoc_STRVAR(intersection_update_doc,
-"Update a set with the intersection of itself and another.");
+static int
+set_discard_key(PyOrderedSetObject *self, PyObject *key)
+{
+    return set_discard_as(self, key, false);
+}
 
-static PyObject *
-set_and(PyOrderedSetObject *self, PyObject *other)
+static int
+set_clear_internal(PyOrderedSetObject *self)
 {
-    return set_intersection(self, other);
+    assert (PyOrderedSet_Check(self));
+    // Swap in an empty container with an arena of its own, so the old
+    // nodes are released together with their arena when `old` goes away.
+    ordered_set old;
+    set_contents_replaced(self);
+    self->oset.swap(old);
+    self->reserved = 0;
+    set_log_change(self, PyOrderedSet_CHANGE_CLEAR, NULL);
+    self->fingerprint = 0;
+    set_bloom_rebuild(self);
+    return 0;
 }
 
-static PyObject *
-set_iand(PyOrderedSetObject *self, PyObject *other)
+static int
+set_tp_clear(PyOrderedSetObject *self)
 {
-    PyObject *result;
+    ordered_set_changelog *changelog = self->changelog;
 
-    if (!PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
-    }
-    result = set_intersection_update(self, other);
-    if (result == NULL)
-        return NULL;
-    Py_DECREF(result);
-    Py_INCREF(self);
-    return (PyObject *)self;
+    self->changelog = NULL;
+    delete changelog;
+    Py_CLEAR(self->clock);
+    Py_CLEAR(self->keyfunc);
+    return set_clear_internal(self);
 }
 
-static PyObject *
-set_difference(PyOrderedSetObject *self, PyObject *other)
+static void
+set_dealloc(PyOrderedSetObject *self)
 {
-    if (!PyOrderedSet_Check(self) || !PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
-    }
+    PyObject_GC_UnTrack(self);
+    set_drop_sorted(self);
+    delete self->bloom;
+    delete self->changelog;
+    Py_CLEAR(self->clock);
+    Py_CLEAR(self->keyfunc);
+    self->oset.~ordered_set();
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
 
-    PyOrderedSetObject *otherset, *result;
+static int
+set_print(PyOrderedSetObject *self, FILE *fp, int flags)
+{
+    const char *emit = "";  /* No separator emitted on first pass */
+    const char *separator = ", ";
+    int status = Py_ReprEnter((PyObject*)self);
 
-    if (!PyOrderedSet_Check(other)) {
-        otherset = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), other);
-        if (otherset == NULL)
-            return NULL;
-        return set_difference(self, (PyObject *)otherset);
+    if (status != 0) {
+        if (status < 0)
+            return status;
+        fprintf(fp, "%s(...)", Py_TYPE(self)->tp_name);
+        return 0;
     }
 
-    otherset = (PyOrderedSetObject *)other;
-    result = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), NULL);
-
-    ordered_set_by_key &aset = self->oset.get<key_index>();
-    for (ordered_set_by_key::iterator it = aset.begin(); it < aset.end(); it++) {
+    fprintf(fp, "%s([", Py_TYPE(self)->tp_name);
+    ordered_set &set = self->oset;
+    ordered_set::iterator it;
+    for (it = set.begin(); it < set.end(); it++) {
         ordered_set::value_type entry = *it;
-        if (!set_contains(otherset, entry.key)) {
-            set_add_key(result, entry.key);
+        fputs(emit, fp);
+        emit = separator;
+        if (PyObject_Print(entry.key, fp, 0) != 0) {
+            Py_ReprLeave((PyObject*)self);
+            return -1;
         }
     }
+    fputs("])", fp);
+    Py_ReprLeave((PyObject*)self);
+    return 0;
+}
 
-    if (PyErr_Occurred()) {
-        Py_DECREF(result);
+/* A list of the keys, allocated at its final size and filled in one pass. */
+static PyObject *
+set_tolist(PyOrderedSetObject *self)
+{
+    if (set_expire_now(self) == -1)
         return NULL;
+    ordered_set &set = self->oset;
+    Py_ssize_t n = set.size();
+    PyObject *list = PyList_New(n);
+    if (list == NULL)
+        return NULL;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *key = set[i].key;
+        Py_INCREF(key);
+        PyList_SET_ITEM(list, i, key);
     }
-    return (PyObject *)result;
+    return list;
 }
 
-PyDoc_STRVAR(difference_doc,
-"Return the difference of two sets as a new set.\n\
-\n\
-(i.e. all elements that are in this set but not the other.)");
+PyDoc_STRVAR(tolist_doc, "Return a list of the elements, in order.");
 
 static PyObject *
-set_difference_update(PyOrderedSetObject *self, PyObject *other)
+set_repr(PyOrderedSetObject *self)
 {
-    if (!PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
+    PyObject *keys, *result=NULL, *listrepr;
+    int status = Py_ReprEnter((PyObject*)self);
+
+    if (status != 0) {
+        if (status < 0)
+            return NULL;
+        return PyString_FromFormat("%s(...)", Py_TYPE(self)->tp_name);
     }
 
-    PyObject *tmp;
+    keys = set_tolist(self);
+    if (keys == NULL)
+        goto done;
+    listrepr = PyObject_Repr(keys);
+    Py_DECREF(keys);
+    if (listrepr == NULL)
+        goto done;
 
-    tmp = set_difference(self, other);
-    if (tmp == NULL)
-        return NULL;
-    self->oset = ((PyOrderedSetObject *)tmp)->oset;
-    Py_DECREF(tmp);
-    Py_RETURN_NONE;
-}
+#if PY_MAJOR_VERSION > 2
+    if (self->maxlen >= 0)
+        result = PyString_FromFormat("%s(%U, maxlen=%zd)", Py_TYPE(self)->tp_name,
+                                     listrepr, self->maxlen);
+    else
+        result = PyString_FromFormat("%s(%U)", Py_TYPE(self)->tp_name, listrepr);
+#else
+    if (self->maxlen >= 0)
+        result = PyString_FromFormat("%s(%s, maxlen=%zd)", Py_TYPE(self)->tp_name,
+                                     PyString_AS_STRING(listrepr), self->maxlen);
+    else
+        result = PyString_FromFormat("%s(%s)", Py_TYPE(self)->tp_name,
+                                     PyString_AS_STRING(listrepr));
+#endif
 
-PyDoc_STRVAR(difference_update_doc,
-"Remove all elements of another set from this set.");
+    Py_DECREF(listrepr);
+done:
+    Py_ReprLeave((PyObject*)self);
+    return result;
+}
 
-static PyObject *
-set_sub(PyOrderedSetObject *self, PyObject *other)
+static Py_ssize_t
+set_len(PyOrderedSetObject *self)
 {
-    return set_difference(self, other);
+    return self->oset.size();
 }
 
-
-static PyObject *
-set_isub(PyOrderedSetObject *self, PyObject *other)
+/* len(), which leaves out expired keys. */
+static Py_ssize_t
+set_sq_length(PyOrderedSetObject *self)
 {
-    if (!PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
-    }
-
-    PyObject *result;
-
-    result = set_difference_update(self, other);
-    if (result == NULL)
-        return NULL;
-    Py_DECREF(result);
-    Py_INCREF(self);
-    return (PyObject *)self;
+    if (set_expire_now(self) == -1)
+        return -1;
+    return set_len(self);
 }
 
 static PyObject *
-set_symmetric_difference(PyOrderedSetObject *self, PyObject *other)
+set_pop(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-    if (!PyOrderedSet_Check(self) || !PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
-    }
-
-    PyOrderedSetObject *otherset, *result;
-
-    if (!PyOrderedSet_Check(other)) {
-        otherset = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), other);
-        if (otherset == NULL)
-            return NULL;
-        return set_symmetric_difference(self, (PyObject *)otherset);
-    }
-
-    otherset = (PyOrderedSetObject *)other;
-    result = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), NULL);
+    Py_ssize_t i = -1, len;
+    PyObject *v;
 
-    ordered_set_by_key &aset = self->oset.get<key_index>();
-    for (ordered_set_by_key::iterator it = aset.begin(); it < aset.end(); it++) {
-        ordered_set::value_type entry = *it;
-        if (!set_contains(otherset, entry.key)) {
-            set_add_key(result, entry.key);
-        }
-    }
+    ORDEREDSET_TIME(PyOrderedSet_OP_POP);
+    if (set_check_nargs("pop", nargs, 0, 1) == -1 ||
+        (nargs > 0 && set_arg_ssize(args[0], &i) == -1) ||
+        set_expire_now(self) == -1)
+        return NULL;
 
-    ordered_set_by_key &bset = otherset->oset.get<key_index>();
-    for (ordered_set_by_key::iterator it = bset.begin(); it < bset.end(); it++) {
-        ordered_set::value_type entry = *it;
-        if (!set_contains(self, entry.key)) {
-            set_add_key(result, entry.key);
-        }
+    len = set_len(self);
+    if (len == 0) {
+        /* Special-case most common failure cause */
+        PyErr_SetString(PyExc_IndexError, "pop from empty set");
+        return NULL;
     }
-
-    if (PyErr_Occurred()) {
-        Py_DECREF(result);
+    if (i < 0)
+        i += len;
+    if (i < 0 || i >= len) {
+        PyErr_SetString(PyExc_IndexError, "pop index out of range");
         return NULL;
     }
-    return (PyObject *)result;
+    ordered_set &set = self->oset;
+    v = set[i].key;
+    Py_INCREF(v);
+    ORDEREDSET_COUNT_ERASE(set.shift_cost(i));
+    set_entry_removed(self, set[i]);
+    set.erase(set.begin() + i);
+    set_maybe_shrink(self);
+    return v;
 }
 
-PyDoc_STRVAR(symmetric_difference_doc,
-"Return the symmetric difference of two sets as a new set.\n\
+SET_FASTCALL_ADAPTER(set_pop)
+
+PyDoc_STRVAR(pop_doc,
+"Remove and return item at index (default last).\n\
 \n\
-(i.e. all elements that are in exactly one of the sets.)");
+Raises IndexError if set is empty or index is out of range.");
 
-static PyObject *
-set_symmetric_difference_update(PyOrderedSetObject *self, PyObject *other)
+static int
+set_traverse(PyOrderedSetObject *self, visitproc visit, void *arg)
 {
-    if (!PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
+    ordered_set &set = self->oset;
+    ordered_set::iterator it;
+    for (it = set.begin(); it < set.end(); it++) {
+        ordered_set::value_type entry = *it;
+        Py_VISIT(entry.key);
+        Py_VISIT(entry.projected);
     }
-
-    PyObject *tmp;
-
-    tmp = set_symmetric_difference(self, other);
-    if (tmp == NULL)
-        return NULL;
-    self->oset = ((PyOrderedSetObject *)tmp)->oset;
-    Py_DECREF(tmp);
-    Py_RETURN_NONE;
+    if (self->changelog != NULL) {
+        std::deque<ordered_set_change>::iterator change;
+        for (change = self->changelog->changes.begin();
+             change != self->changelog->changes.end(); ++change)
+            Py_VISIT(change->key);
+    }
+    Py_VISIT(self->clock);
+    Py_VISIT(self->keyfunc);
+    return 0;
 }
 
-PyDoc_STRVAR(symmetric_difference_update_doc,
-"Update a set with the symmetric difference of itself and another.");
-
-static PyObject *
-set_xor(PyOrderedSetObject *self, PyObject *other)
+static long
+set_nohash(PyObject *self)
 {
-    return set_symmetric_difference(self, other);
+    PyErr_SetString(PyExc_TypeError, "set objects are unhashable");
+    return -1;
 }
 
-static PyObject *
-set_ixor(PyOrderedSetObject *self, PyObject *other)
-{
-    if (!PyObject_IsIterable(other)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
-    }
+/***** Set iterator type ***********************************************/
 
-    PyObject *result;
+/* Walks the order index by position, from si_pos in strides of si_step
+ * until it reaches si_end: forwards one key at a time for iter(), backwards
+ * for reversed() and in any stride for views. Any change to the set bumps
+ * its version and stops the iterator, so it never reads a leaf that has
+ * been split, merged or released. */
+typedef struct {
+    PyObject_HEAD
+    PyOrderedSetObject *si_set; /* Set to NULL when iterator is exhausted */
+    unsigned long si_version;
+    Py_ssize_t si_pos;
+    Py_ssize_t si_end;
+    Py_ssize_t si_step;
+} setiterobject;
 
-    result = set_symmetric_difference_update(self, other);
-    if (result == NULL)
-        return NULL;
-    Py_DECREF(result);
-    Py_INCREF(self);
-    return (PyObject *)self;
+static void
+setiter_dealloc(setiterobject *si)
+{
+    PyObject_GC_UnTrack(si);
+    Py_XDECREF(si->si_set);
+    PyObject_GC_Del(si);
 }
 
-static PyObject *
-set_issubset(PyOrderedSetObject *self, PyObject *other)
+/* A set may hold an iterator over itself, or over an expression on it. */
+static int
+setiter_traverse(setiterobject *si, visitproc visit, void *arg)
 {
-    if (!PyOrderedSet_Check(other)) {
-        PyObject *tmp, *result;
-        tmp = make_new_set(Py_TYPE(self), other);
-        if (tmp == NULL)
-            return NULL;
-        result = set_issubset(self, tmp);
-        Py_DECREF(tmp);
-        return result;
-    }
-    if (set_len(self) > set_len((PyOrderedSetObject *)other))
-        Py_RETURN_FALSE;
-
-    ordered_set_by_key &set = self->oset.get<key_index>();
-    ordered_set_by_key::iterator it;
-    for (it = set.begin(); it < set.end(); it++) {
-        ordered_set::value_type entry = *it;
-        int rv = set_contains((PyOrderedSetObject *)other, entry.key);
-        if (rv == -1)
-            return NULL;
-        if (!rv)
-            Py_RETURN_FALSE;
-    }
-    Py_RETURN_TRUE;
+    Py_VISIT(si->si_set);
+    return 0;
 }
 
-PyDoc_STRVAR(issubset_doc, "Report whether another set contains this set.");
-
 static PyObject *
-set_issuperset(PyOrderedSetObject *self, PyObject *other)
+setiter_len(setiterobject *si)
 {
-    if (!PyOrderedSet_Check(other)) {
-        PyObject *tmp, *result;
-        tmp = make_new_set(Py_TYPE(self), other);
-        if (tmp == NULL)
-            return NULL;
-        result = set_issuperset(self, tmp);
-        Py_DECREF(tmp);
-        return result;
-    }
-    return set_issubset((PyOrderedSetObject *)other, (PyObject *)self);
+    Py_ssize_t len = 0;
+    if (si->si_set != NULL && si->si_version == si->si_set->version)
+        len = (si->si_end - si->si_pos) / si->si_step;
+    return PyLong_FromSsize_t(len);
 }
 
-PyDoc_STRVAR(issuperset_doc, "Report whether this set contains another set.");
+PyDoc_STRVAR(length_hint_doc, "Private method returning an estimate of len(list(it)).");
+
+static PyMethodDef setiter_methods[] = {
+    {"__length_hint__", (PyCFunction)setiter_len, METH_NOARGS, length_hint_doc},
+    {NULL, NULL} /* sentinel */
+};
 
 static PyObject *
-set_richcompare(PyObject *v, PyObject *w, int op)
+setiter_iternext(setiterobject *si)
 {
-    PyOrderedSetObject *vl, *wl;
-    Py_ssize_t i, vlen, wlen;
-
-    if (!PyOrderedSet_Check(v) || !PyOrderedSet_Check(w)) {
-        Py_INCREF(Py_NotImplemented);
-        return Py_NotImplemented;
-    }
-
-    vl = (PyOrderedSetObject *)v;
-    wl = (PyOrderedSetObject *)w;
+    PyOrderedSetObject *so = si->si_set;
 
-    // Shortcut: if the lengths differ, the lists differ
-    vlen = set_len(vl);
-    wlen = set_len(wl);
-    if (vlen != wlen && (op == Py_EQ || op == Py_NE)) {
-        PyObject *res;
-        if (op == Py_EQ)
-            res = Py_False;
-        else
-            res = Py_True;
-        Py_INCREF(res);
-        return res;
+    if (so == NULL)
+        return NULL;
+    if (si->si_version != so->version) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Set changed during iteration");
+        Py_DECREF(so);
+        si->si_set = NULL; /* Make this state sticky */
+        return NULL;
     }
-
-    // Search for the first index where items are different
-    ordered_set_by_key &vset = vl->oset.get<key_index>();
-    ordered_set_by_key &wset = wl->oset.get<key_index>();
-    for (i = 0; i < vlen && i < wlen; i++) {
-        int k = PyObject_RichCompareBool(vset[i].key,
-                                         wset[i].key, Py_EQ);
-        if (k < 0)
-            return NULL;
-        if (!k)
-            break;
+    if (si->si_pos == si->si_end) {
+        Py_DECREF(so);
+        si->si_set = NULL;
+        return NULL;
     }
+    PyObject *key = so->oset[si->si_pos].key;
+    si->si_pos += si->si_step;
+    Py_INCREF(key);
+    return key;
+}
 
-    if (i >= vlen || i >= wlen) {
-        /* No more items to compare -- compare sizes */
-        int cmp;
-        PyObject *res;
-        switch (op) {
-            case Py_LT: cmp = vlen <  wlen; break;
-            case Py_LE: cmp = vlen <= wlen; break;
-            case Py_EQ: cmp = vlen == wlen; break;
-            case Py_NE: cmp = vlen != wlen; break;
-            case Py_GT: cmp = vlen >  wlen; break;
-            case Py_GE: cmp = vlen >= wlen; break;
-            default: return NULL; /* cannot happen */
-        }
-        if (cmp)
-            res = Py_True;
-        else
-            res = Py_False;
-        Py_INCREF(res);
-        return res;
-    }
+static PyTypeObject PyOrderedSetIter_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "orderedsetiterator",       /* tp_name */
+    sizeof(setiterobject),      /* tp_basicsize */
+    0,                          /* tp_itemsize */
+    /* methods */
+    (destructor)setiter_dealloc, /* tp_dealloc */
+    0,                          /* tp_print */
+    0,                          /* tp_getattr */
+    0,                          /* tp_setattr */
+    0,                          /* tp_compare */
+    0,                          /* tp_repr */
+    0,                          /* tp_as_number */
+    0,                          /* tp_as_sequence */
+    0,                          /* tp_as_mapping */
+    0,                          /* tp_hash */
+    0,                          /* tp_call */
+    0,                          /* tp_str */
+    PyObject_GenericGetAttr,    /* tp_getattro */
+    0,                          /* tp_setattro */
+    0,                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                          /* tp_doc */
+    (traverseproc)setiter_traverse, /* tp_traverse */
+    0,                          /* tp_clear */
+    0,                          /* tp_richcompare */
+    0,                          /* tp_weaklistoffset */
+    PyObject_SelfIter,          /* tp_iter */
+    (iternextfunc)setiter_iternext, /* tp_iternext */
+    setiter_methods,            /* tp_methods */
+    0,
+};
 
-    /* We have an item that differs -- shortcuts for EQ/NE */
-    if (op == Py_EQ) {
-        Py_INCREF(Py_False);
-        return Py_False;
+static PyTypeObject PyOrderedSetRevIter_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "orderedset_reverseiterator", /* tp_name */
+    sizeof(setiterobject),      /* tp_basicsize */
+    0,                          /* tp_itemsize */
+    /* methods */
+    (destructor)setiter_dealloc, /* tp_dealloc */
+    0,                          /* tp_print */
+    0,                          /* tp_getattr */
+    0,                          /* tp_setattr */
+    0,                          /* tp_compare */
+    0,                          /* tp_repr */
+    0,                          /* tp_as_number */
+    0,                          /* tp_as_sequence */
+    0,                          /* tp_as_mapping */
+    0,                          /* tp_hash */
+    0,                          /* tp_call */
+    0,                          /* tp_str */
+    PyObject_GenericGetAttr,    /* tp_getattro */
+    0,                          /* tp_setattro */
+    0,                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                          /* tp_doc */
+    (traverseproc)setiter_traverse, /* tp_traverse */
+    0,                          /* tp_clear */
+    0,                          /* tp_richcompare */
+    0,                          /* tp_weaklistoffset */
+    PyObject_SelfIter,          /* tp_iter */
+    (iternextfunc)setiter_iternext, /* tp_iternext */
+    setiter_methods,            /* tp_methods */
+    0,
+};
+
+static PyObject *
+make_set_iter(PyOrderedSetObject *self, PyTypeObject *type, Py_ssize_t first, Py_ssize_t last,
+              Py_ssize_t step)
+{
+    setiterobject *si = PyObject_GC_New(setiterobject, type);
+    if (si == NULL)
+        return NULL;
+    Py_INCREF(self);
+    si->si_set = self;
+    si->si_version = self->version;
+    si->si_pos = first;
+    si->si_end = last;
+    si->si_step = step;
+    PyObject_GC_Track(si);
+    return (PyObject *)si;
+}
+
+static PyObject *
+set_iter(PyOrderedSetObject *self)
+{
+    if (set_expire_now(self) == -1)
+        return NULL;
+    return make_set_iter(self, &PyOrderedSetIter_Type, 0, self->oset.size(), 1);
+}
+
+static PyObject *
+set_reversed(PyOrderedSetObject *self)
+{
+    if (set_expire_now(self) == -1)
+        return NULL;
+    return make_set_iter(self, &PyOrderedSetRevIter_Type, self->oset.size() - 1, -1, -1);
+}
+
+PyDoc_STRVAR(reversed_doc, "Return a reverse iterator over the set.");
+
+/* Add the keys of another orderedset. Keys projected the same way keep
+ * their cached hash, the others are hashed as any iterable's would be. */
+static int
+set_update_from_set(PyOrderedSetObject *self, PyOrderedSetObject *other)
+{
+    ordered_set &set = other->oset;
+
+    if (self->keyfunc != other->keyfunc) {
+        for (Py_ssize_t i = 0; i < (Py_ssize_t)set.size(); i++) {
+            if (set_add_key(self, set[i].key) == -1)
+                return -1;
+        }
+        return 0;
+    }
+    for (Py_ssize_t i = 0; i < (Py_ssize_t)set.size(); i++) {
+        ordered_set_probe probe = {set[i].lookup_key(), set[i].hash};
+        if (set_add_probe(self, set[i].key, probe) == -1)
+            return -1;
     }
-    if (op == Py_NE) {
-        Py_INCREF(Py_True);
-        return Py_True;
+    return 0;
+}
+
+static int
+set_update_internal(PyOrderedSetObject *self, PyObject *other)
+{
+    PyObject *key, *it;
+
+    if (PyOrderedSet_Check(other) && other != (PyObject *)self)
+        return set_update_from_set(self, (PyOrderedSetObject *)other);
+
+    it = PyObject_GetIter(other);
+    if (it == NULL)
+        return -1;
+
+    while ((key = PyIter_Next(it)) != NULL) {
+        if (set_add_key(self, key) == -1) {
+            Py_DECREF(it);
+            Py_DECREF(key);
+            return -1;
+        }
+        Py_DECREF(key);
     }
+    Py_DECREF(it);
+    if (PyErr_Occurred())
+        return -1;
+    return 0;
+}
 
-    /* Compare the final item again using the proper operator */
-    return PyObject_RichCompare(vset[i].key, wset[i].key, op);
+static PyObject *
+set_update(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_UPDATE);
+    for (Py_ssize_t i = 0; i < nargs; i++) {
+        if (set_update_internal(self, args[i]) == -1)
+            return NULL;
+    }
+    Py_RETURN_NONE;
 }
 
-//static int
-//set_nocmp(PyObject *self, PyObject *other)
-//{
-//  PyErr_SetString(PyExc_TypeError, "cannot compare sets using cmp()");
-//  return -1;
-//}
+SET_FASTCALL_ADAPTER(set_update)
+
+PyDoc_STRVAR(update_doc, "Update a set with the union of itself and others.");
 
 static PyObject *
-set_add(PyOrderedSetObject *self, PyObject *key)
+make_new_set(PyTypeObject *type, PyObject *iterable)
 {
-    if (set_add_key(self, key) == -1)
+    PyOrderedSetObject *so;
+
+    so = (PyOrderedSetObject *)type->tp_alloc(type, 0);
+    if (so == NULL)
         return NULL;
-    Py_RETURN_NONE;
+
+    // tp_alloc only hands out zeroed memory, construct the container in place.
+    new (&so->oset) ordered_set();
+    so->shrink_ratio = PyOrderedSet_SHRINK_RATIO;
+    so->reserved = 0;
+    so->version = 0;
+    so->fingerprint = 0;
+    so->sorted = NULL;
+    so->bloom = NULL;
+    so->changelog = NULL;
+    so->maxlen = -1;
+    so->touch = 0;
+    so->ttl = -1.0;
+    so->clock = NULL;
+    so->keyfunc = NULL;
+
+    if (iterable != NULL) {
+        if (set_update_internal(so, iterable) == -1) {
+            Py_DECREF(so);
+            return NULL;
+        }
+    }
+
+    return (PyObject *)so;
 }
 
-PyDoc_STRVAR(add_doc,
-"Add an element to a set.\n\
-\n\
-This has no effect if the element is already present.");
+static PyObject *
+set_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    if (type == &PySet_Type && !_PyArg_NoKeywords("orderedset()", kwds))
+        return NULL;
+
+    return make_new_set(type, NULL);
+}
+
+/* Give so the bounds of self, for copies and set algebra results. */
+static void
+set_copy_config(PyOrderedSetObject *so, PyOrderedSetObject *self)
+{
+    so->maxlen = self->maxlen;
+    so->touch = self->touch;
+    so->ttl = self->ttl;
+    PyObject *old = so->clock;
+    Py_XINCREF(self->clock);
+    so->clock = self->clock;
+    Py_XDECREF(old);
+    old = so->keyfunc;
+    Py_XINCREF(self->keyfunc);
+    so->keyfunc = self->keyfunc;
+    Py_XDECREF(old);
+    if (self->bloom != NULL && so->bloom == NULL) {
+        so->bloom = new ordered_set_bloom(0);
+        set_bloom_rebuild(so);
+    }
+}
 
+/* The keys of iterable as a set to compare self with, projected by the key
+ * function of self so that both sides match keys alike. Nothing else is
+ * carried over: a maxlen or ttl would drop keys. */
 static PyObject *
-set_item(PyOrderedSetObject *self, Py_ssize_t i)
+make_operand_set(PyOrderedSetObject *self, PyObject *iterable)
 {
-    if (i < 0 || i >= set_len(self)) {
-        PyErr_SetString(PyExc_IndexError, "list index out of range");
+    PyOrderedSetObject *so = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), NULL);
+    if (so == NULL)
+        return NULL;
+    Py_XINCREF(self->keyfunc);
+    so->keyfunc = self->keyfunc;
+    if (set_update_internal(so, iterable) == -1) {
+        Py_DECREF(so);
         return NULL;
     }
-    ordered_set_by_key &set = self->oset.get<key_index>();
-    Py_INCREF(set[i].key);
-    return set[i].key;
+    return (PyObject *)so;
 }
 
 static PyObject *
-set_slice(PyOrderedSetObject *self, Py_ssize_t ilow, Py_ssize_t ihigh)
+set_copy(PyOrderedSetObject *self)
 {
-    if (ilow < 0)
-        ilow = 0;
-    else if (ilow > set_len(self))
-        ilow = set_len(self);
-    if (ihigh < ilow)
-        ihigh = ilow;
-    else if (ihigh > set_len(self))
-        ihigh = set_len(self);
+    ORDEREDSET_TIME(PyOrderedSet_OP_COPY);
+    if (set_expire_now(self) == -1)
+        return NULL;
+    PyOrderedSetObject *so = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), NULL);
+    if (so == NULL)
+        return NULL;
+    so->oset = self->oset; // Shallow copy into the new set's own arena.
+    so->fingerprint = self->fingerprint;
+    set_copy_config(so, self);
+
+    return (PyObject *)so;
+}
+
+PyDoc_STRVAR(copy_doc, "Return a shallow copy of a set.");
 
+/* A new set with the config of self holding the len keys at positions
+ * start, start + step, ... Entries are copied with their hashes, as keys of
+ * one set they need no lookup. */
+static PyObject *
+set_copy_range(PyOrderedSetObject *self, Py_ssize_t start, Py_ssize_t step, Py_ssize_t len)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_COPY);
     PyOrderedSetObject *so = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), NULL);
     if (so == NULL)
         return NULL;
+    set_copy_config(so, self);
 
-    ordered_set_by_key &set = self->oset.get<key_index>();
-    ordered_set_by_key::iterator it;
-    for (it = set.begin() + ilow; it < set.begin() + ihigh; it++) {
-        ordered_set::value_type entry = *it;
-        set_add_key(so, entry.key);
-    }
+    ordered_set &set = self->oset;
+    so->oset.reserve(len);
+    for (Py_ssize_t i = 0; i < len; i++)
+        set_append(so, set[start + i * step]);
 
     return (PyObject *)so;
 }
 
-static int
-set_ass_item(PyOrderedSetObject *self, Py_ssize_t i, PyObject *key)
+static PyObject *
+set_clear(PyOrderedSetObject *self)
 {
-    if (key != NULL) {
-        // don't support __setitem__
-        return -1;
-    }
+    ORDEREDSET_TIME(PyOrderedSet_OP_CLEAR);
+    set_clear_internal(self);
+    Py_RETURN_NONE;
+}
 
-    if (i < 0 || i >= set_len(self)) {
-        PyErr_SetString(PyExc_IndexError, "list assignment index out of range");
-        return -1;
-    }
+PyDoc_STRVAR(clear_doc, "Remove all elements from this set.");
 
-    ordered_set_by_key &set = self->oset.get<key_index>();
-    if (key == NULL) {
-        // delete item
-        set.erase(set.begin() + i);
-        return 0;
-    }
-    else {
-        set.replace(set.begin() + i, ordered_set::value_type(key));
-        return 0;
-    }
+static PyObject *
+set_compact(PyOrderedSetObject *self)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_COMPACT);
+    self->reserved = 0;
+    set_compact_internal(self);
+    Py_RETURN_NONE;
 }
 
-static int
-set_ass_slice(PyOrderedSetObject *self, Py_ssize_t ilow, Py_ssize_t ihigh, PyObject *other)
+PyDoc_STRVAR(compact_doc,
+"Release memory held for elements that have been removed.\n\
+\n\
+The set is rebuilt with index structures sized for its current length.");
+
+/* Growing past the bucket array moves the keys to the larger one a few
+ * buckets per add(), so no single add() pays for the whole rehash. Sizing
+ * it and the order's leaves up front skips that work altogether. */
+static PyObject *
+set_reserve(PyOrderedSetObject *self, PyObject *arg)
 {
-    if (other != NULL) {
-        // don't support __setslice__
-        return -1;
-    }
+    ordered_set &set = self->oset;
+    Py_ssize_t n;
 
-    if (ilow < 0)
-        ilow = 0;
-    else if (ilow > set_len(self))
-        ilow = set_len(self);
-    if (ihigh < ilow)
-        ihigh = ilow;
-    else if (ihigh > set_len(self))
-        ihigh = set_len(self);
+    if (set_arg_ssize(arg, &n) == -1)
+        return NULL;
+    if (n < 0) {
+        PyErr_SetString(PyExc_ValueError, "n must be non-negative");
+        return NULL;
+    }
+    if (self->maxlen >= 0 && n > self->maxlen)
+        n = self->maxlen;
+    if ((ordered_set::size_type)n > set.capacity() ||
+        n > set.bucket_count() * set.max_load_factor()) {
+        // Relaying the index counts as a change, as compaction does.
+        self->version++;
+        set.reserve(n);
+    }
+    if (n > self->reserved)
+        self->reserved = n;
+    Py_RETURN_NONE;
+}
 
-    if (other == NULL) {
-        // delete slice
-        ordered_set_by_key &set = self->oset.get<key_index>();
-        ordered_set_by_key::iterator it;
-        for (it = set.begin() + ihigh - 1; it > set.begin() + ilow - 1; it--) {
-            set.erase(it);
+PyDoc_STRVAR(reserve_doc,
+"Make room for n elements.\n\
+\n\
+The set then grows to n elements without reallocating or rehashing its\n\
+index structures. Discarding keeps the room; clear() and compact() release it.");
+
+/* The operands of an N-ary set operation as orderedsets, holding a
+ * reference to each: orderedsets are taken as they are and other iterables
+ * are collected into temporary sets. */
+struct ordered_set_operands {
+    std::vector<PyOrderedSetObject *> sets;
+    /* The clock of each set, from read_clocks(). */
+    std::vector<double> now;
+
+    /* Read the clocks once the sets are in the order they are probed in. */
+    int read_clocks()
+    {
+        now.resize(sets.size());
+        for (size_t i = 0; i < sets.size(); i++) {
+            if (set_clock(sets[i], &now[i]) == -1)
+                return -1;
         }
+        return 0;
     }
-    else {
-        ordered_set old_set(self->oset);
-        set_clear_internal(self);
 
-        ordered_set_by_key &old_keyset = old_set.get<key_index>();
-        ordered_set_by_key::iterator it;
-        for (it = old_keyset.begin(); it < old_keyset.begin() + ilow; it++) {
-            ordered_set::value_type entry = *it;
-            set_add_key(self, entry.key);
-        }
-        set_update_internal(self, other);
-        for (it = old_keyset.begin() + ihigh; it < old_keyset.end(); it++) {
-            ordered_set::value_type entry = *it;
-            set_add_key(self, entry.key);
-        }
+    ~ordered_set_operands()
+    {
+        for (size_t i = 0; i < sets.size(); i++)
+            Py_DECREF(sets[i]);
     }
+};
 
+static int
+set_collect_operands(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs,
+                     ordered_set_operands &operands)
+{
+    operands.sets.reserve(nargs);
+    for (Py_ssize_t i = 0; i < nargs; i++) {
+        PyObject *other = args[i];
+        if (PyOrderedSet_Check(other))
+            Py_INCREF(other);
+        else {
+            other = make_operand_set(self, other);
+            if (other == NULL)
+                return -1;
+        }
+        operands.sets.push_back((PyOrderedSetObject *)other);
+    }
     return 0;
 }
 
-static PyObject *
+static bool
+set_smaller(const PyOrderedSetObject *a, const PyOrderedSetObject *b)
+{
+    return a->oset.size() < b->oset.size();
+}
+
+static bool
+set_larger(const PyOrderedSetObject *a, const PyOrderedSetObject *b)
+{
+    return a->oset.size() > b->oset.size();
+}
+
+/* A new, empty set with the config of self and room for n keys. */
+static PyOrderedSetObject *
+set_make_result(PyOrderedSetObject *self, Py_ssize_t n)
+{
+    PyOrderedSetObject *result = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), NULL);
+    if (result == NULL)
+        return NULL;
+    set_copy_config(result, self);
+    result->oset.reserve(n);
+    return result;
+}
+
+/* The union of self and others, sized once for all of their keys. Overlap
+ * leaves the arrays oversized, set_maybe_shrink() trims them back then. */
+static PyObject *
+set_union_internal(PyOrderedSetObject *self, PyObject *const *others, Py_ssize_t n)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_UNION);
+    Py_ssize_t total = self->oset.size();
+
+    for (Py_ssize_t i = 0; i < n; i++) {
+        Py_ssize_t len = PyObject_Size(others[i]);
+        if (len < 0)
+            PyErr_Clear();
+        else
+            total += len;
+    }
+
+    PyOrderedSetObject *result = set_make_result(self, total);
+    if (result == NULL)
+        return NULL;
+    ordered_set &set = self->oset;
+    for (Py_ssize_t i = 0; i < (Py_ssize_t)set.size(); i++)
+        set_append(result, set[i]);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        if (set_update_internal(result, others[i]) == -1) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+    set_maybe_shrink(result);
+    return (PyObject *)result;
+}
+
+static PyObject *
+set_union(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    return set_union_internal(self, args, nargs);
+}
+
+SET_FASTCALL_ADAPTER(set_union)
+
+PyDoc_STRVAR(union_doc,
+"Return the union of sets as a new set.\n\
+\n\
+(i.e. all elements that are in any of the sets.)");
+
+static PyObject *
+set_or(PyOrderedSetObject *self, PyObject *other)
+{
+    if (!PyOrderedSet_Check(self) || !PyObject_IsIterable(other) ||
+        PyOrderedSetExpr_Check(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    return set_union_internal(self, &other, 1);
+}
+
+static PyObject *
+set_ior(PyOrderedSetObject *self, PyObject *other)
+{
+    if (!PyObject_IsIterable(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    if (set_update_internal(self, other) == -1)
+        return NULL;
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+/* Whether entry of from is in every operand but skip, stopping at the
+ * first miss. Returns 1, 0 or -1 on error. */
+static int
+set_in_all(const ordered_set_operands &operands, PyOrderedSetObject *skip,
+           PyOrderedSetObject *from, const ordered_set_entry &entry)
+{
+    for (size_t i = 0; i < operands.sets.size(); i++) {
+        if (operands.sets[i] == skip)
+            continue;
+        int found = set_contains_entry(operands.sets[i], from, entry, operands.now[i]);
+        if (found != 1)
+            return found;
+    }
+    return 1;
+}
+
+/* The keys of self found in every other operand, in the order of self.
+ * Operands are probed smallest first, so most misses cost one lookup. When
+ * one is smaller than self and all project keys alike, that one is walked
+ * instead and the survivors are put back in order by their position in
+ * self. */
+static PyObject *
+set_intersection_internal(PyOrderedSetObject *self, PyObject *const *others, Py_ssize_t n)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_INTERSECTION);
+    ordered_set_operands operands;
+    bool same_keys = true;
+
+    if (set_collect_operands(self, others, n, operands) == -1)
+        return NULL;
+    std::sort(operands.sets.begin(), operands.sets.end(), set_smaller);
+    // Keys of self are taken as they are, whichever set is walked.
+    if (operands.read_clocks() == -1 || set_expire_now(self) == -1)
+        return NULL;
+    for (size_t i = 0; i < operands.sets.size(); i++)
+        same_keys = same_keys && operands.sets[i]->keyfunc == self->keyfunc;
+
+    ordered_set &set = self->oset;
+    PyOrderedSetObject *smallest = n > 0 ? operands.sets[0] : self;
+    if (smallest->oset.size() >= set.size() || !same_keys)
+        smallest = self;
+
+    PyOrderedSetObject *result = set_make_result(self, smallest->oset.size());
+    if (result == NULL)
+        return NULL;
+
+    if (smallest == self) {
+        for (Py_ssize_t i = 0; i < (Py_ssize_t)set.size(); i++) {
+            int found = set_in_all(operands, NULL, self, set[i]);
+            if (found == -1)
+                goto error;
+            if (found == 1)
+                set_append(result, set[i]);
+        }
+    }
+    else {
+        ordered_set &small = smallest->oset;
+        std::vector<Py_ssize_t> positions;
+        for (Py_ssize_t i = 0; i < (Py_ssize_t)small.size(); i++) {
+            ordered_set_probe probe = {small[i].lookup_key(), small[i].hash};
+            const ordered_set_entry *pos = NULL;
+            int found = set_lookup(self, probe, &pos);
+            if (found == 1)
+                found = set_in_all(operands, smallest, smallest, small[i]);
+            if (found == -1)
+                goto error;
+            if (found == 1)
+                positions.push_back(set.index_of(pos));
+        }
+        std::sort(positions.begin(), positions.end());
+        for (size_t i = 0; i < positions.size(); i++)
+            set_append(result, set[positions[i]]);
+    }
+    return (PyObject *)result;
+
+error:
+    Py_DECREF(result);
+    return NULL;
+}
+
+static PyObject *
+set_intersection(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    return set_intersection_internal(self, args, nargs);
+}
+
+SET_FASTCALL_ADAPTER(set_intersection)
+
+PyDoc_STRVAR(intersection_doc,
+"Return the intersection of sets as a new set.\n\
+\n\
+(i.e. all elements that are in all sets.)");
+
+static PyObject *
+set_intersection_update(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    PyObject *tmp;
+
+    tmp = set_intersection_internal(self, args, nargs);
+    if (tmp == NULL)
+        return NULL;
+    set_swap_contents(self, (PyOrderedSetObject *)tmp);
+    Py_DECREF(tmp);
+    set_maybe_shrink(self);
+    Py_RETURN_NONE;
+}
+
+SET_FASTCALL_ADAPTER(set_intersection_update)
+
+PyDoc_STRVAR(intersection_update_doc,
+"Update a set with the intersection of itself and others.");
+
+static PyObject *
+set_and(PyOrderedSetObject *self, PyObject *other)
+{
+    if (!PyOrderedSet_Check(self) || !PyObject_IsIterable(other) ||
+        PyOrderedSetExpr_Check(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    return set_intersection_internal(self, &other, 1);
+}
+
+static PyObject *
+set_iand(PyOrderedSetObject *self, PyObject *other)
+{
+    PyObject *result;
+
+    if (!PyObject_IsIterable(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    result = set_intersection_update(self, &other, 1);
+    if (result == NULL)
+        return NULL;
+    Py_DECREF(result);
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+/* The keys of self found in none of the others, in the order of self.
+ * Operands are probed largest first, the likeliest to hold a key. */
+static PyObject *
+set_difference_internal(PyOrderedSetObject *self, PyObject *const *others, Py_ssize_t n)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_DIFFERENCE);
+    ordered_set_operands operands;
+
+    if (set_collect_operands(self, others, n, operands) == -1)
+        return NULL;
+    std::sort(operands.sets.begin(), operands.sets.end(), set_larger);
+    while (!operands.sets.empty() && operands.sets.back()->oset.size() == 0) {
+        Py_DECREF(operands.sets.back());
+        operands.sets.pop_back();
+    }
+    if (operands.read_clocks() == -1)
+        return NULL;
+
+    ordered_set &set = self->oset;
+    PyOrderedSetObject *result = set_make_result(self, set.size());
+    if (result == NULL)
+        return NULL;
+
+    for (Py_ssize_t i = 0; i < (Py_ssize_t)set.size(); i++) {
+        int found = 0;
+        for (size_t j = 0; j < operands.sets.size() && found == 0; j++)
+            found = set_contains_entry(operands.sets[j], self, set[i], operands.now[j]);
+        if (found == -1) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        if (found == 0)
+            set_append(result, set[i]);
+    }
+    return (PyObject *)result;
+}
+
+static PyObject *
+set_difference(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    return set_difference_internal(self, args, nargs);
+}
+
+SET_FASTCALL_ADAPTER(set_difference)
+
+PyDoc_STRVAR(difference_doc,
+"Return the difference of this set and others as a new set.\n\
+\n\
+(i.e. all elements that are in this set but none of the others.)");
+
+static PyObject *
+set_difference_update(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    PyObject *tmp;
+
+    tmp = set_difference_internal(self, args, nargs);
+    if (tmp == NULL)
+        return NULL;
+    set_swap_contents(self, (PyOrderedSetObject *)tmp);
+    Py_DECREF(tmp);
+    set_maybe_shrink(self);
+    Py_RETURN_NONE;
+}
+
+SET_FASTCALL_ADAPTER(set_difference_update)
+
+PyDoc_STRVAR(difference_update_doc,
+"Remove all elements of other sets from this set.");
+
+static PyObject *
+set_sub(PyOrderedSetObject *self, PyObject *other)
+{
+    if (!PyOrderedSet_Check(self) || !PyObject_IsIterable(other) ||
+        PyOrderedSetExpr_Check(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    return set_difference_internal(self, &other, 1);
+}
+
+
+static PyObject *
+set_isub(PyOrderedSetObject *self, PyObject *other)
+{
+    if (!PyObject_IsIterable(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+
+    PyObject *result;
+
+    result = set_difference_update(self, &other, 1);
+    if (result == NULL)
+        return NULL;
+    Py_DECREF(result);
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *
+set_symmetric_difference(PyOrderedSetObject *self, PyObject *other)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_SYMMETRIC_DIFFERENCE);
+    if (!PyOrderedSet_Check(self) || !PyObject_IsIterable(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+
+    PyOrderedSetObject *otherset, *result;
+
+    if (!PyOrderedSet_Check(other)) {
+        PyObject *tmp = make_operand_set(self, other);
+        if (tmp == NULL)
+            return NULL;
+        result = (PyOrderedSetObject *)set_symmetric_difference(self, tmp);
+        Py_DECREF(tmp);
+        return (PyObject *)result;
+    }
+
+    otherset = (PyOrderedSetObject *)other;
+    double now, other_now;
+    if (set_clock(self, &now) == -1 || set_clock(otherset, &other_now) == -1)
+        return NULL;
+    result = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), NULL);
+    if (result == NULL)
+        return NULL;
+    set_copy_config(result, self);
+
+    ordered_set &aset = self->oset;
+    for (ordered_set::iterator it = aset.begin(); it < aset.end(); it++) {
+        ordered_set::value_type entry = *it;
+        if (set_contains_entry(otherset, self, entry, other_now) == 0) {
+            set_append(result, entry);
+        }
+    }
+
+    ordered_set &bset = otherset->oset;
+    for (ordered_set::iterator it = bset.begin(); it < bset.end(); it++) {
+        ordered_set::value_type entry = *it;
+        if (set_contains_entry(self, otherset, entry, now) != 0)
+            continue;
+        // Keys of other missing from self are not in result yet either. The
+        // entry is kept as it is if its projection and stamp hold in result.
+        if (otherset->keyfunc == self->keyfunc &&
+            (self->ttl < 0.0 || (otherset->ttl >= 0.0 && otherset->clock == self->clock)))
+            set_append(result, entry);
+        else
+            set_add_key(result, entry.key);
+    }
+
+    if (PyErr_Occurred()) {
+        Py_DECREF(result);
+        return NULL;
+    }
+    return (PyObject *)result;
+}
+
+PyDoc_STRVAR(symmetric_difference_doc,
+"Return the symmetric difference of two sets as a new set.\n\
+\n\
+(i.e. all elements that are in exactly one of the sets.)");
+
+static PyObject *
+set_symmetric_difference_update(PyOrderedSetObject *self, PyObject *other)
+{
+    if (!PyObject_IsIterable(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+
+    PyObject *tmp;
+
+    tmp = set_symmetric_difference(self, other);
+    if (tmp == NULL)
+        return NULL;
+    set_swap_contents(self, (PyOrderedSetObject *)tmp);
+    Py_DECREF(tmp);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(symmetric_difference_update_doc,
+"Update a set with the symmetric difference of itself and another.");
+
+static PyObject *
+set_xor(PyOrderedSetObject *self, PyObject *other)
+{
+    if (PyOrderedSetExpr_Check(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    return set_symmetric_difference(self, other);
+}
+
+static PyObject *
+set_ixor(PyOrderedSetObject *self, PyObject *other)
+{
+    if (!PyObject_IsIterable(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+
+    PyObject *result;
+
+    result = set_symmetric_difference_update(self, other);
+    if (result == NULL)
+        return NULL;
+    Py_DECREF(result);
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *
+set_issubset(PyOrderedSetObject *self, PyObject *other)
+{
+    if (!PyOrderedSet_Check(other)) {
+        PyObject *tmp, *result;
+        tmp = make_operand_set(self, other);
+        if (tmp == NULL)
+            return NULL;
+        result = set_issubset(self, tmp);
+        Py_DECREF(tmp);
+        return result;
+    }
+    if (set_expire_now(self) == -1 || set_expire_now((PyOrderedSetObject *)other) == -1)
+        return NULL;
+    if (set_len(self) > set_len((PyOrderedSetObject *)other))
+        Py_RETURN_FALSE;
+
+    double now;
+    if (set_clock((PyOrderedSetObject *)other, &now) == -1)
+        return NULL;
+    ordered_set &set = self->oset;
+    ordered_set::iterator it;
+    for (it = set.begin(); it < set.end(); it++) {
+        ordered_set::value_type entry = *it;
+        int rv = set_contains_entry((PyOrderedSetObject *)other, self, entry, now);
+        if (rv == -1)
+            return NULL;
+        if (!rv)
+            Py_RETURN_FALSE;
+    }
+    Py_RETURN_TRUE;
+}
+
+PyDoc_STRVAR(issubset_doc, "Report whether another set contains this set.");
+
+static PyObject *
+set_issuperset(PyOrderedSetObject *self, PyObject *other)
+{
+    if (!PyOrderedSet_Check(other)) {
+        PyObject *tmp, *result;
+        tmp = make_operand_set(self, other);
+        if (tmp == NULL)
+            return NULL;
+        result = set_issuperset(self, tmp);
+        Py_DECREF(tmp);
+        return result;
+    }
+    return set_issubset((PyOrderedSetObject *)other, (PyObject *)self);
+}
+
+PyDoc_STRVAR(issuperset_doc, "Report whether this set contains another set.");
+
+static PyObject *
+set_isdisjoint(PyOrderedSetObject *self, PyObject *other)
+{
+    PyObject *it, *key;
+    double now, large_now;
+
+    if (PyOrderedSet_Check(other)) {
+        // Probe the larger set with the entries of the smaller one.
+        PyOrderedSetObject *small = self, *large = (PyOrderedSetObject *)other;
+        if (set_len(small) > set_len(large))
+            std::swap(small, large);
+        if (set_clock(small, &now) == -1 || set_clock(large, &large_now) == -1)
+            return NULL;
+        ordered_set &set = small->oset;
+        for (Py_ssize_t i = 0; i < set_len(small); i++) {
+            const ordered_set_entry &entry = set[i];
+            if (!set_entry_live(small, entry, now))
+                continue;
+            int rv = set_contains_entry(large, small, entry, large_now);
+            if (rv == -1)
+                return NULL;
+            if (rv)
+                Py_RETURN_FALSE;
+        }
+        Py_RETURN_TRUE;
+    }
+
+    if (set_clock(self, &now) == -1)
+        return NULL;
+    it = PyObject_GetIter(other);
+    if (it == NULL)
+        return NULL;
+    while ((key = PyIter_Next(it)) != NULL) {
+        const ordered_set_entry *pos = NULL;
+        int rv = set_find(self, key, &pos);
+        rv = set_found_live_at(self, rv, pos, now);
+        Py_DECREF(key);
+        if (rv == -1) {
+            Py_DECREF(it);
+            return NULL;
+        }
+        if (rv) {
+            Py_DECREF(it);
+            Py_RETURN_FALSE;
+        }
+    }
+    Py_DECREF(it);
+    if (PyErr_Occurred())
+        return NULL;
+    Py_RETURN_TRUE;
+}
+
+PyDoc_STRVAR(isdisjoint_doc,
+"Return True if two sets have a null intersection.\n\
+\n\
+Stops at the first common key without building the intersection.");
+
+static PyObject *
+set_equals_unordered(PyOrderedSetObject *self, PyObject *other)
+{
+    if (!PyOrderedSet_Check(other)) {
+        PyObject *tmp, *result;
+        tmp = make_operand_set(self, other);
+        if (tmp == NULL)
+            return NULL;
+        result = set_equals_unordered(self, tmp);
+        Py_DECREF(tmp);
+        return result;
+    }
+
+    PyOrderedSetObject *so = (PyOrderedSetObject *)other;
+    bool same_hashing = self->keyfunc == so->keyfunc;
+    if (set_expire_now(self) == -1 || set_expire_now(so) == -1)
+        return NULL;
+    if (set_len(self) != set_len(so))
+        Py_RETURN_FALSE;
+    if (same_hashing && self->fingerprint != so->fingerprint)
+        Py_RETURN_FALSE;
+
+    // Equal sizes, so equal if every key of self is in other.
+    ordered_set &set = self->oset;
+    const ordered_set_entry *pos = NULL;
+    for (ordered_set::iterator it = set.begin(); it < set.end(); it++) {
+        int rv;
+        if (same_hashing) {
+            ordered_set_probe probe = {it->lookup_key(), it->hash};
+            rv = set_lookup(so, probe, &pos);
+        }
+        else
+            rv = set_find(so, it->key, &pos);
+        if (rv == -1)
+            return NULL;
+        if (!rv)
+            Py_RETURN_FALSE;
+    }
+    Py_RETURN_TRUE;
+}
+
+PyDoc_STRVAR(equals_unordered_doc,
+"Report whether this set and another hold the same keys, in any order.\n\
+\n\
+Sets that differ are usually told apart in constant time by comparing\n\
+order-independent fingerprints of their contents.");
+
+static PyObject *
+set_richcompare(PyObject *v, PyObject *w, int op)
+{
+    PyOrderedSetObject *vl, *wl;
+    Py_ssize_t i, vlen, wlen;
+    PyObject *xkey = NULL, *ykey = NULL, *res;
+
+    if (!PyOrderedSet_Check(v) || !PyOrderedSet_Check(w)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+
+    vl = (PyOrderedSetObject *)v;
+    wl = (PyOrderedSetObject *)w;
+    if (set_expire_now(vl) == -1 || set_expire_now(wl) == -1)
+        return NULL;
+    // Hashes, and so fingerprints, are only comparable between sets that
+    // project keys the same way.
+    bool same_hashing = vl->keyfunc == wl->keyfunc;
+
+    // Shortcut: if the lengths or the fingerprints differ, the lists differ
+    vlen = set_len(vl);
+    wlen = set_len(wl);
+    if ((vlen != wlen || (same_hashing && vl->fingerprint != wl->fingerprint)) &&
+        (op == Py_EQ || op == Py_NE)) {
+        if (op == Py_EQ)
+            res = Py_False;
+        else
+            res = Py_True;
+        Py_INCREF(res);
+        return res;
+    }
+
+    // Search for the first index where items are different. __eq__ may
+    // change either set, so hold on to both keys and check the lengths
+    // again after every comparison; the differing pair is kept.
+    ordered_set &vset = vl->oset;
+    ordered_set &wset = wl->oset;
+    for (i = 0; i < set_len(vl) && i < set_len(wl); i++) {
+        const ordered_set_entry &x = vset[i], &y = wset[i];
+        if (x.key == y.key)
+            continue;
+        xkey = x.key;
+        ykey = y.key;
+        Py_INCREF(xkey);
+        Py_INCREF(ykey);
+        if (same_hashing && x.hash != y.hash)
+            break;
+        ORDEREDSET_COUNT(richcompares);
+        int k = PyObject_RichCompareBool(xkey, ykey, Py_EQ);
+        if (k < 0) {
+            Py_DECREF(xkey);
+            Py_DECREF(ykey);
+            return NULL;
+        }
+        if (!k)
+            break;
+        Py_CLEAR(xkey);
+        Py_CLEAR(ykey);
+    }
+
+    if (xkey == NULL) {
+        /* No more items to compare -- compare sizes */
+        int cmp;
+        vlen = set_len(vl);
+        wlen = set_len(wl);
+        switch (op) {
+            case Py_LT: cmp = vlen <  wlen; break;
+            case Py_LE: cmp = vlen <= wlen; break;
+            case Py_EQ: cmp = vlen == wlen; break;
+            case Py_NE: cmp = vlen != wlen; break;
+            case Py_GT: cmp = vlen >  wlen; break;
+            case Py_GE: cmp = vlen >= wlen; break;
+            default: return NULL; /* cannot happen */
+        }
+        if (cmp)
+            res = Py_True;
+        else
+            res = Py_False;
+        Py_INCREF(res);
+        return res;
+    }
+
+    /* We have an item that differs -- shortcuts for EQ/NE */
+    if (op == Py_EQ || op == Py_NE) {
+        res = op == Py_EQ ? Py_False : Py_True;
+        Py_INCREF(res);
+    }
+    else {
+        /* Compare the final item again using the proper operator */
+        res = PyObject_RichCompare(xkey, ykey, op);
+    }
+    Py_DECREF(xkey);
+    Py_DECREF(ykey);
+    return res;
+}
+
+//static int
+//set_nocmp(PyObject *self, PyObject *other)
+//{
+//  PyErr_SetString(PyExc_TypeError, "cannot compare sets using cmp()");
+//  return -1;
+//}
+
+static PyObject *
+set_add(PyOrderedSetObject *self, PyObject *key)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_ADD);
+    if (set_add_key(self, key) == -1)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(add_doc,
+"Add an element to a set.\n\
+\n\
+This has no effect if the element is already present.");
+
+static PyObject *
+set_insert(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    Py_ssize_t i, len;
+    PyObject *key;
+
+    if (set_check_nargs("insert", nargs, 2, 2) == -1 || set_arg_ssize(args[0], &i) == -1)
+        return NULL;
+    key = args[1];
+
+    if (self->ttl >= 0.0) {
+        // Stamps have to stay in order, keys can only go at the end.
+        if (i < set_len(self)) {
+            PyErr_SetString(PyExc_ValueError,
+                            "keys of a set with a ttl can only be appended");
+            return NULL;
+        }
+        if (set_add_key(self, key) == -1)
+            return NULL;
+        Py_RETURN_NONE;
+    }
+
+    ordered_set_probe probe;
+    const ordered_set_entry *pos = NULL;
+
+    if (set_probe(self, key, false, &probe) == -1)
+        return NULL;
+    int found = set_lookup(self, probe, &pos);
+    if (found == -1) {
+        Py_DECREF(probe.key);
+        return NULL;
+    }
+    if (found == 1 || self->maxlen == 0) {
+        Py_DECREF(probe.key);
+        Py_RETURN_NONE;
+    }
+    if (self->maxlen > 0)
+        set_make_room(self);
+
+    len = set_len(self);
+    if (i < 0) {
+        i += len;
+        if (i < 0)
+            i = 0;
+    }
+    if (i > len)
+        i = len;
+
+    ordered_set &set = self->oset;
+    set_append(self, ordered_set_entry(key, probe.hash,
+                                       self->keyfunc != NULL ? probe.key : NULL));
+    Py_DECREF(probe.key);
+    if (i < len) {
+        set.move(set.size() - 1, i);
+        set_order_changed(self);
+        set_log_change(self, PyOrderedSet_CHANGE_MOVE, set[i].key, i);
+    }
+    Py_RETURN_NONE;
+}
+
+SET_FASTCALL_ADAPTER(set_insert)
+
+PyDoc_STRVAR(insert_doc,
+"Insert an element before index.\n\
+\n\
+Indices are clamped like list.insert. This has no effect if the element\n\
+is already present; use move() to reposition it.");
+
+static int
+set_move_internal(PyOrderedSetObject *self, PyObject *key, Py_ssize_t i)
+{
+    const ordered_set_entry *entry;
+    Py_ssize_t len = set_len(self);
+
+    if (self->ttl >= 0.0) {
+        PyErr_SetString(PyExc_ValueError, "keys of a set with a ttl cannot be moved");
+        return -1;
+    }
+    int found = set_find(self, key, &entry);
+    if (found == -1)
+        return -1;
+    if (found == 0) {
+        PyErr_SetString(PyExc_ValueError, "x is not in set");
+        return -1;
+    }
+    if (i < 0)
+        i += len;
+    if (i < 0 || i >= len) {
+        PyErr_SetString(PyExc_IndexError, "move index out of range");
+        return -1;
+    }
+
+    ordered_set &set = self->oset;
+    Py_ssize_t pos = set.index_of(entry);
+    if (pos == i)
+        return 0;
+    set.move(pos, i);
+    set_order_changed(self);
+    set_log_change(self, PyOrderedSet_CHANGE_MOVE, set[i].key, i);
+    return 0;
+}
+
+static PyObject *
+set_move(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    Py_ssize_t i;
+
+    if (set_check_nargs("move", nargs, 2, 2) == -1 || set_arg_ssize(args[1], &i) == -1)
+        return NULL;
+    if (set_move_internal(self, args[0], i) == -1)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+SET_FASTCALL_ADAPTER(set_move)
+
+PyDoc_STRVAR(move_doc,
+"Move an existing element so that it ends up at index.\n\
+\n\
+Raises ValueError if the element is not present and IndexError if index\n\
+is out of range.");
+
+static PyObject *
+set_move_to_end(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs,
+                PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"key", "last", NULL};
+    PyObject *slots[] = {NULL, NULL};
+    int last = 1;
+
+    if (set_parse_keywords("move_to_end", kwlist, 1, args, nargs, kwnames, slots) == -1)
+        return NULL;
+    if (slots[1] != NULL && set_arg_flag(slots[1], &last) == -1)
+        return NULL;
+    if (set_move_internal(self, slots[0], last ? -1 : 0) == -1)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+SET_FASTCALL_KEYWORDS_ADAPTER(set_move_to_end)
+
+PyDoc_STRVAR(move_to_end_doc,
+"Move an existing element to the end, or to the beginning if last is false.\n\
+\n\
+Raises ValueError if the element is not present.");
+
+/* Permutations of the whole order. They go through rearrange(), which
+ * lays the leaves of the order out anew and leaves the hash index alone. Keys
+ * of a set with a ttl stay in insertion order, the sweep relies on it. */
+static int
+set_check_reorder(PyOrderedSetObject *self)
+{
+    if (self->ttl >= 0.0) {
+        PyErr_SetString(PyExc_ValueError, "keys of a set with a ttl cannot be moved");
+        return -1;
+    }
+    return 0;
+}
+
+/* Put the keys at positions order[0], order[1], ... in that order. Callers
+ * compute the order with Python code that may have changed the set, so it
+ * is only applied to the version it was computed for. */
+static int
+set_apply_order(PyOrderedSetObject *self, const std::vector<Py_ssize_t> &order,
+                unsigned long version)
+{
+    if (self->version != version) {
+        PyErr_SetString(PyExc_RuntimeError, "Set changed during reordering");
+        return -1;
+    }
+    ordered_set &set = self->oset;
+    std::vector<const ordered_set_entry *> entries;
+    entries.reserve(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+        entries.push_back(&set[order[i]]);
+    set.rearrange(entries);
+    set_order_changed(self);
+    set_log_order(self);
+    return 0;
+}
+
+/* Sort with list.sort(), so comparisons get its type specialised fast
+ * paths and its exact stability and reverse semantics: the positions
+ * 0..n-1 are sorted by key=sortkeys.__getitem__, where sortkeys holds the
+ * elements or, with a key function, its result for each of them. */
+static PyObject *
+set_sort(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs,
+         PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"key", "reverse", NULL};
+    PyObject *slots[] = {Py_None, Py_False};
+    PyObject *sortkeys = NULL, *positions = NULL, *getitem = NULL, *sort = NULL;
+    PyObject *noargs = NULL, *kwds = NULL, *rv = NULL;
+    std::vector<Py_ssize_t> order;
+
+    if (set_parse_keywords("sort", kwlist, 0, args, nargs, kwnames, slots) == -1)
+        return NULL;
+    if (set_check_reorder(self) == -1)
+        return NULL;
+
+    unsigned long version = self->version;
+    Py_ssize_t n = set_len(self);
+    sortkeys = set_tolist(self);
+    positions = PyList_New(n);
+    if (sortkeys == NULL || positions == NULL)
+        goto done;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *k = PyList_GET_ITEM(sortkeys, i);
+        PyObject *pos = PyLong_FromSsize_t(i);
+        if (pos == NULL)
+            goto done;
+        PyList_SET_ITEM(positions, i, pos);
+        // The key function is called once per element, up front.
+        if (slots[0] != Py_None) {
+            k = PyObject_CallFunctionObjArgs(slots[0], k, NULL);
+            if (k == NULL)
+                goto done;
+            PyList_SetItem(sortkeys, i, k);
+        }
+    }
+
+    getitem = PyObject_GetAttrString(sortkeys, "__getitem__");
+    sort = PyObject_GetAttrString(positions, "sort");
+    noargs = PyTuple_New(0);
+    if (getitem == NULL || sort == NULL || noargs == NULL)
+        goto done;
+    kwds = Py_BuildValue("{sOsO}", "key", getitem, "reverse", slots[1]);
+    if (kwds == NULL)
+        goto done;
+    rv = PyObject_Call(sort, noargs, kwds);
+    if (rv == NULL)
+        goto done;
+
+    order.reserve(n);
+    for (Py_ssize_t i = 0; i < n; i++)
+        order.push_back(PyLong_AsSsize_t(PyList_GET_ITEM(positions, i)));
+    if (set_apply_order(self, order, version) == -1)
+        Py_CLEAR(rv);
+
+done:
+    Py_XDECREF(sortkeys);
+    Py_XDECREF(positions);
+    Py_XDECREF(getitem);
+    Py_XDECREF(sort);
+    Py_XDECREF(noargs);
+    Py_XDECREF(kwds);
+    if (rv == NULL)
+        return NULL;
+    Py_DECREF(rv);
+    Py_RETURN_NONE;
+}
+
+SET_FASTCALL_KEYWORDS_ADAPTER(set_sort)
+
+PyDoc_STRVAR(sort_doc,
+"Sort the set in place, stably, like list.sort(key=None, reverse=False).\n\
+\n\
+key is called once per element. The hash index is left untouched.");
+
+static PyObject *
+set_reverse(PyOrderedSetObject *self)
+{
+    if (set_check_reorder(self) == -1)
+        return NULL;
+    self->oset.reverse();
+    set_order_changed(self);
+    set_log_order(self);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(reverse_doc, "Reverse the order of the set in place.");
+
+static PyObject *
+set_shuffle(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    PyObject *rng = NULL, *random;
+
+    if (set_check_nargs("shuffle", nargs, 0, 1) == -1 || set_check_reorder(self) == -1)
+        return NULL;
+    if (nargs == 1 && args[0] != Py_None)
+        random = PyObject_GetAttrString(args[0], "random");
+    else {
+        rng = PyImport_ImportModule("random");
+        if (rng == NULL)
+            return NULL;
+        random = PyObject_GetAttrString(rng, "random");
+        Py_DECREF(rng);
+    }
+    if (random == NULL)
+        return NULL;
+
+    unsigned long version = self->version;
+    Py_ssize_t n = set_len(self);
+    std::vector<Py_ssize_t> order;
+    order.reserve(n);
+    for (Py_ssize_t i = 0; i < n; i++)
+        order.push_back(i);
+    // Fisher-Yates with rng.random(), as random.shuffle(x, random) did.
+    for (Py_ssize_t i = n - 1; i > 0; i--) {
+        PyObject *r = PyObject_CallObject(random, NULL);
+        double x = r != NULL ? PyFloat_AsDouble(r) : -1.0;
+        Py_XDECREF(r);
+        if (x == -1.0 && PyErr_Occurred()) {
+            Py_DECREF(random);
+            return NULL;
+        }
+        Py_ssize_t j = (Py_ssize_t)(x * (i + 1));
+        if (!(x >= 0.0) || j > i) {
+            PyErr_SetString(PyExc_ValueError, "rng.random() must return a float in [0, 1)");
+            Py_DECREF(random);
+            return NULL;
+        }
+        std::swap(order[i], order[j]);
+    }
+    Py_DECREF(random);
+    if (set_apply_order(self, order, version) == -1)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+SET_FASTCALL_ADAPTER(set_shuffle)
+
+PyDoc_STRVAR(shuffle_doc,
+"shuffle([rng]) -- shuffle the set in place.\n\
+\n\
+rng.random() draws the positions, the random module's by default.");
+
+/* Change tracking, for replicas kept up to date with delta_since() and
+ * apply_delta() instead of copies of the whole set. Changes travel as
+ * tuples of an operation name and its arguments: */
+static const char *const set_change_names[PyOrderedSet_NCHANGES] = {
+    "add",      /* ("add", key) */
+    "discard",  /* ("discard", key) */
+    "move",     /* ("move", key, index) */
+    "order",    /* ("order", (key, ...)) */
+    "clear",    /* ("clear",) */
+};
+
+/* Builds the tuples of one delta, all sharing one object per name. */
+struct ordered_set_change_maker {
+    PyObject *names[PyOrderedSet_NCHANGES];
+
+    ordered_set_change_maker()
+    {
+        for (int op = 0; op < PyOrderedSet_NCHANGES; op++)
+            names[op] = NULL;
+    }
+
+    ~ordered_set_change_maker()
+    {
+        for (int op = 0; op < PyOrderedSet_NCHANGES; op++)
+            Py_XDECREF(names[op]);
+    }
+
+    int init()
+    {
+        for (int op = 0; op < PyOrderedSet_NCHANGES; op++) {
+            names[op] = Py_BuildValue("s", set_change_names[op]);
+            if (names[op] == NULL)
+                return -1;
+        }
+        return 0;
+    }
+
+    PyObject *make(int op, PyObject *key, Py_ssize_t index) const
+    {
+        switch (op) {
+        case PyOrderedSet_CHANGE_MOVE:
+            return Py_BuildValue("(OOn)", names[op], key, index);
+        case PyOrderedSet_CHANGE_CLEAR:
+            return PyTuple_Pack(1, names[op]);
+        default:
+            return PyTuple_Pack(2, names[op], key);
+        }
+    }
+
+    /* Append a change to the list changes. */
+    int append(PyObject *changes, int op, PyObject *key, Py_ssize_t index = 0) const
+    {
+        PyObject *change = make(op, key, index);
+        if (change == NULL)
+            return -1;
+        int rv = PyList_Append(changes, change);
+        Py_DECREF(change);
+        return rv;
+    }
+};
+
+static PyObject *
+set_track_changes(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs,
+                  PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"maxlen", NULL};
+    PyObject *slots[] = {Py_None};
+    Py_ssize_t maxlen = -1;
+
+    if (set_parse_keywords("track_changes", kwlist, 0, args, nargs, kwnames, slots) == -1)
+        return NULL;
+    if (slots[0] != Py_None) {
+        if (set_arg_ssize(slots[0], &maxlen) == -1)
+            return NULL;
+        if (maxlen < 0) {
+            PyErr_SetString(PyExc_ValueError, "maxlen must be non-negative");
+            return NULL;
+        }
+    }
+    if (maxlen == 0) {
+        ordered_set_changelog *changelog = self->changelog;
+        self->changelog = NULL;
+        delete changelog;
+    }
+    else if (self->changelog == NULL)
+        self->changelog = new ordered_set_changelog(self->version, maxlen);
+    else {
+        self->changelog->maxlen = maxlen;
+        self->changelog->trim();
+    }
+    return PyLong_FromUnsignedLong(self->version);
+}
+
+SET_FASTCALL_KEYWORDS_ADAPTER(set_track_changes)
+
+PyDoc_STRVAR(track_changes_doc,
+"track_changes(maxlen=None) -- record changes for delta_since().\n\
+\n\
+Returns the current version, the one a copy taken now is at. With maxlen\n\
+only that many of the latest changes are kept; maxlen=0 stops recording.");
+
+static PyObject *
+set_delta_since(PyOrderedSetObject *self, PyObject *arg)
+{
+    ordered_set_changelog *changelog = self->changelog;
+    ordered_set_change_maker maker;
+    PyObject *changes, *result;
+    unsigned long version;
+
+    if (changelog == NULL) {
+        PyErr_SetString(PyExc_ValueError, "set does not track changes");
+        return NULL;
+    }
+    version = PyLong_AsUnsignedLong(arg);
+    if (version == (unsigned long)-1 && PyErr_Occurred())
+        return NULL;
+    if (version < changelog->start || version > self->version) {
+        PyErr_Format(PyExc_ValueError, "version %lu is not in the change log", version);
+        return NULL;
+    }
+
+    struct version_before {
+        bool operator()(unsigned long v, const ordered_set_change &change) const
+        {
+            return v < change.version;
+        }
+    };
+    std::deque<ordered_set_change>::iterator it = std::upper_bound(
+        changelog->changes.begin(), changelog->changes.end(), version, version_before());
+
+    if (maker.init() == -1)
+        return NULL;
+    changes = PyList_New(changelog->changes.end() - it);
+    if (changes == NULL)
+        return NULL;
+    for (Py_ssize_t i = 0; it != changelog->changes.end(); ++it, i++) {
+        PyObject *change = maker.make(it->op, it->key, it->index);
+        if (change == NULL) {
+            Py_DECREF(changes);
+            return NULL;
+        }
+        PyList_SET_ITEM(changes, i, change);
+    }
+    result = Py_BuildValue("(kO)", self->version, changes);
+    Py_DECREF(changes);
+    return result;
+}
+
+PyDoc_STRVAR(delta_since_doc,
+"delta_since(version) -- changes made after version, as (version, changes).\n\
+\n\
+apply_delta() replays them on a replica at version. Raises ValueError\n\
+unless changes are tracked and the log still reaches back to version.");
+
+/* Put the keys of the tuple keys in that order, for an "order" change. */
+static int
+set_apply_keys_order(PyOrderedSetObject *self, PyObject *keys)
+{
+    std::vector<Py_ssize_t> order;
+    const ordered_set_entry *pos = NULL;
+
+    if (!PyTuple_Check(keys) || PyTuple_GET_SIZE(keys) != set_len(self))
+        goto mismatch;
+    order.reserve(PyTuple_GET_SIZE(keys));
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(keys); i++) {
+        int found = set_find(self, PyTuple_GET_ITEM(keys, i), &pos);
+        if (found == -1)
+            return -1;
+        if (found == 0)
+            goto mismatch;
+        order.push_back(self->oset.index_of(pos));
+    }
+    return set_apply_order(self, order, self->version);
+
+mismatch:
+    PyErr_SetString(PyExc_ValueError, "order does not match the keys of the set");
+    return -1;
+}
+
+static int
+set_apply_change(PyOrderedSetObject *self, PyObject *change)
+{
+    Py_ssize_t n, index;
+    PyObject *name;
+
+    if (!PyTuple_Check(change) || PyTuple_GET_SIZE(change) == 0)
+        goto invalid;
+    n = PyTuple_GET_SIZE(change);
+    name = PyTuple_GET_ITEM(change, 0);
+    if (set_keyword_is(name, "add") && n == 2)
+        return set_add_key(self, PyTuple_GET_ITEM(change, 1));
+    if (set_keyword_is(name, "discard") && n == 2)
+        return set_discard_key(self, PyTuple_GET_ITEM(change, 1)) == -1 ? -1 : 0;
+    if (set_keyword_is(name, "move") && n == 3) {
+        if (set_arg_ssize(PyTuple_GET_ITEM(change, 2), &index) == -1)
+            return -1;
+        return set_move_internal(self, PyTuple_GET_ITEM(change, 1), index);
+    }
+    if (set_keyword_is(name, "order") && n == 2) {
+        if (set_check_reorder(self) == -1)
+            return -1;
+        return set_apply_keys_order(self, PyTuple_GET_ITEM(change, 1));
+    }
+    if (set_keyword_is(name, "clear") && n == 1)
+        return set_clear_internal(self);
+
+invalid:
+    PyErr_Format(PyExc_ValueError, "invalid change %R", change);
+    return -1;
+}
+
+static PyObject *
+set_apply_delta(PyOrderedSetObject *self, PyObject *delta)
+{
+    PyObject *changes, *version = Py_None;
+    int rv = 0;
+
+    // A list of changes from diff(), or a (version, changes) tuple.
+    if (!PyList_Check(delta)) {
+        if (!PyTuple_Check(delta) || PyTuple_GET_SIZE(delta) != 2) {
+            PyErr_SetString(PyExc_TypeError,
+                            "delta must be a (version, changes) tuple or a list of changes");
+            return NULL;
+        }
+        version = PyTuple_GET_ITEM(delta, 0);
+        delta = PyTuple_GET_ITEM(delta, 1);
+    }
+    changes = PySequence_Fast(delta, "changes must be a sequence");
+    if (changes == NULL)
+        return NULL;
+    PyObject *const *items = PySequence_Fast_ITEMS(changes);
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(changes);
+    for (Py_ssize_t i = 0; rv != -1 && i < n; i++)
+        rv = set_apply_change(self, items[i]);
+    Py_DECREF(changes);
+    if (rv == -1)
+        return NULL;
+    Py_INCREF(version);
+    return version;
+}
+
+PyDoc_STRVAR(apply_delta_doc,
+"apply_delta(delta) -- replay changes returned by delta_since() or diff().\n\
+\n\
+Returns the version the delta brings the replica to, None for a diff. The\n\
+work done is proportional to the number of changes, save for reorderings\n\
+of the set.");
+
+/* Counts of marked positions below an index, in O(log n). */
+struct ordered_set_fenwick {
+    std::vector<Py_ssize_t> tree;
+
+    explicit ordered_set_fenwick(Py_ssize_t n) : tree(n + 1, 0) {}
+
+    void add(Py_ssize_t i, Py_ssize_t delta)
+    {
+        for (i++; i < (Py_ssize_t)tree.size(); i += i & -i)
+            tree[i] += delta;
+    }
+
+    /* Marks at positions 0..i-1. */
+    Py_ssize_t count(Py_ssize_t i) const
+    {
+        Py_ssize_t n = 0;
+        for (; i > 0; i -= i & -i)
+            n += tree[i];
+        return n;
+    }
+};
+
+/*
+ * The edit script turning self into other: keys missing from other are
+ * discarded, then the keys of other are settled in its order. A longest
+ * increasing subsequence of the positions of the common keys, found by
+ * patience sorting, stays where it is. Every other key is moved, or added
+ * and moved, to just after the key before it in other, which is settled
+ * by then. The index that takes is the number of keys settled so far plus
+ * the unsettled ones still in front of the last key that stayed, which
+ * keep their places relative to it and are counted with a Fenwick tree.
+ */
+static PyObject *
+set_diff(PyOrderedSetObject *self, PyObject *arg)
+{
+    ordered_set_change_maker maker;
+    const ordered_set_entry *pos = NULL;
+    PyOrderedSetObject *other;
+    PyObject *changes = NULL;
+
+    if (PyOrderedSet_Check(arg)) {
+        Py_INCREF(arg);
+        other = (PyOrderedSetObject *)arg;
+    }
+    else {
+        other = (PyOrderedSetObject *)make_operand_set(self, arg);
+        if (other == NULL)
+            return NULL;
+    }
+    if (set_expire_now(self) == -1 || set_expire_now(other) == -1) {
+        Py_DECREF(other);
+        return NULL;
+    }
+
+    ordered_set &aset = self->oset;
+    ordered_set &bset = other->oset;
+    Py_ssize_t na = aset.size(), nb = bset.size(), m = 0;
+    // Position of each key of self among those kept, -1 if discarded, and
+    // that position for each key of other, -1 if added.
+    std::vector<Py_ssize_t> kept(na, -1), seq(nb, -1);
+
+    if (maker.init() == -1 || (changes = PyList_New(0)) == NULL)
+        goto error;
+    for (Py_ssize_t i = 0; i < na; i++) {
+        int found = set_find_entry(other, self, aset[i], &pos);
+        if (found == -1)
+            goto error;
+        if (found == 1)
+            kept[i] = m++;
+        else if (maker.append(changes, PyOrderedSet_CHANGE_DISCARD, aset[i].key) == -1)
+            goto error;
+    }
+    for (Py_ssize_t j = 0; j < nb; j++) {
+        int found = set_find_entry(self, other, bset[j], &pos);
+        if (found == -1)
+            goto error;
+        if (found == 1)
+            seq[j] = kept[aset.index_of(pos)];
+    }
+
+    {
+        // Patience sorting: tails[k] ends the best increasing run of length
+        // k + 1 found so far, prev[j] links j to the key before it in its run.
+        std::vector<Py_ssize_t> tails, prev(nb, -1);
+        std::vector<char> stays(nb, 0);
+        for (Py_ssize_t j = 0; j < nb; j++) {
+            if (seq[j] < 0)
+                continue;
+            Py_ssize_t lo = 0, hi = tails.size();
+            while (lo < hi) {
+                Py_ssize_t mid = (lo + hi) / 2;
+                if (seq[tails[mid]] < seq[j])
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo > 0)
+                prev[j] = tails[lo - 1];
+            if (lo == (Py_ssize_t)tails.size())
+                tails.push_back(j);
+            else
+                tails[lo] = j;
+        }
+        for (Py_ssize_t j = tails.empty() ? -1 : tails.back(); j >= 0; j = prev[j])
+            stays[j] = 1;
+
+        ordered_set_fenwick unsettled(m);
+        for (Py_ssize_t j = 0; j < nb; j++) {
+            if (seq[j] >= 0 && !stays[j])
+                unsettled.add(seq[j], 1);
+        }
+        Py_ssize_t anchor = 0, len = m;
+        for (Py_ssize_t j = 0; j < nb; j++) {
+            if (stays[j]) {
+                anchor = seq[j];
+                continue;
+            }
+            if (seq[j] >= 0)
+                unsettled.add(seq[j], -1);
+            else if (maker.append(changes, PyOrderedSet_CHANGE_ADD, bset[j].key) == -1)
+                goto error;
+            else
+                len++;
+            Py_ssize_t index = j + unsettled.count(anchor);
+            if ((seq[j] >= 0 || index != len - 1) &&
+                maker.append(changes, PyOrderedSet_CHANGE_MOVE, bset[j].key, index) == -1)
+                goto error;
+        }
+    }
+    Py_DECREF(other);
+    return changes;
+
+error:
+    Py_DECREF(other);
+    Py_XDECREF(changes);
+    return NULL;
+}
+
+PyDoc_STRVAR(diff_doc,
+"diff(other) -- the changes that turn this set into other.\n\
+\n\
+Keys not in other are discarded and keys only in other are added. The\n\
+most keys that keep their relative order stay put and the others are\n\
+moved. The result is a list of changes as delta_since() returns them,\n\
+for apply_delta().");
+
+static PyObject *
+set_item(PyOrderedSetObject *self, Py_ssize_t i)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_GETITEM);
+    if (i < 0 || i >= set_len(self)) {
+        PyErr_SetString(PyExc_IndexError, "list index out of range");
+        return NULL;
+    }
+    ordered_set &set = self->oset;
+    Py_INCREF(set[i].key);
+    return set[i].key;
+}
+
+static PyObject *
+set_slice(PyOrderedSetObject *self, Py_ssize_t ilow, Py_ssize_t ihigh)
+{
+    if (ilow < 0)
+        ilow = 0;
+    else if (ilow > set_len(self))
+        ilow = set_len(self);
+    if (ihigh < ilow)
+        ihigh = ilow;
+    else if (ihigh > set_len(self))
+        ihigh = set_len(self);
+
+    return set_copy_range(self, ilow, 1, ihigh - ilow);
+}
+
+static int
+set_ass_item(PyOrderedSetObject *self, Py_ssize_t i, PyObject *key)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_DELITEM);
+    if (key != NULL) {
+        // don't support __setitem__
+        PyErr_SetString(PyExc_TypeError,
+                        "orderedset does not support item assignment, use insert() or move()");
+        return -1;
+    }
+
+    if (i < 0 || i >= set_len(self)) {
+        PyErr_SetString(PyExc_IndexError, "list assignment index out of range");
+        return -1;
+    }
+
+    // delete item
+    ordered_set &set = self->oset;
+    ORDEREDSET_COUNT_ERASE(set.shift_cost(i));
+    set_entry_removed(self, set[i]);
+    set.erase(set.begin() + i);
+    set_maybe_shrink(self);
+    return 0;
+}
+
+/* remove_if() predicate selecting the keys at positions next, next + step,
+ * ... It counts positions itself, relying on remove_if() visiting the pointer
+ * array once and in order with the copy it was given. */
+struct ordered_set_slice_victims {
+    mutable Py_ssize_t pos, next, left;
+    Py_ssize_t step;
+
+    bool operator()(const ordered_set_entry &) const
+    {
+        if (pos++ != next)
+            return false;
+        next = --left > 0 ? next + step : -1;
+        return true;
+    }
+};
+
+/* Remove the slicelength keys at start, start + step, ... A contiguous run
+ * is erased a leaf at a time; any other step filters the order in a single
+ * pass, so no key is shifted more than once whatever the step. */
+static void
+set_delete_slice(PyOrderedSetObject *self, Py_ssize_t start, Py_ssize_t step,
+                 Py_ssize_t slicelength)
+{
+    ordered_set &set = self->oset;
+
+    if (slicelength <= 0)
+        return;
+    if (step < 0) {
+        start += (slicelength - 1) * step;
+        step = -step;
+    }
+
+    for (Py_ssize_t i = 0; i < slicelength; i++)
+        set_entry_removed(self, set[start + i * step]);
+
+    if (step == 1) {
+        ORDEREDSET_COUNT_ERASE(set.shift_cost(start + slicelength - 1));
+        set.erase(set.begin() + start, set.begin() + start + slicelength);
+        return;
+    }
+
+    ordered_set_slice_victims victims = {0, start, slicelength, step};
+    ORDEREDSET_COUNT_ERASE(set.size() - slicelength);
+    set.remove_if(victims);
+}
+
+static int
+set_ass_slice(PyOrderedSetObject *self, Py_ssize_t ilow, Py_ssize_t ihigh, PyObject *other)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_DELITEM);
+    if (other != NULL) {
+        // don't support __setslice__
+        PyErr_SetString(PyExc_TypeError,
+                        "orderedset does not support slice assignment, use update() or insert()");
+        return -1;
+    }
+
+    if (ilow < 0)
+        ilow = 0;
+    else if (ilow > set_len(self))
+        ilow = set_len(self);
+    if (ihigh < ilow)
+        ihigh = ilow;
+    else if (ihigh > set_len(self))
+        ihigh = set_len(self);
+
+    set_delete_slice(self, ilow, 1, ihigh - ilow);
+    set_maybe_shrink(self);
+    return 0;
+}
+
+static PyObject *
 set_subscript(PyOrderedSetObject* self, PyObject* item)
+{
+    if (set_expire_now(self) == -1)
+        return NULL;
+    if (PyIndex_Check(item)) {
+        Py_ssize_t i;
+        i = PyNumber_AsSsize_t(item, PyExc_IndexError);
+        if (i == -1 && PyErr_Occurred())
+            return NULL;
+        if (i < 0)
+            i += set_len(self);
+        return set_item(self, i);
+    }
+    else if (PySlice_Check(item)) {
+        Py_ssize_t start, stop, step, slicelength;
+        int error;
+#if PY_MAJOR_VERSION > 2
+        error = PySlice_GetIndicesEx(item, set_len(self),
+                                     &start, &stop, &step, &slicelength) < 0;
+#else
+        error = PySlice_GetIndicesEx((PySliceObject*)item, set_len(self),
+                                     &start, &stop, &step, &slicelength) < 0;
+#endif
+
+        if (error) {
+            return NULL;
+        }
+
+        return set_copy_range(self, start, step, slicelength);
+    }
+    else {
+        PyErr_SetString(PyExc_TypeError, "indices must be integers");
+        return NULL;
+    }
+}
+
+static int
+set_ass_subscript(PyOrderedSetObject *self, PyObject *item, PyObject *value)
+{
+    if (PyIndex_Check(item)) {
+        Py_ssize_t i;
+        i = PyNumber_AsSsize_t(item, PyExc_IndexError);
+        if (i == -1 && PyErr_Occurred())
+            return -1;
+        if (i < 0)
+            i += set_len(self);
+        return set_ass_item(self, i, value);
+    }
+    else if (PySlice_Check(item)) {
+        ORDEREDSET_TIME(PyOrderedSet_OP_DELITEM);
+        Py_ssize_t start, stop, step, slicelength;
+        int error;
+
+        if (value != NULL) {
+            // don't support __setitem__ with a slice
+            PyErr_SetString(PyExc_TypeError,
+                            "orderedset does not support slice assignment, use update() or insert()");
+            return -1;
+        }
+#if PY_MAJOR_VERSION > 2
+        error = PySlice_GetIndicesEx(item, set_len(self),
+                                     &start, &stop, &step, &slicelength) < 0;
+#else
+        error = PySlice_GetIndicesEx((PySliceObject*)item, set_len(self),
+                                     &start, &stop, &step, &slicelength) < 0;
+#endif
+        if (error)
+            return -1;
+
+        set_delete_slice(self, start, step, slicelength);
+        set_maybe_shrink(self);
+        return 0;
+    }
+    else {
+        PyErr_SetString(PyExc_TypeError, "indices must be integers");
+        return -1;
+    }
+}
+
+/***** Lazy set expressions ********************************************/
+
+/*
+ * a.lazy() | b - c builds a tree of setexprobjects over the operand sets
+ * instead of computing a set per operator. Membership probes the operands'
+ * hash indices directly and iteration streams the result in the order the
+ * eager operators would give it, so neither builds anything. len(),
+ * indexing and materialize() evaluate the expression eagerly, caching the
+ * result in each node until an operand or the cached set itself changes.
+ */
+
+enum {
+    SET_EXPR_LEAF,
+    SET_EXPR_OR,
+    SET_EXPR_AND,
+    SET_EXPR_SUB,
+    SET_EXPR_XOR
+};
+
+typedef struct setexprobject {
+    PyObject_HEAD
+    int se_op;
+    PyOrderedSetObject *se_set;        /* Operand of a leaf */
+    struct setexprobject *se_left;
+    struct setexprobject *se_right;
+    PyOrderedSetObject *se_cache;      /* Evaluated result, or NULL */
+    unsigned long se_stamp;            /* set_expr_stamp() when cached */
+    unsigned long se_cache_version;
+} setexprobject;
+
+/* Sum of the versions of the operands. Versions only grow, so the sum
+ * changes whenever any operand does. */
+static unsigned long
+set_expr_stamp(setexprobject *e)
+{
+    if (e->se_op == SET_EXPR_LEAF)
+        return e->se_set->version;
+    return set_expr_stamp(e->se_left) + set_expr_stamp(e->se_right);
+}
+
+static setexprobject *
+make_set_expr(int op, PyOrderedSetObject *set, setexprobject *left, setexprobject *right)
+{
+    setexprobject *e = PyObject_GC_New(setexprobject, &PyOrderedSetExpr_Type);
+    if (e == NULL)
+        return NULL;
+    Py_XINCREF(set);
+    Py_XINCREF(left);
+    Py_XINCREF(right);
+    e->se_op = op;
+    e->se_set = set;
+    e->se_left = left;
+    e->se_right = right;
+    e->se_cache = NULL;
+    e->se_stamp = 0;
+    e->se_cache_version = 0;
+    PyObject_GC_Track(e);
+    return e;
+}
+
+static void
+setexpr_dealloc(setexprobject *e)
+{
+    PyObject_GC_UnTrack(e);
+    Py_XDECREF(e->se_set);
+    Py_XDECREF(e->se_left);
+    Py_XDECREF(e->se_right);
+    Py_XDECREF(e->se_cache);
+    PyObject_GC_Del(e);
+}
+
+static int
+setexpr_traverse(setexprobject *e, visitproc visit, void *arg)
+{
+    Py_VISIT(e->se_set);
+    Py_VISIT(e->se_left);
+    Py_VISIT(e->se_right);
+    Py_VISIT(e->se_cache);
+    return 0;
+}
+
+/* Expressions over each other form no cycles, so any cycle runs through a
+ * set, which set_tp_clear() breaks. Only the cache is dropped here: the
+ * operands stay in place for as long as the node can still be reached. */
+static int
+setexpr_tp_clear(setexprobject *e)
+{
+    Py_CLEAR(e->se_cache);
+    return 0;
+}
+
+/* Whether key is in the result of e. Leaves without a key function share
+ * one probe, so the key is hashed once however many operands it visits.
+ * Returns 1, 0 or -1 on error. */
+static int
+set_expr_contains_probe(setexprobject *e, PyObject *key, ordered_set_probe *probe)
+{
+    int l, r;
+
+    switch (e->se_op) {
+    case SET_EXPR_LEAF: {
+        PyOrderedSetObject *so = e->se_set;
+        const ordered_set_entry *pos = NULL;
+        if (so->keyfunc != NULL)
+            return set_contains(so, key);
+        if (probe->key == NULL && set_probe(so, key, false, probe) == -1)
+            return -1;
+        int found = set_lookup(so, *probe, &pos);
+        return set_found_live(so, found, pos);
+    }
+    case SET_EXPR_OR:
+        l = set_expr_contains_probe(e->se_left, key, probe);
+        return l != 0 ? l : set_expr_contains_probe(e->se_right, key, probe);
+    case SET_EXPR_AND:
+        l = set_expr_contains_probe(e->se_left, key, probe);
+        return l != 1 ? l : set_expr_contains_probe(e->se_right, key, probe);
+    case SET_EXPR_SUB:
+        l = set_expr_contains_probe(e->se_left, key, probe);
+        if (l != 1)
+            return l;
+        r = set_expr_contains_probe(e->se_right, key, probe);
+        return r == -1 ? -1 : !r;
+    default:
+        l = set_expr_contains_probe(e->se_left, key, probe);
+        if (l == -1)
+            return -1;
+        r = set_expr_contains_probe(e->se_right, key, probe);
+        return r == -1 ? -1 : l != r;
+    }
+}
+
+static int
+set_expr_contains(setexprobject *e, PyObject *key)
+{
+    ordered_set_probe probe = {NULL, 0};
+
+    int found = set_expr_contains_probe(e, key, &probe);
+    Py_XDECREF(probe.key);
+    return found;
+}
+
+/* The cached result of e if it is still current, else NULL. */
+static PyOrderedSetObject *
+set_expr_cached(setexprobject *e)
+{
+    if (e->se_op == SET_EXPR_LEAF)
+        return e->se_set;
+    if (e->se_cache != NULL &&
+        (e->se_stamp != set_expr_stamp(e) || e->se_cache_version != e->se_cache->version))
+        Py_CLEAR(e->se_cache);
+    return e->se_cache;
+}
+
+/* Evaluate e with the eager operators, from the cached results of its
+ * subexpressions where they have them. Returns a new reference; for a leaf
+ * that is the operand itself. */
+static PyOrderedSetObject *
+set_expr_eval(setexprobject *e)
+{
+    PyOrderedSetObject *result = set_expr_cached(e);
+    if (result != NULL) {
+        Py_INCREF(result);
+        return result;
+    }
+
+    PyOrderedSetObject *l = set_expr_eval(e->se_left);
+    if (l == NULL)
+        return NULL;
+    PyOrderedSetObject *r = set_expr_eval(e->se_right);
+    if (r == NULL) {
+        Py_DECREF(l);
+        return NULL;
+    }
+    PyObject *other = (PyObject *)r;
+    switch (e->se_op) {
+    case SET_EXPR_OR:
+        result = (PyOrderedSetObject *)set_union_internal(l, &other, 1);
+        break;
+    case SET_EXPR_AND:
+        result = (PyOrderedSetObject *)set_intersection_internal(l, &other, 1);
+        break;
+    case SET_EXPR_SUB:
+        result = (PyOrderedSetObject *)set_difference_internal(l, &other, 1);
+        break;
+    default:
+        result = (PyOrderedSetObject *)set_symmetric_difference(l, other);
+        break;
+    }
+    Py_DECREF(l);
+    Py_DECREF(r);
+    if (result == NULL)
+        return NULL;
+
+    Py_INCREF(result);
+    e->se_cache = result;
+    e->se_stamp = set_expr_stamp(e);
+    e->se_cache_version = result->version;
+    return result;
+}
+
+/* The set whose key function a plain iterable operand of a and b is
+ * projected by, as the eager operators would: a if it is a set, else the
+ * first leaf of a or b. */
+static PyOrderedSetObject *
+set_expr_like(PyObject *a, PyObject *b)
+{
+    PyObject *obj = PyOrderedSet_Check(a) || PyOrderedSetExpr_Check(a) ? a : b;
+    if (PyOrderedSet_Check(obj))
+        return (PyOrderedSetObject *)obj;
+    setexprobject *e = (setexprobject *)obj;
+    while (e->se_op != SET_EXPR_LEAF)
+        e = e->se_left;
+    return e->se_set;
+}
+
+/* An operand of an expression operator: expressions as they are, sets as
+ * leaves and other iterables collected into a set like `like` first. */
+static setexprobject *
+set_expr_operand(PyObject *obj, PyOrderedSetObject *like)
+{
+    if (PyOrderedSetExpr_Check(obj)) {
+        Py_INCREF(obj);
+        return (setexprobject *)obj;
+    }
+    if (PyOrderedSet_Check(obj))
+        return make_set_expr(SET_EXPR_LEAF, (PyOrderedSetObject *)obj, NULL, NULL);
+    PyObject *tmp = make_operand_set(like, obj);
+    if (tmp == NULL)
+        return NULL;
+    setexprobject *e = make_set_expr(SET_EXPR_LEAF, (PyOrderedSetObject *)tmp, NULL, NULL);
+    Py_DECREF(tmp);
+    return e;
+}
+
+static PyObject *
+set_expr_binop(PyObject *a, PyObject *b, int op)
+{
+    if (!PyObject_IsIterable(a) || !PyObject_IsIterable(b)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+
+    PyOrderedSetObject *like = set_expr_like(a, b);
+    setexprobject *left = set_expr_operand(a, like);
+    if (left == NULL)
+        return NULL;
+    setexprobject *right = set_expr_operand(b, like);
+    if (right == NULL) {
+        Py_DECREF(left);
+        return NULL;
+    }
+    setexprobject *e = make_set_expr(op, NULL, left, right);
+    Py_DECREF(left);
+    Py_DECREF(right);
+    return (PyObject *)e;
+}
+
+static PyObject *
+setexpr_or(PyObject *a, PyObject *b)
+{
+    return set_expr_binop(a, b, SET_EXPR_OR);
+}
+
+static PyObject *
+setexpr_and(PyObject *a, PyObject *b)
+{
+    return set_expr_binop(a, b, SET_EXPR_AND);
+}
+
+static PyObject *
+setexpr_sub(PyObject *a, PyObject *b)
+{
+    return set_expr_binop(a, b, SET_EXPR_SUB);
+}
+
+static PyObject *
+setexpr_xor(PyObject *a, PyObject *b)
+{
+    return set_expr_binop(a, b, SET_EXPR_XOR);
+}
+
+/* Streaming evaluation: a cursor per expression node walks its left
+ * operand and then, for | and ^, its right one, keeping the keys the
+ * operator lets through. */
+struct ordered_set_expr_cursor {
+    setexprobject *expr;
+    Py_ssize_t pos;                    /* Next position in a leaf */
+    int phase;                         /* 0 on the left operand, 1 on the right */
+    ordered_set_expr_cursor *child;
+
+    ordered_set_expr_cursor(setexprobject *expr)
+        : expr(expr), pos(0), phase(0), child(NULL) {}
+    ~ordered_set_expr_cursor() { delete child; }
+};
+
+/* The next key of the cursor as a new reference, or NULL once exhausted or
+ * on error. */
+static PyObject *
+set_expr_next(ordered_set_expr_cursor *c)
+{
+    setexprobject *e = c->expr;
+
+    if (e->se_op == SET_EXPR_LEAF) {
+        ordered_set &set = e->se_set->oset;
+        if (c->pos >= (Py_ssize_t)set.size())
+            return NULL;
+        PyObject *key = set[c->pos++].key;
+        Py_INCREF(key);
+        return key;
+    }
+
+    for (;;) {
+        if (c->child == NULL)
+            c->child = new ordered_set_expr_cursor(c->phase == 0 ? e->se_left : e->se_right);
+        PyObject *key = set_expr_next(c->child);
+        if (key == NULL) {
+            if (PyErr_Occurred() || c->phase == 1 ||
+                e->se_op == SET_EXPR_AND || e->se_op == SET_EXPR_SUB)
+                return NULL;
+            delete c->child;
+            c->child = NULL;
+            c->phase = 1;
+            continue;
+        }
+
+        int found, keep;
+        if (c->phase == 1) {
+            // Right operand of | or ^: only keys missing from the left.
+            found = set_expr_contains(e->se_left, key);
+            keep = found == 0;
+        }
+        else if (e->se_op == SET_EXPR_OR) {
+            return key;
+        }
+        else {
+            found = set_expr_contains(e->se_right, key);
+            keep = e->se_op == SET_EXPR_AND ? found == 1 : found == 0;
+        }
+        if (keep)
+            return key;
+        Py_DECREF(key);
+        if (found == -1)
+            return NULL;
+    }
+}
+
+typedef struct {
+    PyObject_HEAD
+    setexprobject *ei_expr;            /* Set to NULL when iterator is exhausted */
+    unsigned long ei_stamp;
+    ordered_set_expr_cursor *ei_cursor;
+} setexpriterobject;
+
+static void
+setexpriter_dealloc(setexpriterobject *ei)
+{
+    PyObject_GC_UnTrack(ei);
+    delete ei->ei_cursor;
+    Py_XDECREF(ei->ei_expr);
+    PyObject_GC_Del(ei);
+}
+
+static int
+setexpriter_traverse(setexpriterobject *ei, visitproc visit, void *arg)
+{
+    Py_VISIT(ei->ei_expr);
+    return 0;
+}
+
+static PyObject *
+setexpriter_iternext(setexpriterobject *ei)
+{
+    setexprobject *e = ei->ei_expr;
+    PyObject *key;
+
+    if (e == NULL)
+        return NULL;
+    if (ei->ei_stamp != set_expr_stamp(e)) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Set changed during iteration");
+        key = NULL;
+    }
+    else
+        key = set_expr_next(ei->ei_cursor);
+    if (key == NULL) {
+        /* Make this state sticky */
+        delete ei->ei_cursor;
+        ei->ei_cursor = NULL;
+        Py_CLEAR(ei->ei_expr);
+    }
+    return key;
+}
+
+static PyTypeObject PyOrderedSetExprIter_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "orderedset_expr_iterator", /* tp_name */
+    sizeof(setexpriterobject),  /* tp_basicsize */
+    0,                          /* tp_itemsize */
+    /* methods */
+    (destructor)setexpriter_dealloc, /* tp_dealloc */
+    0,                          /* tp_print */
+    0,                          /* tp_getattr */
+    0,                          /* tp_setattr */
+    0,                          /* tp_compare */
+    0,                          /* tp_repr */
+    0,                          /* tp_as_number */
+    0,                          /* tp_as_sequence */
+    0,                          /* tp_as_mapping */
+    0,                          /* tp_hash */
+    0,                          /* tp_call */
+    0,                          /* tp_str */
+    PyObject_GenericGetAttr,    /* tp_getattro */
+    0,                          /* tp_setattro */
+    0,                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                          /* tp_doc */
+    (traverseproc)setexpriter_traverse, /* tp_traverse */
+    0,                          /* tp_clear */
+    0,                          /* tp_richcompare */
+    0,                          /* tp_weaklistoffset */
+    PyObject_SelfIter,          /* tp_iter */
+    (iternextfunc)setexpriter_iternext, /* tp_iternext */
+    0,
+};
+
+static PyObject *
+setexpr_iter(setexprobject *e)
+{
+    PyOrderedSetObject *cached = set_expr_cached(e);
+    if (cached != NULL)
+        return set_iter(cached);
+
+    setexpriterobject *ei = PyObject_GC_New(setexpriterobject, &PyOrderedSetExprIter_Type);
+    if (ei == NULL)
+        return NULL;
+    Py_INCREF(e);
+    ei->ei_expr = e;
+    ei->ei_stamp = set_expr_stamp(e);
+    ei->ei_cursor = new ordered_set_expr_cursor(e);
+    PyObject_GC_Track(ei);
+    return (PyObject *)ei;
+}
+
+static Py_ssize_t
+setexpr_len(setexprobject *e)
+{
+    PyOrderedSetObject *result = set_expr_eval(e);
+    if (result == NULL)
+        return -1;
+    Py_ssize_t len = set_len(result);
+    Py_DECREF(result);
+    return len;
+}
+
+/* Truth only needs the first key of the stream. */
+static int
+setexpr_bool(setexprobject *e)
+{
+    PyOrderedSetObject *cached = set_expr_cached(e);
+    if (cached != NULL)
+        return set_len(cached) > 0;
+
+    ordered_set_expr_cursor cursor(e);
+    PyObject *key = set_expr_next(&cursor);
+    if (key == NULL)
+        return PyErr_Occurred() ? -1 : 0;
+    Py_DECREF(key);
+    return 1;
+}
+
+static PyObject *
+setexpr_subscript(setexprobject *e, PyObject *item)
+{
+    PyOrderedSetObject *result = set_expr_eval(e);
+    if (result == NULL)
+        return NULL;
+    PyObject *value = set_subscript(result, item);
+    Py_DECREF(result);
+    return value;
+}
+
+static PyObject *
+setexpr_materialize(setexprobject *e)
+{
+    if (e->se_op == SET_EXPR_LEAF)
+        return set_copy(e->se_set);
+    PyOrderedSetObject *result = set_expr_eval(e);
+    if (result == NULL)
+        return NULL;
+    PyObject *copy = set_copy(result);
+    Py_DECREF(result);
+    return copy;
+}
+
+PyDoc_STRVAR(materialize_doc,
+"Return the value of the expression as a new orderedset.\n\
+\n\
+The value is evaluated once and cached until an operand changes, so\n\
+later calls only copy it.");
+
+static PyMethodDef setexpr_methods[] = {
+    {"materialize", (PyCFunction)setexpr_materialize, METH_NOARGS, materialize_doc},
+    {NULL, NULL} /* sentinel */
+};
+
+#if PY_MAJOR_VERSION > 2
+static PyNumberMethods setexpr_as_number = {
+    0,                          /* nb_add */
+    (binaryfunc)setexpr_sub,    /* nb_subtract */
+    0,                          /* nb_multiply */
+    0,                          /* nb_remainder */
+    0,                          /* nb_divmod */
+    0,                          /* nb_power */
+    0,                          /* nb_negative */
+    0,                          /* nb_positive */
+    0,                          /* nb_absolute */
+    (inquiry)setexpr_bool,      /* nb_bool */
+    0,                          /* nb_invert */
+    0,                          /* nb_lshift */
+    0,                          /* nb_rshift */
+    (binaryfunc)setexpr_and,    /* nb_and */
+    (binaryfunc)setexpr_xor,    /* nb_xor */
+    (binaryfunc)setexpr_or,     /* nb_or */
+};
+#else
+static PyNumberMethods setexpr_as_number = {
+    0,                          /* nb_add */
+    (binaryfunc)setexpr_sub,    /* nb_subtract */
+    0,                          /* nb_multiply */
+    0,                          /* nb_divide */
+    0,                          /* nb_remainder */
+    0,                          /* nb_divmod */
+    0,                          /* nb_power */
+    0,                          /* nb_negative */
+    0,                          /* nb_positive */
+    0,                          /* nb_absolute */
+    (inquiry)setexpr_bool,      /* nb_nonzero */
+    0,                          /* nb_invert */
+    0,                          /* nb_lshift */
+    0,                          /* nb_rshift */
+    (binaryfunc)setexpr_and,    /* nb_and */
+    (binaryfunc)setexpr_xor,    /* nb_xor */
+    (binaryfunc)setexpr_or,     /* nb_or */
+};
+#endif
+
+static PySequenceMethods setexpr_as_sequence = {
+    (lenfunc)setexpr_len,       /* sq_length */
+    0,                          /* sq_concat */
+    0,                          /* sq_repeat */
+    0,                          /* sq_item */
+    0,                          /* sq_slice */
+    0,                          /* sq_ass_item */
+    0,                          /* sq_ass_slice */
+    (objobjproc)set_expr_contains, /* sq_contains */
+};
+
+static PyMappingMethods setexpr_as_mapping = {
+    (lenfunc)setexpr_len,       /* mp_length */
+    (binaryfunc)setexpr_subscript, /* mp_subscript */
+    0,                          /* mp_ass_subscript */
+};
+
+PyTypeObject PyOrderedSetExpr_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "orderedset_expr",          /* tp_name */
+    sizeof(setexprobject),      /* tp_basicsize */
+    0,                          /* tp_itemsize */
+    /* methods */
+    (destructor)setexpr_dealloc, /* tp_dealloc */
+    0,                          /* tp_print */
+    0,                          /* tp_getattr */
+    0,                          /* tp_setattr */
+    0,                          /* tp_compare */
+    0,                          /* tp_repr */
+    &setexpr_as_number,         /* tp_as_number */
+    &setexpr_as_sequence,       /* tp_as_sequence */
+    &setexpr_as_mapping,        /* tp_as_mapping */
+    0,                          /* tp_hash */
+    0,                          /* tp_call */
+    0,                          /* tp_str */
+    PyObject_GenericGetAttr,    /* tp_getattro */
+    0,                          /* tp_setattro */
+    0,                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                          /* tp_doc */
+    (traverseproc)setexpr_traverse, /* tp_traverse */
+    (inquiry)setexpr_tp_clear,  /* tp_clear */
+    0,                          /* tp_richcompare */
+    0,                          /* tp_weaklistoffset */
+    (getiterfunc)setexpr_iter,  /* tp_iter */
+    0,                          /* tp_iternext */
+    setexpr_methods,            /* tp_methods */
+    0,
+};
+
+static PyObject *
+set_lazy(PyOrderedSetObject *self)
+{
+    return (PyObject *)make_set_expr(SET_EXPR_LEAF, self, NULL, NULL);
+}
+
+PyDoc_STRVAR(lazy_doc,
+"Return the set as a lazy expression.\n\
+\n\
+|, &, - and ^ on it build an expression over their operands instead of\n\
+new sets. `in` and iteration are answered from the operands directly;\n\
+len(), indexing and materialize() evaluate it once and cache the result\n\
+until an operand changes.");
+
+/***** Set view type ***************************************************/
+
+/* The keys of a set at positions sv_start, sv_start + sv_step, ..., sv_len
+ * of them, read through the set's own indices. Views hold no keys: any
+ * change to the set bumps its version and invalidates them, rather than
+ * letting them see shifted positions. */
+typedef struct {
+    PyObject_HEAD
+    PyOrderedSetObject *sv_set;
+    unsigned long sv_version;
+    Py_ssize_t sv_start;
+    Py_ssize_t sv_step;
+    Py_ssize_t sv_len;
+} setviewobject;
+
+static PyObject *
+make_set_view(PyOrderedSetObject *self, PyTypeObject *type, Py_ssize_t start, Py_ssize_t step,
+              Py_ssize_t len)
+{
+    setviewobject *sv = PyObject_GC_New(setviewobject, type);
+    if (sv == NULL)
+        return NULL;
+    Py_INCREF(self);
+    sv->sv_set = self;
+    sv->sv_version = self->version;
+    sv->sv_start = start;
+    sv->sv_step = step;
+    sv->sv_len = len;
+    PyObject_GC_Track(sv);
+    return (PyObject *)sv;
+}
+
+static void
+setview_dealloc(setviewobject *sv)
+{
+    PyObject_GC_UnTrack(sv);
+    Py_DECREF(sv->sv_set);
+    PyObject_GC_Del(sv);
+}
+
+/* A set may hold a view of itself. */
+static int
+setview_traverse(setviewobject *sv, visitproc visit, void *arg)
+{
+    Py_VISIT(sv->sv_set);
+    return 0;
+}
+
+static int
+setview_check(setviewobject *sv)
+{
+    if (sv->sv_version != sv->sv_set->version) {
+        PyErr_SetString(PyExc_RuntimeError, "Set changed after the view was taken");
+        return -1;
+    }
+    return 0;
+}
+
+static Py_ssize_t
+setview_len(setviewobject *sv)
+{
+    if (setview_check(sv) == -1)
+        return -1;
+    return sv->sv_len;
+}
+
+static PyObject *
+setview_item(setviewobject *sv, Py_ssize_t i)
+{
+    if (setview_check(sv) == -1)
+        return NULL;
+    if (i < 0 || i >= sv->sv_len) {
+        PyErr_SetString(PyExc_IndexError, "view index out of range");
+        return NULL;
+    }
+    return set_item(sv->sv_set, sv->sv_start + i * sv->sv_step);
+}
+
+/* Position of key in the view, -1 if it is not in the view or -2 on error.
+ * The set's hash index finds the key, its position then has to fall on
+ * the view's range and stride. */
+static Py_ssize_t
+setview_find(setviewobject *sv, PyObject *key)
+{
+    PyOrderedSetObject *so = sv->sv_set;
+    const ordered_set_entry *pos = NULL;
+
+    if (setview_check(sv) == -1)
+        return -2;
+    int found = set_find(so, key, &pos);
+    found = set_found_live(so, found, pos);
+    if (found == -1)
+        return -2;
+    if (found == 0)
+        return -1;
+    Py_ssize_t offset = (Py_ssize_t)so->oset.index_of(pos) - sv->sv_start;
+    if (offset % sv->sv_step != 0)
+        return -1;
+    Py_ssize_t i = offset / sv->sv_step;
+    return i >= 0 && i < sv->sv_len ? i : -1;
+}
+
+static int
+setview_contains(setviewobject *sv, PyObject *key)
+{
+    Py_ssize_t i = setview_find(sv, key);
+    if (i == -2)
+        return -1;
+    return i >= 0;
+}
+
+static PyObject *
+setview_index(setviewobject *sv, PyObject *key)
+{
+    Py_ssize_t i = setview_find(sv, key);
+    if (i == -2)
+        return NULL;
+    if (i >= 0)
+        return PyLong_FromSsize_t(i);
+    PyErr_SetString(PyExc_ValueError, "x is not in view");
+    return NULL;
+}
+
+PyDoc_STRVAR(view_index_doc,
+"Return index of value in the view.\n"
+"Raises ValueError if the value is not present.");
+
+static PyObject *
+setview_subscript(setviewobject *sv, PyObject *item)
 {
     if (PyIndex_Check(item)) {
         Py_ssize_t i;
@@ -1012,94 +3886,560 @@ set_subscript(PyOrderedSetObject* self, PyObject* item)
         if (i == -1 && PyErr_Occurred())
             return NULL;
         if (i < 0)
-            i += set_len(self);
-        return set_item(self, i);
+            i += sv->sv_len;
+        return setview_item(sv, i);
     }
     else if (PySlice_Check(item)) {
         Py_ssize_t start, stop, step, slicelength;
         int error;
+
+        if (setview_check(sv) == -1)
+            return NULL;
 #if PY_MAJOR_VERSION > 2
-        error = PySlice_GetIndicesEx(item, set_len(self),
+        error = PySlice_GetIndicesEx(item, sv->sv_len,
                                      &start, &stop, &step, &slicelength) < 0;
 #else
-        error = PySlice_GetIndicesEx((PySliceObject*)item, set_len(self),
+        error = PySlice_GetIndicesEx((PySliceObject*)item, sv->sv_len,
                                      &start, &stop, &step, &slicelength) < 0;
 #endif
+        if (error)
+            return NULL;
 
-        if (error) {
+        return make_set_view(sv->sv_set, Py_TYPE(sv), sv->sv_start + start * sv->sv_step,
+                             sv->sv_step * step, slicelength);
+    }
+    else {
+        PyErr_SetString(PyExc_TypeError, "indices must be integers");
+        return NULL;
+    }
+}
+
+static PyObject *
+setview_iter(setviewobject *sv)
+{
+    if (setview_check(sv) == -1)
+        return NULL;
+    return make_set_iter(sv->sv_set, &PyOrderedSetIter_Type, sv->sv_start,
+                         sv->sv_start + sv->sv_len * sv->sv_step, sv->sv_step);
+}
+
+static PyObject *
+setview_reversed(setviewobject *sv)
+{
+    if (setview_check(sv) == -1)
+        return NULL;
+    return make_set_iter(sv->sv_set, &PyOrderedSetRevIter_Type,
+                         sv->sv_start + (sv->sv_len - 1) * sv->sv_step,
+                         sv->sv_start - sv->sv_step, -sv->sv_step);
+}
+
+static PyObject *
+setview_tolist(setviewobject *sv)
+{
+    if (setview_check(sv) == -1)
+        return NULL;
+    ordered_set &set = sv->sv_set->oset;
+    PyObject *list = PyList_New(sv->sv_len);
+    if (list == NULL)
+        return NULL;
+    for (Py_ssize_t i = 0; i < sv->sv_len; i++) {
+        PyObject *key = set[sv->sv_start + i * sv->sv_step].key;
+        Py_INCREF(key);
+        PyList_SET_ITEM(list, i, key);
+    }
+    return list;
+}
+
+static PyObject *
+setview_copy(setviewobject *sv)
+{
+    if (setview_check(sv) == -1)
+        return NULL;
+    return set_copy_range(sv->sv_set, sv->sv_start, sv->sv_step, sv->sv_len);
+}
+
+PyDoc_STRVAR(view_copy_doc,
+"Return a new orderedset of the keys in the view, configured like the set.");
+
+static PyObject *
+setview_repr(setviewobject *sv)
+{
+    PyObject *keys, *result;
+
+    keys = setview_tolist(sv);
+    if (keys == NULL)
+        return NULL;
+#if PY_MAJOR_VERSION > 2
+    result = PyString_FromFormat("%s(%R)", Py_TYPE(sv)->tp_name, keys);
+#else
+    PyObject *listrepr = PyObject_Repr(keys);
+    result = listrepr == NULL ? NULL :
+        PyString_FromFormat("%s(%s)", Py_TYPE(sv)->tp_name, PyString_AS_STRING(listrepr));
+    Py_XDECREF(listrepr);
+#endif
+    Py_DECREF(keys);
+    return result;
+}
+
+static PyMethodDef setview_methods[] = {
+    {"__reversed__", (PyCFunction)setview_reversed, METH_NOARGS, reversed_doc},
+    {"copy", (PyCFunction)setview_copy, METH_NOARGS, view_copy_doc},
+    {"index", (PyCFunction)setview_index, METH_O, view_index_doc},
+    {"tolist", (PyCFunction)setview_tolist, METH_NOARGS, tolist_doc},
+    {NULL, NULL} /* sentinel */
+};
+
+static PySequenceMethods setview_as_sequence = {
+    (lenfunc)setview_len,       /* sq_length */
+    0,                          /* sq_concat */
+    0,                          /* sq_repeat */
+    (ssizeargfunc)setview_item, /* sq_item */
+    0,                          /* sq_slice */
+    0,                          /* sq_ass_item */
+    0,                          /* sq_ass_slice */
+    (objobjproc)setview_contains, /* sq_contains */
+};
+
+static PyMappingMethods setview_as_mapping = {
+    (lenfunc)setview_len,       /* mp_length */
+    (binaryfunc)setview_subscript, /* mp_subscript */
+    0,                          /* mp_ass_subscript */
+};
+
+static PyTypeObject PyOrderedSetView_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "orderedset_view",          /* tp_name */
+    sizeof(setviewobject),      /* tp_basicsize */
+    0,                          /* tp_itemsize */
+    /* methods */
+    (destructor)setview_dealloc, /* tp_dealloc */
+    0,                          /* tp_print */
+    0,                          /* tp_getattr */
+    0,                          /* tp_setattr */
+    0,                          /* tp_compare */
+    (reprfunc)setview_repr,     /* tp_repr */
+    0,                          /* tp_as_number */
+    &setview_as_sequence,       /* tp_as_sequence */
+    &setview_as_mapping,        /* tp_as_mapping */
+    0,                          /* tp_hash */
+    0,                          /* tp_call */
+    0,                          /* tp_str */
+    PyObject_GenericGetAttr,    /* tp_getattro */
+    0,                          /* tp_setattro */
+    0,                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                          /* tp_doc */
+    (traverseproc)setview_traverse, /* tp_traverse */
+    0,                          /* tp_clear */
+    0,                          /* tp_richcompare */
+    0,                          /* tp_weaklistoffset */
+    (getiterfunc)setview_iter,  /* tp_iter */
+    0,                          /* tp_iternext */
+    setview_methods,            /* tp_methods */
+    0,
+};
+
+static PyObject *
+set_remove(PyOrderedSetObject *self, PyObject *key)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_DISCARD);
+    int rv = set_discard_key(self, key);
+    if (rv == -1) {
+        if (!PyOrderedSet_Check(self) || !PyErr_ExceptionMatches(PyExc_TypeError))
             return NULL;
-        }
+        PyErr_Clear();
+    } else if (rv == 0) {
+        PyErr_SetString(PyExc_ValueError, "orderedset.remove(x): x not in set");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(remove_doc,
+"Remove an element from a set; it must be a member.\n\
+\n\
+Raises ValueError if the element is not a member.");
+
+static PyObject *
+set_discard(PyOrderedSetObject *self, PyObject *key)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_DISCARD);
+    int rv = set_discard_key(self, key);
+    if (rv == -1) {
+        if (!PyOrderedSet_Check(self) || !PyErr_ExceptionMatches(PyExc_TypeError))
+            return NULL;
+        PyErr_Clear();
+    }
+    Py_RETURN_NONE;
+}
 
-        if (slicelength <= 0) {
-            return make_new_set(Py_TYPE(self), NULL);
+PyDoc_STRVAR(discard_doc,
+"Remove an element from a set if it is a member.\n\
+\n\
+If the element is not a member, do nothing.");
+
+/***** Sorted index ****************************************************/
+
+static ordered_set_sorted *
+set_sorted_index(PyOrderedSetObject *self)
+{
+    // Sorted queries count positions too.
+    if (set_expire_now(self) == -1)
+        return NULL;
+    if (self->sorted != NULL)
+        return self->sorted;
+
+    ordered_set_sorted *sorted = new ordered_set_sorted();
+    ordered_set &set = self->oset;
+    for (ordered_set::iterator it = set.begin(); it != set.end(); it++) {
+        sorted->insert(sorted_set_entry(it->key));
+        if (PyErr_Occurred()) {
+            delete sorted;
+            return NULL;
         }
-        else {
-            PyOrderedSetObject *so = (PyOrderedSetObject *)make_new_set(Py_TYPE(self), NULL);
-            if (so == NULL)
-                return NULL;
+    }
+    self->sorted = sorted;
+    return sorted;
+}
+
+typedef struct {
+    PyObject_HEAD
+    PyOrderedSetObject *si_set; /* Set to NULL when iterator is exhausted */
+    unsigned long si_version;
+    ordered_set_sorted::iterator si_it;
+    ordered_set_sorted::iterator si_end;
+} sortediterobject;
+
+static void
+sortediter_dealloc(sortediterobject *si)
+{
+    typedef ordered_set_sorted::iterator iterator;
+    PyObject_GC_UnTrack(si);
+    si->si_it.~iterator();
+    si->si_end.~iterator();
+    Py_XDECREF(si->si_set);
+    PyObject_GC_Del(si);
+}
+
+/* A set may hold an iterator over its own sorted index. */
+static int
+sortediter_traverse(sortediterobject *si, visitproc visit, void *arg)
+{
+    Py_VISIT(si->si_set);
+    return 0;
+}
+
+static PyObject *
+sortediter_len(sortediterobject *si)
+{
+    Py_ssize_t len = 0;
+    PyOrderedSetObject *so = si->si_set;
+    if (so != NULL && si->si_version == so->version)
+        len = so->sorted->rank(si->si_end) - so->sorted->rank(si->si_it);
+    return PyLong_FromSsize_t(len);
+}
+
+static PyMethodDef sortediter_methods[] = {
+    {"__length_hint__", (PyCFunction)sortediter_len, METH_NOARGS, length_hint_doc},
+    {NULL, NULL} /* sentinel */
+};
+
+static PyObject *
+sortediter_iternext(sortediterobject *si)
+{
+    PyObject *key;
+    PyOrderedSetObject *so = si->si_set;
+
+    if (so == NULL)
+        return NULL;
+    if (si->si_version != so->version) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Set changed during iteration");
+        Py_DECREF(so);
+        si->si_set = NULL; /* Make this state sticky */
+        return NULL;
+    }
+    if (si->si_it == si->si_end) {
+        Py_DECREF(so);
+        si->si_set = NULL;
+        return NULL;
+    }
+
+    key = si->si_it->key;
+    ++si->si_it;
+    Py_INCREF(key);
+    return key;
+}
+
+static PyTypeObject PyOrderedSetSortedIter_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "orderedsetsortediterator", /* tp_name */
+    sizeof(sortediterobject),   /* tp_basicsize */
+    0,                          /* tp_itemsize */
+    /* methods */
+    (destructor)sortediter_dealloc, /* tp_dealloc */
+    0,                          /* tp_print */
+    0,                          /* tp_getattr */
+    0,                          /* tp_setattr */
+    0,                          /* tp_compare */
+    0,                          /* tp_repr */
+    0,                          /* tp_as_number */
+    0,                          /* tp_as_sequence */
+    0,                          /* tp_as_mapping */
+    0,                          /* tp_hash */
+    0,                          /* tp_call */
+    0,                          /* tp_str */
+    PyObject_GenericGetAttr,    /* tp_getattro */
+    0,                          /* tp_setattro */
+    0,                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                          /* tp_doc */
+    (traverseproc)sortediter_traverse, /* tp_traverse */
+    0,                          /* tp_clear */
+    0,                          /* tp_richcompare */
+    0,                          /* tp_weaklistoffset */
+    PyObject_SelfIter,          /* tp_iter */
+    (iternextfunc)sortediter_iternext, /* tp_iternext */
+    sortediter_methods,         /* tp_methods */
+    0,
+};
+
+static PyObject *
+make_sorted_iter(PyOrderedSetObject *self,
+                 ordered_set_sorted::iterator first,
+                 ordered_set_sorted::iterator last)
+{
+    sortediterobject *si = PyObject_GC_New(sortediterobject, &PyOrderedSetSortedIter_Type);
+    if (si == NULL)
+        return NULL;
+    Py_INCREF(self);
+    si->si_set = self;
+    si->si_version = self->version;
+    new (&si->si_it) ordered_set_sorted::iterator(first);
+    new (&si->si_end) ordered_set_sorted::iterator(last);
+    PyObject_GC_Track(si);
+    return (PyObject *)si;
+}
+
+static PyObject *
+set_sorted_iter(PyOrderedSetObject *self)
+{
+    ordered_set_sorted *sorted = set_sorted_index(self);
+    if (sorted == NULL)
+        return NULL;
+    return make_sorted_iter(self, sorted->begin(), sorted->end());
+}
+
+PyDoc_STRVAR(sorted_iter_doc,
+"Return an iterator over the elements in ascending order.\n\
+\n\
+The first sorted query builds a sorted index, which is then kept up to\n\
+date by every insertion and removal. Elements must be mutually orderable.");
+
+static PyObject *
+set_irange(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs,
+           PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"lo", "hi", NULL};
+    PyObject *slots[] = {Py_None, Py_None};
+    ordered_set_sorted *sorted;
+
+    if (set_parse_keywords("irange", kwlist, 0, args, nargs, kwnames, slots) == -1)
+        return NULL;
+    PyObject *lo = slots[0], *hi = slots[1];
+    sorted = set_sorted_index(self);
+    if (sorted == NULL)
+        return NULL;
+
+    ordered_set_sorted::iterator first = sorted->begin(), last = sorted->end();
+    if (lo != Py_None)
+        first = sorted->lower_bound(sorted_set_entry(lo));
+    if (hi != Py_None)
+        last = sorted->upper_bound(sorted_set_entry(hi));
+    if (PyErr_Occurred())
+        return NULL;
+    if (sorted->rank(first) > sorted->rank(last))
+        first = last;
+    return make_sorted_iter(self, first, last);
+}
+
+SET_FASTCALL_KEYWORDS_ADAPTER(set_irange)
+
+PyDoc_STRVAR(irange_doc,
+"irange(lo=None, hi=None) -> iterator\n\
+\n\
+Iterate in ascending order over the elements x with lo <= x <= hi.\n\
+A bound of None leaves that side open.");
+
+static PyObject *
+set_bisect(PyOrderedSetObject *self, PyObject *key, bool right)
+{
+    ordered_set_sorted *sorted = set_sorted_index(self);
+    if (sorted == NULL)
+        return NULL;
+
+    ordered_set_sorted::iterator it = right ?
+        sorted->upper_bound(sorted_set_entry(key)) :
+        sorted->lower_bound(sorted_set_entry(key));
+    if (PyErr_Occurred())
+        return NULL;
+    return PyLong_FromSize_t(sorted->rank(it));
+}
+
+static PyObject *
+set_bisect_left(PyOrderedSetObject *self, PyObject *key)
+{
+    return set_bisect(self, key, false);
+}
+
+PyDoc_STRVAR(bisect_left_doc,
+"Return the number of elements less than value.\n\
+\n\
+This is where value would be inserted in sorted order, before any\n\
+element equal to it.");
+
+static PyObject *
+set_bisect_right(PyOrderedSetObject *self, PyObject *key)
+{
+    return set_bisect(self, key, true);
+}
 
-            ordered_set_by_key &set = self->oset.get<key_index>();
-            ordered_set_by_key::iterator it;
-            for (it = set.begin() + start; it < set.begin() + stop; it += step) {
-                ordered_set::value_type entry = *it;
-                set_add_key(so, entry.key);
-            }
+PyDoc_STRVAR(bisect_right_doc,
+"Return the number of elements less than or equal to value.");
 
-            return (PyObject *)so;
-        }
-    }
-    else {
-        PyErr_SetString(PyExc_TypeError, "indices must be integers");
+static PyObject *
+set_rank(PyOrderedSetObject *self, PyObject *key)
+{
+    int rv = set_contains(self, key);
+    if (rv == -1)
+        return NULL;
+    if (rv == 0) {
+        PyErr_SetString(PyExc_ValueError, "x is not in set");
         return NULL;
     }
+    return set_bisect(self, key, false);
 }
 
+PyDoc_STRVAR(rank_doc,
+"Return the position of value in sorted order.\n\
+Raises ValueError if the value is not present.");
+
 static PyObject *
-set_remove(PyOrderedSetObject *self, PyObject *key)
+set_contains_key(PyOrderedSetObject *self, PyObject *key)
 {
-    int rv = set_discard_key(self, key);
-    if (rv == -1) {
-        if (!PyOrderedSet_Check(self) || !PyErr_ExceptionMatches(PyExc_TypeError))
-            return NULL;
-        PyErr_Clear();
-    } else if (rv == 0) {
-        PyErr_SetString(PyExc_ValueError, "orderedset.remove(x): x not in set");
+    const ordered_set_entry *pos = NULL;
+
+    int rv = set_find_as(self, key, true, &pos);
+    rv = set_found_live(self, rv, pos);
+    if (rv == -1)
+        return NULL;
+    return PyBool_FromLong(rv);
+}
+
+PyDoc_STRVAR(contains_key_doc,
+"Report whether an element with the given key is in the set.\n\
+\n\
+The key is compared as is, without passing it through the key function.");
+
+static PyObject *
+set_discard_key_method(PyOrderedSetObject *self, PyObject *key)
+{
+    ORDEREDSET_TIME(PyOrderedSet_OP_DISCARD);
+    if (set_discard_as(self, key, true) == -1)
         return NULL;
-    }
     Py_RETURN_NONE;
 }
 
-PyDoc_STRVAR(remove_doc,
-"Remove an element from a set; it must be a member.\n\
+PyDoc_STRVAR(discard_key_doc,
+"Remove the element with the given key if present.");
+
+static PyObject *
+set_get(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    PyObject *key, *failobj = Py_None;
+    const ordered_set_entry *pos = NULL;
+
+    if (set_check_nargs("get", nargs, 1, 2) == -1)
+        return NULL;
+    key = args[0];
+    if (nargs > 1)
+        failobj = args[1];
+    int rv = set_find_as(self, key, true, &pos);
+    rv = set_found_live(self, rv, pos);
+    if (rv == -1)
+        return NULL;
+    if (rv == 1)
+        failobj = pos->key;
+    Py_INCREF(failobj);
+    return failobj;
+}
+
+SET_FASTCALL_ADAPTER(set_get)
+
+PyDoc_STRVAR(get_doc,
+"Return the element with the given key if present, else default.\n\
 \n\
-Raises ValueError if the element is not a member.");
+S.get(key[, default]); the key is not passed through the key function.");
 
 static PyObject *
-set_discard(PyOrderedSetObject *self, PyObject *key)
+set_expire(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-    int rv = set_discard_key(self, key);
-    if (rv == -1) {
-        if (!PyOrderedSet_Check(self) || !PyErr_ExceptionMatches(PyExc_TypeError))
+    PyObject *nowobj = Py_None;
+    double now;
+
+    if (set_check_nargs("expire", nargs, 0, 1) == -1)
+        return NULL;
+    if (nargs > 0)
+        nowobj = args[0];
+    if (self->ttl < 0.0) {
+        PyErr_SetString(PyExc_ValueError, "set has no ttl");
+        return NULL;
+    }
+    if (nowobj == Py_None) {
+        if (set_now(self, &now) == -1)
             return NULL;
-        PyErr_Clear();
     }
-    Py_RETURN_NONE;
+    else {
+        now = PyFloat_AsDouble(nowobj);
+        if (now == -1.0 && PyErr_Occurred())
+            return NULL;
+    }
+    return PyLong_FromSsize_t(set_expire_internal(self, now, true));
 }
 
-PyDoc_STRVAR(discard_doc,
-"Remove an element from a set if it is a member.\n\
+SET_FASTCALL_ADAPTER(set_expire)
+
+PyDoc_STRVAR(expire_doc,
+"Remove keys whose ttl has run out and return how many were removed.\n\
 \n\
-If the element is not a member, do nothing.");
+now defaults to the current time of the set's clock.");
 
 static PyObject *
 set_reduce(PyOrderedSetObject *self)
 {
     PyObject *keys = NULL, *args = NULL, *result = NULL, *dict = NULL;
 
-    keys = PySequence_List((PyObject *)self);
+    keys = set_tolist(self);
     if (keys == NULL)
         goto done;
-    args = PyTuple_Pack(1, keys);
+    if (self->maxlen >= 0 || self->ttl >= 0.0 || self->keyfunc != NULL || self->bloom != NULL) {
+        PyObject *maxlen = self->maxlen >= 0 ? PyLong_FromSsize_t(self->maxlen) : Py_None;
+        PyObject *ttl = self->ttl >= 0.0 ? PyFloat_FromDouble(self->ttl) : Py_None;
+        PyObject *clock = self->clock != NULL ? self->clock : Py_None;
+        PyObject *keyfunc = self->keyfunc != NULL ? self->keyfunc : Py_None;
+
+        if (maxlen == Py_None)
+            Py_INCREF(maxlen);
+        if (ttl == Py_None)
+            Py_INCREF(ttl);
+        if (maxlen != NULL && ttl != NULL)
+            args = Py_BuildValue("(OOiOOOi)", keys, maxlen, self->touch, ttl, clock, keyfunc,
+                                 self->bloom != NULL);
+        Py_XDECREF(maxlen);
+        Py_XDECREF(ttl);
+    }
+    else
+        args = PyTuple_Pack(1, keys);
     if (args == NULL)
         goto done;
     dict = PyObject_GetAttrString((PyObject *)self, "__dict__");
@@ -1118,49 +4458,239 @@ done:
 
 PyDoc_STRVAR(reduce_doc, "Return state information for pickling.");
 
+static PyObject *
+set_sizeof(PyOrderedSetObject *self)
+{
+    ordered_set::arena_type *arena = self->oset.get_arena();
+    Py_ssize_t res;
+
+    res = Py_TYPE(self)->tp_basicsize + sizeof(*arena);
+    res += arena->reserved() + arena->large();
+    if (self->bloom != NULL)
+        res += sizeof(*self->bloom) + self->bloom->nbytes();
+    if (self->changelog != NULL)
+        res += sizeof(*self->changelog) +
+            self->changelog->changes.size() * sizeof(ordered_set_change);
+    return PyLong_FromSsize_t(res);
+}
+
+PyDoc_STRVAR(sizeof_doc, "S.__sizeof__() -> size of S in memory, in bytes");
+
 static int
-set_init(PyOrderedSetObject *self, PyObject *args, PyObject *kwds)
+stats_add(PyObject *dict, const char *name, PyObject *value)
 {
-    PyObject *iterable = NULL;
+    int rv;
 
-    if (!PyOrderedSet_Check(self))
+    if (value == NULL)
         return -1;
-    if (!PyArg_UnpackTuple(args, Py_TYPE(self)->tp_name, 0, 1, &iterable))
+    rv = PyDict_SetItemString(dict, name, value);
+    Py_DECREF(value);
+    return rv;
+}
+
+static PyObject *
+set_stats(PyOrderedSetObject *self)
+{
+    ordered_set::arena_type *arena = self->oset.get_arena();
+    ordered_set &set = self->oset;
+    ordered_set::size_type nbuckets = set.bucket_count();
+    ordered_set::size_type used, longest;
+    PyObject *stats, *bytes;
+
+    set.chain_stats(used, longest);
+
+    bytes = PyDict_New();
+    if (bytes == NULL)
+        return NULL;
+    if (stats_add(bytes, "nodes", PyLong_FromSize_t(arena->used())) < 0 ||
+        stats_add(bytes, "free_nodes",
+                  PyLong_FromSize_t(arena->reserved() - arena->used())) < 0 ||
+        stats_add(bytes, "buckets", PyLong_FromSize_t(set.bucket_bytes())) < 0 ||
+        stats_add(bytes, "order", PyLong_FromSize_t(set.order_bytes())) < 0 ||
+        (self->bloom != NULL &&
+         stats_add(bytes, "bloom", PyLong_FromSize_t(self->bloom->nbytes())) < 0)) {
+        Py_DECREF(bytes);
+        return NULL;
+    }
+
+    stats = PyDict_New();
+    if (stats == NULL) {
+        Py_DECREF(bytes);
+        return NULL;
+    }
+    if (stats_add(stats, "size", PyLong_FromSize_t(set.size())) < 0 ||
+        stats_add(stats, "capacity", PyLong_FromSize_t(set.capacity())) < 0 ||
+        stats_add(stats, "bucket_count", PyLong_FromSize_t(nbuckets)) < 0 ||
+        stats_add(stats, "load_factor", PyFloat_FromDouble(set.load_factor())) < 0 ||
+        stats_add(stats, "max_load_factor",
+                  PyFloat_FromDouble(set.max_load_factor())) < 0 ||
+        stats_add(stats, "max_chain", PyLong_FromSize_t(longest)) < 0 ||
+        stats_add(stats, "mean_chain",
+                  PyFloat_FromDouble(used ? (double)set.size() / used : 0.0)) < 0 ||
+        stats_add(stats, "arena_blocks", PyLong_FromSize_t(arena->nblocks())) < 0) {
+        Py_DECREF(bytes);
+        Py_DECREF(stats);
+        return NULL;
+    }
+    // stats_add() consumes bytes, whether it fails or not.
+    if (stats_add(stats, "bytes", bytes) < 0) {
+        Py_DECREF(stats);
+        return NULL;
+    }
+    return stats;
+}
+
+PyDoc_STRVAR(stats_doc,
+"Return a dict describing the memory layout of the set.\n\
+\n\
+It reports the element count, the pointer slots held by the leaves of the\n\
+order, bucket count, load factor, the longest and mean chain among occupied\n\
+buckets and the bytes held by nodes, free node slots, buckets and the order.");
+
+static int
+set_init_fastcall(PyOrderedSetObject *self, PyObject *const *args, Py_ssize_t nargs,
+                  PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"iterable", "maxlen", "touch", "ttl", "clock", "key",
+                                         "bloom", NULL};
+    // iterable, maxlen, touch, ttl, clock, key, bloom
+    PyObject *slots[] = {NULL, Py_None, NULL, Py_None, Py_None, Py_None, NULL};
+    PyObject *iterable, *clock, *keyfunc;
+    Py_ssize_t maxlen = -1;
+    int touch = 0, bloom = 0;
+    double ttl = -1.0;
+
+    if (!PyOrderedSet_Check(self))
         return -1;
+    // A fresh container only needs emptying when __init__ is called again.
+    if (set_len(self) > 0)
+        set_clear_internal(self);
+    if (kwnames == NULL && nargs <= 1 && self->maxlen < 0 && !self->touch &&
+        self->ttl < 0.0 && self->clock == NULL && self->keyfunc == NULL &&
+        self->bloom == NULL) {
+        // orderedset() and orderedset(iterable) on a set with no settings
+        // to reset, nothing to parse or validate.
+        if (nargs == 0)
+            return 0;
+        return set_update_internal(self, args[0]);
+    }
 
-    ordered_set::ctor_args_list args_list = boost::make_tuple(
-        ordered_set_by_key::ctor_args(),
-        ordered_set_by_hash::ctor_args());
-    ordered_set set(args_list);
-    self->oset = set;
+    if (set_parse_keywords("orderedset", kwlist, 0, args, nargs, kwnames, slots) == -1)
+        return -1;
+    iterable = slots[0];
+    clock = slots[4];
+    keyfunc = slots[5];
+    if ((slots[2] != NULL && set_arg_flag(slots[2], &touch) == -1) ||
+        (slots[6] != NULL && set_arg_flag(slots[6], &bloom) == -1))
+        return -1;
+    if (slots[1] != Py_None) {
+        if (set_arg_ssize(slots[1], &maxlen) == -1)
+            return -1;
+        if (maxlen < 0) {
+            PyErr_SetString(PyExc_ValueError, "maxlen must be non-negative");
+            return -1;
+        }
+    }
+    if (slots[3] != Py_None) {
+        ttl = PyFloat_AsDouble(slots[3]);
+        if (ttl == -1.0 && PyErr_Occurred())
+            return -1;
+        if (ttl < 0.0) {
+            PyErr_SetString(PyExc_ValueError, "ttl must be non-negative");
+            return -1;
+        }
+        if (touch) {
+            // Touched keys would be moved behind younger ones.
+            PyErr_SetString(PyExc_ValueError, "touch cannot be combined with ttl");
+            return -1;
+        }
+    }
+    if (clock == Py_None)
+        clock = NULL;
+    else if (!PyCallable_Check(clock)) {
+        PyErr_SetString(PyExc_TypeError, "clock must be callable");
+        return -1;
+    }
+    if (keyfunc == Py_None)
+        keyfunc = NULL;
+    else if (!PyCallable_Check(keyfunc)) {
+        PyErr_SetString(PyExc_TypeError, "key must be callable");
+        return -1;
+    }
 
-    set_clear_internal(self);
+    if (bloom && self->bloom == NULL)
+        self->bloom = new ordered_set_bloom(0);
+    else if (!bloom) {
+        delete self->bloom;
+        self->bloom = NULL;
+    }
+    self->maxlen = maxlen;
+    self->touch = touch;
+    self->ttl = ttl;
+    Py_XINCREF(clock);
+    Py_XDECREF(self->clock);
+    self->clock = clock;
+    Py_XINCREF(keyfunc);
+    Py_XDECREF(self->keyfunc);
+    self->keyfunc = keyfunc;
     if (iterable == NULL)
         return 0;
     return set_update_internal(self, iterable);
 }
 
+static int
+set_init(PyOrderedSetObject *self, PyObject *args, PyObject *kwds)
+{
+    std::vector<PyObject *> stack;
+    PyObject *kwnames;
+    int rv;
+
+    if (set_keywords_to_stack(args, kwds, stack, &kwnames) == -1)
+        return -1;
+    rv = set_init_fastcall(self, stack.data(), PyTuple_GET_SIZE(args), kwnames);
+    Py_XDECREF(kwnames);
+    return rv;
+}
+
+#if PY_VERSION_HEX >= 0x03090000
+/* orderedset(...) without a tuple and a dict for the arguments. Subclasses
+ * do not inherit tp_vectorcall and go through set_new and set_init. */
+static PyObject *
+set_vectorcall(PyObject *type, PyObject *const *args, size_t nargsf, PyObject *kwnames)
+{
+    PyObject *so = make_new_set((PyTypeObject *)type, NULL);
+    if (so == NULL)
+        return NULL;
+    if (set_init_fastcall((PyOrderedSetObject *)so, args, PyVectorcall_NARGS(nargsf),
+                          kwnames) == -1) {
+        Py_DECREF(so);
+        return NULL;
+    }
+    return so;
+}
+#endif
+
 #if PY_MAJOR_VERSION > 2
 static PySequenceMethods set_as_sequence = {
-    (lenfunc)set_len,           /* sq_length */
+    (lenfunc)set_sq_length,     /* sq_length */
     0,                          /* sq_concat */
     0,                          /* sq_repeat */
     (ssizeargfunc)set_item,     /* sq_item */
     0,                          /* sq_slice */
     (ssizeobjargproc)set_ass_item, /* sq_ass_item */
     0,                          /* sq_ass_slice */
-    (objobjproc)set_contains,   /* sq_contains */
+    (objobjproc)set_sq_contains, /* sq_contains */
 };
 #else
 static PySequenceMethods set_as_sequence = {
-    (lenfunc)set_len,           /* sq_length */
+    (lenfunc)set_sq_length,     /* sq_length */
     0,                          /* sq_concat */
     0,                          /* sq_repeat */
     (ssizeargfunc)set_item,     /* sq_item */
     (ssizessizeargfunc)set_slice, /* sq_slice */
     (ssizeobjargproc)set_ass_item, /* sq_ass_item */
     (ssizessizeobjargproc)set_ass_slice, /* sq_ass_slice */
-    (objobjproc)set_contains,   /* sq_contains */
+    (objobjproc)set_sq_contains, /* sq_contains */
 };
 #endif
 
@@ -1168,26 +4698,125 @@ static PySequenceMethods set_as_sequence = {
 
 static PyMethodDef orderedset_methods[] = {
     {"add", (PyCFunction)set_add, METH_O, add_doc},
+    {"apply_delta", (PyCFunction)set_apply_delta, METH_O, apply_delta_doc},
+    {"bisect_left", (PyCFunction)set_bisect_left, METH_O, bisect_left_doc},
+    {"bisect_right", (PyCFunction)set_bisect_right, METH_O, bisect_right_doc},
     {"clear", (PyCFunction)set_clear, METH_NOARGS, clear_doc},
+    {"compact", (PyCFunction)set_compact, METH_NOARGS, compact_doc},
+    {"contains_key", (PyCFunction)set_contains_key, METH_O, contains_key_doc},
     {"copy", (PyCFunction)set_copy, METH_NOARGS, copy_doc},
+    {"delta_since", (PyCFunction)set_delta_since, METH_O, delta_since_doc},
+    {"diff", (PyCFunction)set_diff, METH_O, diff_doc},
     {"discard", (PyCFunction)set_discard, METH_O, discard_doc},
-    {"difference", (PyCFunction)set_difference, METH_O, difference_doc},
-    {"difference_update", (PyCFunction)set_difference_update, METH_O, difference_update_doc},
+    {"discard_key", (PyCFunction)set_discard_key_method, METH_O, discard_key_doc},
+    {"difference", SET_FASTCALL(set_difference), difference_doc},
+    {"difference_update", SET_FASTCALL(set_difference_update), difference_update_doc},
+    {"equals_unordered", (PyCFunction)set_equals_unordered, METH_O, equals_unordered_doc},
+    {"expire", SET_FASTCALL(set_expire), expire_doc},
+    {"get", SET_FASTCALL(set_get), get_doc},
     {"index", (PyCFunction)set_index, METH_O, index_doc},
-    {"intersection",(PyCFunction)set_intersection, METH_O, intersection_doc},
-    {"intersection_update",(PyCFunction)set_intersection_update, METH_O, intersection_update_doc},
+    {"insert", SET_FASTCALL(set_insert), insert_doc},
+    {"intersection", SET_FASTCALL(set_intersection), intersection_doc},
+    {"intersection_update", SET_FASTCALL(set_intersection_update), intersection_update_doc},
+    {"irange", SET_FASTCALL_KEYWORDS(set_irange), irange_doc},
+    {"isdisjoint", (PyCFunction)set_isdisjoint, METH_O, isdisjoint_doc},
     {"issubset", (PyCFunction)set_issubset, METH_O, issubset_doc},
     {"issuperset", (PyCFunction)set_issuperset, METH_O, issuperset_doc},
-    {"pop", (PyCFunction)set_pop, METH_VARARGS, pop_doc},
+    {"lazy", (PyCFunction)set_lazy, METH_NOARGS, lazy_doc},
+    {"move", SET_FASTCALL(set_move), move_doc},
+    {"move_to_end", SET_FASTCALL_KEYWORDS(set_move_to_end), move_to_end_doc},
+    {"pop", SET_FASTCALL(set_pop), pop_doc},
+    {"rank", (PyCFunction)set_rank, METH_O, rank_doc},
     {"__reduce__", (PyCFunction)set_reduce, METH_NOARGS, reduce_doc},
+    {"__reversed__", (PyCFunction)set_reversed, METH_NOARGS, reversed_doc},
+    {"__sizeof__", (PyCFunction)set_sizeof, METH_NOARGS, sizeof_doc},
     {"remove", (PyCFunction)set_remove, METH_O, remove_doc},
+    {"reserve", (PyCFunction)set_reserve, METH_O, reserve_doc},
+    {"reverse", (PyCFunction)set_reverse, METH_NOARGS, reverse_doc},
+    {"shuffle", SET_FASTCALL(set_shuffle), shuffle_doc},
+    {"sort", SET_FASTCALL_KEYWORDS(set_sort), sort_doc},
+    {"sorted_iter", (PyCFunction)set_sorted_iter, METH_NOARGS, sorted_iter_doc},
+    {"stats", (PyCFunction)set_stats, METH_NOARGS, stats_doc},
     {"symmetric_difference",(PyCFunction)set_symmetric_difference, METH_O, symmetric_difference_doc},
     {"symmetric_difference_update",(PyCFunction)set_symmetric_difference_update, METH_O, symmetric_difference_update_doc},
-    {"union", (PyCFunction)set_union, METH_O, union_doc},
-    {"update", (PyCFunction)set_update, METH_O, update_doc},
+    {"tolist", (PyCFunction)set_tolist, METH_NOARGS, tolist_doc},
+    {"track_changes", SET_FASTCALL_KEYWORDS(set_track_changes), track_changes_doc},
+    {"union", SET_FASTCALL(set_union), union_doc},
+    {"update", SET_FASTCALL(set_update), update_doc},
     {NULL, NULL} /* sentinel */
 };
 
+static PyObject *
+set_get_shrink_ratio(PyOrderedSetObject *self, void *closure)
+{
+    return PyFloat_FromDouble(self->shrink_ratio);
+}
+
+static int
+set_set_shrink_ratio(PyOrderedSetObject *self, PyObject *value, void *closure)
+{
+    double ratio;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "cannot delete shrink_ratio");
+        return -1;
+    }
+    ratio = PyFloat_AsDouble(value);
+    if (ratio == -1.0 && PyErr_Occurred())
+        return -1;
+    // Anything above one half would compact again right after growing.
+    if (ratio < 0.0 || ratio > 0.5) {
+        PyErr_SetString(PyExc_ValueError, "shrink_ratio must be between 0 and 0.5");
+        return -1;
+    }
+    self->shrink_ratio = ratio;
+    return 0;
+}
+
+static PyObject *
+set_get_bloom(PyOrderedSetObject *self, void *closure)
+{
+    return PyBool_FromLong(self->bloom != NULL);
+}
+
+static PyObject *
+set_get_maxlen(PyOrderedSetObject *self, void *closure)
+{
+    if (self->maxlen < 0)
+        Py_RETURN_NONE;
+    return PyLong_FromSsize_t(self->maxlen);
+}
+
+static PyObject *
+set_get_ttl(PyOrderedSetObject *self, void *closure)
+{
+    if (self->ttl < 0.0)
+        Py_RETURN_NONE;
+    return PyFloat_FromDouble(self->ttl);
+}
+
+static PyObject *
+set_get_view(PyOrderedSetObject *self, void *closure)
+{
+    if (set_expire_now(self) == -1)
+        return NULL;
+    return make_set_view(self, &PyOrderedSetView_Type, 0, 1, self->oset.size());
+}
+
+static PyGetSetDef orderedset_getsets[] = {
+    {(char *)"bloom", (getter)set_get_bloom, NULL,
+     (char *)"Whether misses are screened by a Bloom summary of the keys.", NULL},
+    {(char *)"maxlen", (getter)set_get_maxlen, NULL,
+     (char *)"Maximum size of a bounded set, or None if unbounded.", NULL},
+    {(char *)"shrink_ratio", (getter)set_get_shrink_ratio, (setter)set_set_shrink_ratio,
+     (char *)"Fraction of capacity below which the set compacts itself (0 disables).", NULL},
+    {(char *)"ttl", (getter)set_get_ttl, NULL,
+     (char *)"Seconds a key lives after being added, or None.", NULL},
+    {(char *)"view", (getter)set_get_view, NULL,
+     (char *)"A view of the set, sliced as view[i:j:k] without copying keys.", NULL},
+    {NULL} /* sentinel */
+};
+
 #if PY_MAJOR_VERSION > 2
 static PyNumberMethods set_as_number = {
     0,                          /* nb_add */
@@ -1260,19 +4889,35 @@ static PyNumberMethods set_as_number = {
 #endif
 
 static PyMappingMethods set_as_mapping = {
-    (lenfunc)set_len,           /* mp_length */
+    (lenfunc)set_sq_length,     /* mp_length */
     (binaryfunc)set_subscript,  /* mp_subscript */
-    0                           /* mp_ass_subscript */
+    (objobjargproc)set_ass_subscript, /* mp_ass_subscript */
 };
 
 PyDoc_STRVAR(orderedset_doc,
-"orderedset(iterable) --> orderedset object\n\
+"orderedset(iterable, maxlen=None, touch=False, ttl=None, clock=None, key=None,\n\
+           bloom=False) --> orderedset object\n\
+\n\
+Build an ordered collection of unique elements.\n\
 \n\
-Build an ordered collection of unique elements.");
+With key, elements are unique by key(element), computed once per element\n\
+and kept next to it; contains_key(), discard_key() and get() take keys.\n\
+\n\
+With maxlen, adding a new key to a full set evicts the oldest key. With\n\
+touch, keys found again by add() or `in` move to the end, so the least\n\
+recently used key is evicted.\n\
+\n\
+With ttl, keys expire ttl seconds after they were added, as read from\n\
+clock() or time.monotonic() by default. Expired keys are hidden from add()\n\
+and `in` at once and removed from the front of the set in batches. len(),\n\
+iteration, indexing, comparisons and copies remove them first.\n\
+\n\
+With bloom, a Bloom filter of one to four bytes per key answers most\n\
+lookups of absent keys without touching the hash table.");
 
 PyTypeObject PyOrderedSet_Type = {
     PyVarObject_HEAD_INIT(&PyType_Type, 0)
-    "orderedset.orderedset",    /* tp_name */
+    "bcse.collections.orderedset", /* tp_name */
     sizeof(PyOrderedSetObject), /* tp_basicsize */
     0,                          /* tp_itemsize */
     /* methods */
@@ -1294,14 +4939,14 @@ PyTypeObject PyOrderedSet_Type = {
     Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
     orderedset_doc,             /* tp_doc */
     (traverseproc)set_traverse, /* tp_traverse */
-    (inquiry)set_clear_internal, /* tp_clear */
+    (inquiry)set_tp_clear,      /* tp_clear */
     (richcmpfunc)set_richcompare, /* tp_richcompare */
     0,                          /* tp_weaklistoffset */
     (getiterfunc)set_iter,      /* tp_iter */
     0,                          /* tp_iternext */
     orderedset_methods,         /* tp_methods */
     0,                          /* tp_members */
-    0,                          /* tp_getset */
+    orderedset_getsets,         /* tp_getset */
     0,                          /* tp_base */
     0,                          /* tp_dict */
     0,                          /* tp_descr_get */
@@ -1311,4 +4956,237 @@ PyTypeObject PyOrderedSet_Type = {
     PyType_GenericAlloc,        /* tp_alloc */
     set_new,                    /* tp_new */
     PyObject_GC_Del,            /* tp_free */
+#if PY_VERSION_HEX >= 0x03090000
+    0,                          /* tp_is_gc */
+    0,                          /* tp_bases */
+    0,                          /* tp_mro */
+    0,                          /* tp_cache */
+    0,                          /* tp_subclasses */
+    0,                          /* tp_weaklist */
+    0,                          /* tp_del */
+    0,                          /* tp_version_tag */
+    0,                          /* tp_finalize */
+    set_vectorcall,             /* tp_vectorcall */
+#endif
+};
+
+/***** unique() iterator ***************************************************/
+
+/* Approximate bytes a seen key takes up in the index: the node, its bucket
+ * and its slot in a leaf of the order. */
+#define PyOrderedSet_ENTRY_BYTES (sizeof(ordered_set_entry) + 5 * sizeof(void *))
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *it;
+    PyObject *key;              /* NULL for the identity */
+    PyOrderedSetObject *seen;
+} uniqueobject;
+
+static PyObject *
+unique_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = {"iterable", "key", "maxmemory", NULL};
+    PyObject *iterable, *key = Py_None, *maxmemory = Py_None;
+    uniqueobject *uo;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OO:unique", (char **)kwlist,
+                                     &iterable, &key, &maxmemory))
+        return NULL;
+
+    uo = (uniqueobject *)type->tp_alloc(type, 0);
+    if (uo == NULL)
+        return NULL;
+    uo->it = PyObject_GetIter(iterable);
+    if (uo->it == NULL)
+        goto error;
+    if (key != Py_None) {
+        Py_INCREF(key);
+        uo->key = key;
+    }
+    uo->seen = (PyOrderedSetObject *)make_new_set(&PyOrderedSet_Type, NULL);
+    if (uo->seen == NULL)
+        goto error;
+    if (maxmemory != Py_None) {
+        Py_ssize_t bytes = PyNumber_AsSsize_t(maxmemory, PyExc_OverflowError);
+        if (bytes == -1 && PyErr_Occurred())
+            goto error;
+        if (bytes <= 0) {
+            PyErr_SetString(PyExc_ValueError, "maxmemory must be positive");
+            goto error;
+        }
+        // Remember as many of the most recent keys as fit.
+        uo->seen->maxlen = bytes / PyOrderedSet_ENTRY_BYTES;
+        if (uo->seen->maxlen < 1)
+            uo->seen->maxlen = 1;
+    }
+    return (PyObject *)uo;
+
+error:
+    Py_DECREF(uo);
+    return NULL;
+}
+
+static void
+unique_dealloc(uniqueobject *uo)
+{
+    PyObject_GC_UnTrack(uo);
+    Py_XDECREF(uo->it);
+    Py_XDECREF(uo->key);
+    Py_XDECREF(uo->seen);
+    Py_TYPE(uo)->tp_free((PyObject *)uo);
+}
+
+static int
+unique_traverse(uniqueobject *uo, visitproc visit, void *arg)
+{
+    Py_VISIT(uo->it);
+    Py_VISIT(uo->key);
+    Py_VISIT(uo->seen);
+    return 0;
+}
+
+static PyObject *
+unique_next(uniqueobject *uo)
+{
+    PyObject *item, *k;
+
+    while ((item = PyIter_Next(uo->it)) != NULL) {
+        if (uo->key == NULL) {
+            k = item;
+            Py_INCREF(k);
+        }
+        else {
+            k = PyObject_CallFunctionObjArgs(uo->key, item, NULL);
+            if (k == NULL)
+                break;
+        }
+        ordered_set_probe probe;
+        const ordered_set_entry *pos = NULL;
+        int found = set_probe(uo->seen, k, false, &probe);
+        Py_DECREF(k);
+        if (found == -1)
+            break;
+        found = set_lookup(uo->seen, probe, &pos);
+        if (found == 0)
+            set_append(uo->seen, ordered_set_entry(probe.key, probe.hash));
+        Py_DECREF(probe.key);
+        if (found == 0)
+            return item;
+        if (found == -1)
+            break;
+        Py_DECREF(item);
+    }
+    Py_XDECREF(item);
+    return NULL;
+}
+
+PyDoc_STRVAR(unique_doc,
+"unique(iterable, key=None, maxmemory=None) --> unique object\n\
+\n\
+Yield the first occurrence of each element of iterable, in order, as it is\n\
+reached. With key, elements are told apart by key(element).\n\
+\n\
+With maxmemory, only as many of the most recent keys as fit in about that\n\
+many bytes of index are remembered, so memory stays bounded on endless\n\
+streams; an element whose key has been forgotten is yielded again.");
+
+PyTypeObject PyOrderedSetUnique_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "bcse.collections.unique",  /* tp_name */
+    sizeof(uniqueobject),       /* tp_basicsize */
+    0,                          /* tp_itemsize */
+    /* methods */
+    (destructor)unique_dealloc, /* tp_dealloc */
+    0,                          /* tp_print */
+    0,                          /* tp_getattr */
+    0,                          /* tp_setattr */
+    0,                          /* tp_compare */
+    0,                          /* tp_repr */
+    0,                          /* tp_as_number */
+    0,                          /* tp_as_sequence */
+    0,                          /* tp_as_mapping */
+    0,                          /* tp_hash */
+    0,                          /* tp_call */
+    0,                          /* tp_str */
+    PyObject_GenericGetAttr,    /* tp_getattro */
+    0,                          /* tp_setattro */
+    0,                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    unique_doc,                 /* tp_doc */
+    (traverseproc)unique_traverse, /* tp_traverse */
+    0,                          /* tp_clear */
+    0,                          /* tp_richcompare */
+    0,                          /* tp_weaklistoffset */
+    PyObject_SelfIter,          /* tp_iter */
+    (iternextfunc)unique_next,  /* tp_iternext */
+    0,                          /* tp_methods */
+    0,                          /* tp_members */
+    0,                          /* tp_getset */
+    0,                          /* tp_base */
+    0,                          /* tp_dict */
+    0,                          /* tp_descr_get */
+    0,                          /* tp_descr_set */
+    0,                          /* tp_dictoffset */
+    0,                          /* tp_init */
+    PyType_GenericAlloc,        /* tp_alloc */
+    unique_new,                 /* tp_new */
+    PyObject_GC_Del,            /* tp_free */
 };
+
+#ifdef ORDEREDSET_PROFILE
+static const char *profile_op_names[PyOrderedSet_NOPS] = {
+    "add", "discard", "contains", "index", "pop", "getitem", "delitem",
+    "update", "union", "intersection", "difference", "symmetric_difference",
+    "copy", "clear", "compact"
+};
+
+PyObject *
+PyOrderedSet_Profile(PyObject *self, PyObject *args)
+{
+    ordered_set_profile &p = _PyOrderedSet_Profile;
+    PyObject *result = NULL, *latency = NULL, *bins;
+    int reset = 0;
+
+    if (!PyArg_ParseTuple(args, "|i:profile", &reset))
+        return NULL;
+
+    latency = PyDict_New();
+    if (latency == NULL)
+        return NULL;
+    for (int op = 0; op < PyOrderedSet_NOPS; op++) {
+        bins = PyList_New(PyOrderedSet_NBINS);
+        if (bins == NULL)
+            goto error;
+        for (int bin = 0; bin < PyOrderedSet_NBINS; bin++) {
+            PyObject *n = PyLong_FromUnsignedLongLong(p.latency[op][bin]);
+            if (n == NULL) {
+                Py_DECREF(bins);
+                goto error;
+            }
+            PyList_SET_ITEM(bins, bin, n);
+        }
+        if (PyDict_SetItemString(latency, profile_op_names[op], bins) < 0) {
+            Py_DECREF(bins);
+            goto error;
+        }
+        Py_DECREF(bins);
+    }
+
+    result = Py_BuildValue("{sKsKsKsKsKsKsKsKsO}",
+                           "hash_calls", p.hash_calls,
+                           "richcompares", p.richcompares,
+                           "bloom_rejects", p.bloom_rejects,
+                           "rehashes", p.rehashes,
+                           "compactions", p.compactions,
+                           "erases", p.erases,
+                           "erase_shift", p.erase_shift,
+                           "allocations", p.allocations,
+                           "latency", latency);
+    if (result != NULL && reset)
+        memset(&p, 0, sizeof(p));
+error:
+    Py_DECREF(latency);
+    return result;
+}
+#endif
@@ -5,78 +5,386 @@
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/random_access_index.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/ranked_index.hpp>
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/identity.hpp>
 #include <boost/multi_index/mem_fun.hpp>
+#include <stdint.h>
+#include <deque>
+#include <vector>
 
 #ifdef DEBUG
 #define BOOST_MULTI_INDEX_ENABLE_INVARIANT_CHECKING
 #define BOOST_MULTI_INDEX_ENABLE_SAFE_MODE
 #endif
 
+// Hot path counters and per operation latency histograms, read back through
+// bcse.collections.profile(). Without ORDEREDSET_PROFILE they compile away.
+enum {
+    PyOrderedSet_OP_ADD,
+    PyOrderedSet_OP_DISCARD,
+    PyOrderedSet_OP_CONTAINS,
+    PyOrderedSet_OP_INDEX,
+    PyOrderedSet_OP_POP,
+    PyOrderedSet_OP_GETITEM,
+    PyOrderedSet_OP_DELITEM,
+    PyOrderedSet_OP_UPDATE,
+    PyOrderedSet_OP_UNION,
+    PyOrderedSet_OP_INTERSECTION,
+    PyOrderedSet_OP_DIFFERENCE,
+    PyOrderedSet_OP_SYMMETRIC_DIFFERENCE,
+    PyOrderedSet_OP_COPY,
+    PyOrderedSet_OP_CLEAR,
+    PyOrderedSet_OP_COMPACT,
+    PyOrderedSet_NOPS
+};
+
+#ifdef ORDEREDSET_PROFILE
+#include <chrono>
+
+/* Latency bins are powers of two nanoseconds, the last one open ended. */
+#define PyOrderedSet_NBINS 32
+
+struct ordered_set_profile {
+    unsigned long long hash_calls;
+    unsigned long long richcompares;
+    unsigned long long bloom_rejects;
+    unsigned long long rehashes;
+    unsigned long long compactions;
+    unsigned long long erases;
+    unsigned long long erase_shift;
+    unsigned long long allocations;
+    unsigned long long latency[PyOrderedSet_NOPS][PyOrderedSet_NBINS];
+};
+
+extern ordered_set_profile _PyOrderedSet_Profile;
+
+struct ordered_set_timer {
+    int op;
+    std::chrono::steady_clock::time_point start;
+
+    ordered_set_timer(int op) : op(op), start(std::chrono::steady_clock::now()) {}
+
+    ~ordered_set_timer()
+    {
+        unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        int bin = 0;
+        while (ns > 1 && bin < PyOrderedSet_NBINS - 1) {
+            ns >>= 1;
+            bin++;
+        }
+        _PyOrderedSet_Profile.latency[op][bin]++;
+    }
+};
+
+#define ORDEREDSET_COUNT(counter) (_PyOrderedSet_Profile.counter++)
+#define ORDEREDSET_COUNT_ADD(counter, n) (_PyOrderedSet_Profile.counter += (n))
+#define ORDEREDSET_TIME(op) ordered_set_timer _ordered_set_timer(op)
+/* An erase and the pointers it shifts; shifted is not evaluated unless
+ * profiling, since working it out walks the order. */
+#define ORDEREDSET_COUNT_ERASE(shifted) \
+    (ORDEREDSET_COUNT(erases), ORDEREDSET_COUNT_ADD(erase_shift, (shifted)))
+#else
+#define ORDEREDSET_COUNT(counter) ((void)0)
+#define ORDEREDSET_COUNT_ADD(counter, n) ((void)0)
+#define ORDEREDSET_TIME(op) ((void)0)
+#define ORDEREDSET_COUNT_ERASE(shifted) ((void)0)
+#endif
+
+#include "arenaallocator.h"
+#include "orderedindex.h"
+
+// Carve nodes from PyObject_Malloc instead of PyMem_RawMalloc
+#ifdef ORDEREDSET_PYOBJECT_MALLOC
+typedef pyobject_backend ordered_set_backend;
+#else
+typedef pymem_raw_backend ordered_set_backend;
+#endif
+
 using namespace ::boost;
 using namespace ::boost::multi_index;
 
+#if PY_VERSION_HEX < 0x03020000
+typedef long Py_hash_t;
+typedef unsigned long Py_uhash_t;
+#endif
+
 struct ordered_set_entry {
     PyObject *key;
+    // key_func(key) in a set with a key function, NULL otherwise.
+    PyObject *projected;
+    // Hash of lookup_key(), computed once when the entry is made.
+    Py_hash_t hash;
+    // Insertion time in a set with a ttl.
+    double stamp;
 
-    ordered_set_entry(PyObject *key)
+    ordered_set_entry(PyObject *key, Py_hash_t hash, PyObject *projected = NULL,
+                      double stamp = 0.0)
+        : projected(projected), hash(hash), stamp(stamp)
     {
         Py_INCREF(key);
         this->key = key;
+        Py_XINCREF(projected);
     }
 
     ordered_set_entry(ordered_set_entry const & x)
+        : projected(x.projected), hash(x.hash), stamp(x.stamp)
     {
         Py_INCREF(x.key);
         this->key = x.key;
+        Py_XINCREF(projected);
     }
 
     ~ordered_set_entry()
     {
         Py_DECREF(key);
+        Py_XDECREF(projected);
     }
 
-    bool operator<(const ordered_set_entry& other) const
+    // The object the set hashes and compares on.
+    PyObject *lookup_key() const
     {
-        int i = PyObject_RichCompareBool(key, other.key, Py_LT);
-        return i > 0;
+        return projected != NULL ? projected : key;
+    }
+};
+
+// A key looked up in the hash index, hashed by the caller.
+struct ordered_set_probe {
+    PyObject *key;
+    Py_hash_t hash;
+};
+
+// Hash and equality for any entry type with a cached hash and lookup_key(),
+// so that orderedmap's container can share them.
+struct ordered_set_hash {
+    template <typename Entry>
+    std::size_t operator()(const Entry &x) const { return x.hash; }
+};
+
+// Equal hashes, then identity, then ==. A failing comparison counts as
+// unequal and leaves the error set for the caller to check.
+struct ordered_set_equal {
+    static bool equal(PyObject *a, Py_hash_t ha, PyObject *b, Py_hash_t hb)
+    {
+        if (ha != hb)
+            return false;
+        if (a == b)
+            return true;
+        ORDEREDSET_COUNT(richcompares);
+        return PyObject_RichCompareBool(a, b, Py_EQ) > 0;
     }
 
-    long hash() const
+    template <typename Entry>
+    bool operator()(const Entry &a, const Entry &b) const
     {
-        return PyObject_Hash(key);
+        return equal(a.lookup_key(), a.hash, b.lookup_key(), b.hash);
+    }
+
+    template <typename Entry>
+    bool operator()(const ordered_set_probe &a, const Entry &b) const
+    {
+        return equal(a.key, a.hash, b.lookup_key(), b.hash);
     }
 };
 
-struct key_index{};
-struct hash_index{};
+// Hash by the cached hash, compare with ==, keep the order in a counted
+// B+ tree.
+typedef ordered_index<ordered_set_entry, ordered_set_hash, ordered_set_backend> ordered_set;
+
+// Borrowed reference to a key owned by an ordered_set, for the optional
+// sorted index. Keys are ordered with PyObject_RichCompareBool; errors are
+// left set for the caller to check.
+struct sorted_set_entry {
+    PyObject *key;
+
+    sorted_set_entry(PyObject *key) : key(key) {}
+
+    bool operator<(const sorted_set_entry& other) const
+    {
+        ORDEREDSET_COUNT(richcompares);
+        int i = PyObject_RichCompareBool(key, other.key, Py_LT);
+        return i > 0;
+    }
+};
 
 typedef multi_index_container<
-    ordered_set_entry,
+    sorted_set_entry,
     indexed_by<
-        random_access<
-            tag<key_index>
-        >,
-
-        // hash by ordered_set_entry::hash
-        hashed_unique<
-            tag<hash_index>,
-            const_mem_fun<ordered_set_entry, long, &ordered_set_entry::hash>
+        ranked_non_unique<
+            identity<sorted_set_entry>
         >
-    >
-> ordered_set;
+    >,
+    arena_allocator<sorted_set_entry, ordered_set_backend>
+> ordered_set_sorted;
+
+/*
+ * Blocked Bloom filter over the cached hashes of a set, for sets created
+ * with bloom=True. Every hash sets two bits of a single 64 bit word, so a
+ * miss is usually answered by reading one word instead of a hash bucket.
+ * Bits are never cleared; the owner rebuilds the filter once as many keys
+ * have been added since the last rebuild as it was sized for.
+ */
+struct ordered_set_bloom {
+    std::vector<uint64_t> words;
+    /* Number of adds the filter was sized for, at 8 bits each. */
+    Py_ssize_t capacity;
+    /* Adds since the filter was built, removed keys included. */
+    Py_ssize_t added;
+
+    explicit ordered_set_bloom(Py_ssize_t n) : added(0)
+    {
+        std::size_t nwords = 1;
+        while ((Py_ssize_t)nwords * 8 < n)
+            nwords <<= 1;
+        words.assign(nwords, 0);
+        capacity = nwords * 8;
+    }
 
-typedef ordered_set::index<key_index>::type ordered_set_by_key;
-typedef ordered_set::index<hash_index>::type ordered_set_by_hash;
+    static uint64_t mix(Py_hash_t hash)
+    {
+        // MurmurHash3's finalizer; int keys hash to themselves.
+        uint64_t h = (uint64_t)hash;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static uint64_t bits(uint64_t h)
+    {
+        return ((uint64_t)1 << (h & 63)) | ((uint64_t)1 << ((h >> 6) & 63));
+    }
+
+    void add(Py_hash_t hash)
+    {
+        uint64_t h = mix(hash);
+        words[(h >> 12) & (words.size() - 1)] |= bits(h);
+        added++;
+    }
+
+    bool may_contain(Py_hash_t hash) const
+    {
+        uint64_t h = mix(hash), b = bits(h);
+        return (words[(h >> 12) & (words.size() - 1)] & b) == b;
+    }
+
+    bool full() const { return added > capacity; }
+
+    std::size_t nbytes() const { return words.capacity() * sizeof(uint64_t); }
+};
+
+/* Kinds of ordered_set_change. */
+enum {
+    PyOrderedSet_CHANGE_ADD,        /* key appended */
+    PyOrderedSet_CHANGE_DISCARD,    /* key removed */
+    PyOrderedSet_CHANGE_MOVE,       /* key moved to index */
+    PyOrderedSet_CHANGE_ORDER,      /* keys put in the order of the tuple key */
+    PyOrderedSet_CHANGE_CLEAR,      /* every key removed, key is NULL */
+    PyOrderedSet_NCHANGES
+};
+
+struct ordered_set_change {
+    int op;
+    PyObject *key;
+    Py_ssize_t index;
+    /* Version of the set once the change was made. */
+    unsigned long version;
+};
+
+/*
+ * Changes made to a set since track_changes(), oldest first, so that a
+ * replica at any version from `start` on can be brought up to date by
+ * replaying the ones made after it. Every change holds a reference to its
+ * key. With a maxlen, the oldest changes are dropped and start moves on.
+ */
+struct ordered_set_changelog {
+    std::deque<ordered_set_change> changes;
+    unsigned long start;
+    /* Number of changes kept, -1 for all of them. */
+    Py_ssize_t maxlen;
+
+    ordered_set_changelog(unsigned long start, Py_ssize_t maxlen)
+        : start(start), maxlen(maxlen) {}
+
+    ~ordered_set_changelog() { forget(start); }
+
+    void record(int op, PyObject *key, Py_ssize_t index, unsigned long version)
+    {
+        ordered_set_change change = {op, key, index, version};
+        Py_XINCREF(key);
+        changes.push_back(change);
+        trim();
+    }
+
+    void trim()
+    {
+        while (maxlen >= 0 && (Py_ssize_t)changes.size() > maxlen) {
+            ordered_set_change change = changes.front();
+            changes.pop_front();
+            start = change.version;
+            Py_XDECREF(change.key);
+        }
+    }
+
+    /* Drop every change, for when the log cannot follow the set: replicas
+     * older than version have to start over from a copy. */
+    void forget(unsigned long version)
+    {
+        while (!changes.empty()) {
+            ordered_set_change change = changes.front();
+            changes.pop_front();
+            Py_XDECREF(change.key);
+        }
+        start = version;
+    }
+};
+
+/* Sets whose order holds fewer pointer slots than this are never shrunk. */
+#define PyOrderedSet_SHRINK_MINSIZE 1024
+#define PyOrderedSet_SHRINK_RATIO 0.25
+/* A set with a ttl sweeps its expired keys once they number
+ * len >> PyOrderedSet_EXPIRE_SHIFT. */
+#define PyOrderedSet_EXPIRE_SHIFT 4
 
 typedef struct _orderedsetobject {
     PyObject_HEAD
 
     ordered_set oset;
+    /* Compact once len(set) drops below this fraction of the capacity. */
+    double shrink_ratio;
+    /* Elements made room for with reserve(), kept when shrinking. */
+    Py_ssize_t reserved;
+    /* Bumped on every insertion and removal. */
+    unsigned long version;
+    /* Sum of the mixed hashes of all entries, independent of their order. */
+    Py_uhash_t fingerprint;
+    /* Keys in sort order, built on first use of a sorted query. */
+    ordered_set_sorted *sorted;
+    /* Summary of the hashes for fast misses, NULL unless bloom=True. */
+    ordered_set_bloom *bloom;
+    /* Changes since track_changes(), NULL unless tracking. */
+    ordered_set_changelog *changelog;
+    /* Upper bound on len(set), -1 if unbounded. */
+    Py_ssize_t maxlen;
+    /* Give keys hit by add() or `in` a second chance on eviction. */
+    int touch;
+    /* Seconds a key lives after being added, negative if forever. */
+    double ttl;
+    /* Returns the time for ttl stamps, NULL for the monotonic clock. */
+    PyObject *clock;
+    /* Projects keys before hashing and comparing, NULL for the identity. */
+    PyObject *keyfunc;
 } PyOrderedSetObject;
 
 PyAPI_DATA(PyTypeObject) PyOrderedSet_Type;
+PyAPI_DATA(PyTypeObject) PyOrderedSetUnique_Type;
+
+#ifdef ORDEREDSET_PROFILE
+PyAPI_FUNC(PyObject *) PyOrderedSet_Profile(PyObject *self, PyObject *args);
+#endif
 
 #define PyOrderedSet_Check(ob) \
     (Py_TYPE(ob) == &PyOrderedSet_Type || \
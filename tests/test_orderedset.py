@@ -1,4 +1,12 @@
-from bcse.collections import orderedset
+from bcse.collections import orderedmap, orderedset, unique
+
+
+def rss():
+    try:
+        with open('/proc/self/statm') as f:
+            return int(f.read().split()[1]) * 4096
+    except (IOError, OSError):
+        return 0
 
 if __name__ == '__main__':
     a = orderedset('abracadabra')
@@ -19,120 +27,406 @@ if __name__ == '__main__':
     print(a ^ b)
     print(b ^ a)
 
-    print('Benchmark...')
-
-    from random import randint
-    from time import time
-
-    data1 = [randint(1, 100000) for _ in range(100000)]
-    data2 = [randint(1, 100000) for _ in range(100000)]
-
-    t0 = time()
-    orderedset(data1)
-    t = time() - t0
-    print('init with 100k random integers: %fs' % t)
-
-    a = orderedset(data1)
-    b = orderedset(data2)
-    t0 = time()
-    c = a | b
-    t = time() - t0
-    print('a | b: %fs' % t)
-
-    a = orderedset(data1)
-    b = orderedset(data2)
-    t0 = time()
-    c = a & b
-    t = time() - t0
-    print('a & b: %fs' % t)
-
-    a = orderedset(data1)
-    b = orderedset(data2)
-    t0 = time()
-    c = a - b
-    t = time() - t0
-    print('a - b: %fs' % t)
-
-    a = orderedset(data1)
-    b = orderedset(data2)
-    t0 = time()
-    c = a ^ b
-    t = time() - t0
-    print('a ^ b: %fs' % t)
-
-    a = orderedset(data1)
-    b = orderedset(data2)
-    t0 = time()
-    a |= b
-    t = time() - t0
-    print('a |= b: %fs' % t)
-
-    a = orderedset(data1)
-    b = orderedset(data2)
-    t0 = time()
-    a &= b
-    t = time() - t0
-    print('a &= b: %fs' % t)
-
-    a = orderedset(data1)
-    b = orderedset(data2)
-    t0 = time()
-    a -= b
-    t = time() - t0
-    print('a -= b: %fs' % t)
-
-    a = orderedset(data1)
-    b = orderedset(data2)
-    t0 = time()
-    a ^= b
-    t = time() - t0
-    print('a ^= b: %fs' % t)
 
-    a = orderedset()
-    t0 = time()
-    [a.add(i) for i in data1]
-    t = time() - t0
-    print('add 100k times: %fs' % t)
-
-    a = orderedset(data1)
-    len = len(a)
-    b = range(len-1, -1, -1)
-    t0 = time()
-    [a.__delitem__(i) for i in b]
-    t = time() - t0
-    print('reversed sequential delete %d items: %fs' % (len, t))
-
-    a = orderedset(data1)
-    t0 = time()
-    [a.discard(i) for i in data2]
-    t = time() - t0
-    print('discard 100k times: %fs' % t)
-
-    a = orderedset(data1)
-    t0 = time()
-    while 1:
+    a = orderedset([5, 3, 9, 1, 7])
+    assert list(a.sorted_iter()) == [1, 3, 5, 7, 9]
+    assert list(a.irange(3, 7)) == [3, 5, 7]
+    assert list(a.irange(hi=4)) == [1, 3]
+    assert (a.bisect_left(5), a.bisect_right(5), a.rank(9)) == (2, 3, 4)
+    a.add(4)
+    a.discard(3)
+    assert list(a.sorted_iter()) == [1, 4, 5, 7, 9]
+    assert list(a) == [5, 9, 1, 7, 4]
+
+    a = orderedset([1, 2, 3, 4, 5])
+    a.insert(0, 0)
+    a.insert(-1, 9)
+    a.insert(100, 6)
+    a.insert(0, 3)
+    assert list(a) == [0, 1, 2, 3, 4, 9, 5, 6]
+    a.move(9, 0)
+    a.move(0, -1)
+    assert list(a) == [9, 1, 2, 3, 4, 5, 6, 0]
+    a.move_to_end(1)
+    a.move_to_end(6, last=False)
+    assert list(a) == [6, 9, 2, 3, 4, 5, 0, 1]
+    assert a.index(0) == 6 and 0 in a
+    for args in ((7, 0), (6, 8)):
+        try:
+            a.move(*args)
+            assert False, args
+        except (ValueError, IndexError):
+            pass
+
+    import pickle
+    a = orderedset(range(100), maxlen=32)
+    assert a.maxlen == 32 and list(a) == list(range(68, 100))
+    for i in range(100, 200):
+        a.add(i)
+        assert len(a) == 32 and i in a and i - 32 not in a
+    assert list(a) == sorted(a)
+    assert pickle.loads(pickle.dumps(a)).maxlen == a.copy().maxlen == 32
+    assert orderedset().maxlen is None and len(orderedset([1], maxlen=0)) == 0
+
+    a = orderedset(range(4), maxlen=4, touch=True)
+    assert 0 in a and list(a) == [1, 2, 3, 0]
+    a.add(1)
+    a.add(4)
+    assert list(a) == [3, 0, 1, 4]
+
+    now = [0.0]
+    a = orderedset(range(4), ttl=10, clock=lambda: now[0])
+    now[0] = 5
+    a.update([4, 5])
+    now[0] = 10
+    assert 3 not in a and 4 in a and a.ttl == 10
+    a.add(0)
+    assert list(a) == [4, 5, 0]
+    assert a.expire(15) == 2 and list(a) == [0]
+    assert (a | [1]).ttl == 10
+    now[0] = 0
+    a = orderedset(range(100), ttl=1.0, clock=lambda: now[0])
+    now[0] = 2
+    assert len(a) == 0 and list(a) == [] and not a
+    a = orderedset(range(100), ttl=1.0, clock=lambda: now[0])
+    now[0] = 4
+    assert len(a & orderedset(range(100))) == len(orderedset(range(100)) & a) == 0
+    now[0] = 0
+    a = orderedset(range(2), ttl=1.0, clock=lambda: now[0])
+    now[0] = 0.5
+    a.update(range(2, 100))
+    now[0] = 1.2
+    assert 1 not in a and a[0] == 2 and len(a) == 98 and a.index(2) == 0
+    assert a == orderedset(range(2, 100)) and a.copy() == orderedset(range(2, 100))
+    calls = [0]
+    def clock():
+        calls[0] += 1
+        return 0.0
+    a = orderedset(range(100), ttl=10, clock=clock)
+    b = orderedset(range(50, 150), ttl=10, clock=clock)
+    calls[0] = 0
+    assert len(orderedset(range(200)) - a) == 100 and len(b & a) == 50 and len(b ^ a) == 100
+    assert not b.isdisjoint(a) and not a.isdisjoint(range(99, 200)) and calls[0] <= 10
+    try:
+        a.insert(0, 9)
+        assert False
+    except ValueError:
+        pass
+
+    assert list(orderedset([-1, -2])) == [-1, -2]
+    records = [('u1', 1), ('u2', 2), ('u1', 3)]
+    a = orderedset(records, key=lambda r: r[0])
+    assert list(a) == [('u1', 1), ('u2', 2)]
+    assert ('u1', 3) in a and a.contains_key('u2') and not a.contains_key(('u2', 2))
+    assert a.get('u1') == ('u1', 1) and a.get('u3', 0) == 0
+    a.discard_key('u1')
+    assert list(a) == [('u2', 2)] and list(a | [('u2', 9), ('u4', 4)]) == [('u2', 2), ('u4', 4)]
+    a = orderedset([('u1', 1), ('u2', 2)], key=lambda r: r[0])
+    assert list(a & [('u2', 9)]) == [('u2', 2)] and list(a - [('u2', 9)]) == [('u1', 1)]
+    assert list(a ^ [('u2', 9), ('u3', 3)]) == [('u1', 1), ('u3', 3)]
+    assert a.issubset([('u1', 5), ('u2', 6)]) and a.issuperset([('u1', 7)])
+    assert a.equals_unordered([('u2', 7), ('u1', 8)]) and not a.isdisjoint([('u2', 9)])
+    assert list(a.lazy() & [('u2', 9)]) == [('u2', 2)] and a.intersection([('u1', 0)]) == a[:1]
+
+    import itertools
+    assert list(unique([3, 1, 3, 2, 1])) == [3, 1, 2]
+    assert list(unique('aBbA', key=str.lower)) == ['a', 'B']
+    assert list(itertools.islice(unique(itertools.count()), 3)) == [0, 1, 2]
+    assert len(list(unique([1, 2, 1, 2], maxmemory=1))) == 4
+
+    m = orderedmap([('a', 1), ('b', 2)], c=3)
+    assert m.keys() == ['a', 'b', 'c'] and m['b'] == 2 and 'c' in m
+    assert m.key_at(-1) == 'c' and m.item_at(0) == ('a', 1) and m.index('c') == 2
+    m['a'] = 10
+    assert m.items() == [('a', 10), ('b', 2), ('c', 3)]
+    assert m.pop('b') == 2 and m.popitem(last=False) == ('a', 10) and m.keys() == ['c']
+    assert m.setdefault('d', 4) == 4 and m.get('x') is None and m.values() == [3, 4]
+    assert pickle.loads(pickle.dumps(m)) == m and m != orderedmap(d=4, c=3)
+    assert orderedmap([(-1, 'a'), (-2, 'b')]).keys() == [-1, -2]
+
+    class Clearing(object):
+        def __eq__(self, other):
+            m2.clear()
+            return True
+        __hash__ = object.__hash__
+    m1, m2 = orderedmap(a=Clearing(), b=1), orderedmap(a=Clearing(), b=1)
+    assert m1 != m2 and not m1 == m2
+
+    class ClearingKey(object):
+        def __eq__(self, other):
+            s2.clear()
+            return True
+        def __hash__(self):
+            return 1000
+    s1 = orderedset([ClearingKey()] + list(range(599)))
+    s2 = orderedset([ClearingKey()] + list(range(599)))
+    assert not s1 == s2 and len(s2) == 0
+    s2 = orderedset([ClearingKey()] + list(range(599)))
+    assert s1 > s2 and not s1 < s2
+
+    a = orderedset(range(1000))
+    b = orderedset(reversed(range(1000)))
+    assert a != b and a.equals_unordered(b) and a.equals_unordered(range(1000))
+    b.discard(0)
+    b.add(1000)
+    assert not a.equals_unordered(b) and a != b
+    b.discard(1000)
+    b.add(0)
+    assert a.equals_unordered(b)
+    assert orderedset(['a', 'B'], key=str.lower).equals_unordered(orderedset(['b', 'A'], key=str.lower))
+    assert orderedset(['a', 'B'], key=str.lower).equals_unordered(['b', 'A'])
+    assert a == orderedset(list(a)) and a.copy() == a and (a | b) == a
+
+    assert orderedset([1, 2]).isdisjoint([3, 4]) and not orderedset([1, 2]).isdisjoint(iter([4, 2]))
+    assert orderedset(range(10)).isdisjoint(orderedset(range(10, 1000)))
+    assert not orderedset(range(1000)).isdisjoint(orderedset([5]))
+    a = orderedset(range(0, 20000, 2), bloom=True)
+    assert a.bloom and not orderedset().bloom
+    assert all(i in a for i in range(0, 20000, 2)) and not any(i in a for i in range(1, 20000, 2))
+    for i in range(0, 20000, 4):
+        a.discard(i)
+    a.compact()
+    assert all(i in a for i in range(2, 20000, 4)) and not any(i in a for i in range(0, 20000, 4))
+    assert pickle.loads(pickle.dumps(a)).bloom and (a - [2]).bloom and 6 in a.copy()
+    assert a.isdisjoint(range(1, 100, 2)) and not a.isdisjoint([6])
+
+    a = orderedset([1, 2, 3], maxlen=10, touch=True)
+    a.__init__([4])
+    assert list(a) == [4] and a.maxlen is None
+    a.move_to_end(last=False, key=4)
+    for call in (lambda: a.pop(0, 1), lambda: a.move_to_end(4, key=4),
+                 lambda: a.move_to_end(4, lst=0), lambda: orderedset([], 1, 0, None, None, None, 0, 0)):
+        try:
+            call()
+            assert False
+        except TypeError:
+            pass
+
+    a = orderedset([3, 1, 2])
+    assert list(reversed(a)) == [2, 1, 3] and a.tolist() == [3, 1, 2] and list(reversed(orderedset())) == []
+    it = reversed(a)
+    assert it.__length_hint__() == 3 and next(it) == 2 and it.__length_hint__() == 2
+    for make in (iter, reversed):
+        it = make(a)
+        next(it)
+        a.move_to_end(a[0])
         try:
-            a.pop()
-        except IndexError:
-            break
-    t = time() - t0
-    print('pop all items: %fs' % t)
-
-    a = orderedset(data1)
-    t0 = time()
-    c = list(a)
-    t = time() - t0
-    print('list(a): %fs' % t)
-
-    a = orderedset(data1)
-    t0 = time()
-    c = reversed(a)
-    t = time() - t0
-    print('reversed(a): %fs' % t)
-
-    a = orderedset(data1)
-    b = orderedset(data2)
-    t0 = time()
-    [(i in a) for i in b]
-    t = time() - t0
-    print('[(i in a) for i in b]: %fs' % t)
+            next(it)
+            assert False
+        except RuntimeError:
+            pass
+
+    a, b = orderedset(range(20), bloom=True), list(range(20))
+    for s in (slice(2, 5), slice(None, None, 2), slice(None, None, -3), slice(-2, None), slice(5, 1)):
+        del a[s], b[s]
+        assert list(a) == b and a == orderedset(b) and all(a.index(k) == i for i, k in enumerate(b))
+    assert 0 not in a and 1 in a
+    a = orderedset([5, 3, 9, 1, 7])
+    del a[1::2]
+    assert list(a.sorted_iter()) == [5, 7, 9]
+    try:
+        a[:1] = [1]
+        assert False
+    except TypeError:
+        pass
+
+    a = orderedset(range(10))
+    v = a.view[2:9]
+    assert len(v) == 7 and list(v) == list(range(2, 9)) and v[-1] == 8 and 5 in v and 9 not in v
+    assert list(v[::-3]) == [8, 5, 2] and v[::-3].index(2) == 2 and list(reversed(v[1::2])) == [7, 5, 3]
+    assert v[::2].copy() == orderedset([2, 4, 6, 8]) and 3 not in v[::2] and v.tolist() == a[2:9].tolist()
+    assert list(a[::-4]) == [9, 5, 1]
+    a.add(10)
+    try:
+        len(v)
+        assert False
+    except RuntimeError:
+        pass
+
+    a, b, c = orderedset([4, 1, 3, 2]), orderedset([2, 3, 9]), [5, 3, 2, 1]
+    assert list(a.union(b, c, iter([7]))) == [4, 1, 3, 2, 9, 5, 7] and list(a.union()) == list(a)
+    assert list(a.intersection(b, c)) == [3, 2] and list(a.intersection(c, [2, 3, 4, 1])) == [1, 3, 2]
+    assert list(a.difference(b, iter([4]))) == [1] and list(a.difference()) == list(a)
+    d = a.copy()
+    d.update(b, [0])
+    d.difference_update([9], b)
+    d.intersection_update(c, range(2))
+    assert list(d) == [1]
+
+    a, b, c = orderedset([1, 2, 3]), orderedset([4, 2]), orderedset([3, 5])
+    e = (a.lazy() | b) - c
+    assert 4 in e and 3 not in e and list(e) == [1, 2, 4] and bool(e) and not (a.lazy() & [9])
+    assert list(c ^ a.lazy()) == list(c ^ a) and len(e) == 3 and e[-1] == 4
+    m = e.materialize()
+    assert m == orderedset([1, 2, 4]) and e.materialize() is not m
+    m.add(7)
+    assert e.materialize() == orderedset([1, 2, 4]) and list(e) == [1, 2, 4]
+    c.add(4)
+    assert list(e) == [1, 2] and e.materialize() == orderedset([1, 2])
+    import gc
+    # Keep an automatic collection from freeing the cycle first.
+    gc.disable()
+    s = orderedset([1])
+    s.add(s.lazy() | [2])
+    s.add(iter(s.lazy()))
+    del s
+    assert gc.collect() > 0
+    import weakref
+    class Holder(object):
+        pass
+    s, k = orderedset([1]), Holder()
+    k.ref = s.view[:]
+    s.add(k)
+    r = weakref.ref(k)
+    del s, k
+    gc.collect()
+    assert r() is None
+    s, k = orderedset(), Holder()
+    k.ref = [s.sorted_iter(), s.irange()]
+    s.add(k)
+    r = weakref.ref(k)
+    del s, k
+    gc.collect()
+    assert r() is None
+    gc.enable()
+    it = iter(a.lazy() - [1])
+    next(it)
+    a.add(6)
+    try:
+        next(it)
+        assert False
+    except RuntimeError:
+        pass
+
+    import random
+    a, b = orderedset([3, -1, 2, -3, 1], bloom=True), [3, -1, 2, -3, 1]
+    a.sort(key=abs, reverse=True)
+    assert list(a) == sorted(b, key=abs, reverse=True) == [3, -3, 2, -1, 1]
+    a.sort()
+    a.reverse()
+    assert list(a) == [3, 2, 1, -1, -3] and a.index(-3) == 4 and -1 in a
+    a.shuffle(random.Random(1))
+    assert sorted(a) == sorted(b) and all(a.index(k) == i for i, k in enumerate(a))
+    a = orderedset(['b', 1, 'a'])
+    for call in (a.sort, lambda: orderedset([1], ttl=1).reverse()):
+        try:
+            call()
+            assert False
+        except (TypeError, ValueError):
+            pass
+    assert list(a) == ['b', 1, 'a']
+
+    a = orderedset([1, 2])
+    it = iter(a)
+    a.reserve(5000)
+    stats = a.stats()
+    assert stats['capacity'] >= 5000 and stats['bucket_count'] * stats['max_load_factor'] >= 5000
+    try:
+        next(it)
+        assert False
+    except RuntimeError:
+        pass
+    a.update(range(3, 5001))
+    a.discard(1)
+    assert a.stats()['capacity'] == stats['capacity'] and a.stats()['bucket_count'] == stats['bucket_count']
+    a -= range(4000)
+    assert a.stats()['capacity'] >= 5000 and list(a) == list(range(4000, 5001))
+    a.compact()
+    assert a.stats()['capacity'] < 5000
+    orderedset(maxlen=4).reserve(10 ** 12)
+    try:
+        a.reserve(-1)
+        assert False
+    except ValueError:
+        pass
+
+    a = orderedset(range(6), maxlen=8)
+    version = a.track_changes()
+    b = orderedset(a)
+    a.update([6, 7, 8])
+    del a[2:4]
+    a.pop(0)
+    a.insert(1, 9)
+    a.move(6, -1)
+    a &= [9, 8, 7, 6, 4]
+    a ^= [7, 10]
+    a.sort()
+    d = a.delta_since(version)
+    assert d[0] > version and ('discard', 0) in d[1] and ('move', 9, 1) in d[1]
+    assert b.apply_delta(pickle.loads(pickle.dumps(d))) == d[0] and list(b) == list(a) == [6, 8, 9, 10]
+    a.add(11)
+    a.discard(6)
+    assert a.track_changes(maxlen=1) == d[0] + 2
+    assert a.delta_since(d[0] + 1) == (d[0] + 2, [('discard', 6)])
+    for call in (lambda: a.delta_since(d[0]), lambda: orderedset().delta_since(0),
+                 lambda: b.apply_delta((0, [('order', (1, 2))])),
+                 lambda: a.track_changes(maxlen=0) and a.delta_since(d[0] + 2)):
+        try:
+            call()
+            assert False
+        except ValueError:
+            pass
+
+    a, b = orderedset('abcdefg'), orderedset('xbdacgf')
+    d = a.diff(b)
+    assert sorted(c for c in d if c[0] == 'discard') == [('discard', 'e')]
+    assert len([c for c in d if c[0] == 'move']) == 4  # 3 kept keys and 'x'
+    c = orderedset(a)
+    assert c.apply_delta(d) is None and list(c) == list(b)
+    assert a.diff('xbdacgf') == d and a.diff(a) == [] and orderedset().diff(a) != []
+    c = orderedset(range(1000))
+    d = c.diff(reversed(range(1000)))
+    assert c.apply_delta(d) is None and list(c) == list(reversed(range(1000)))
+    try:
+        orderedset('ab').apply_delta([('move', 'z', 0)] * 4)
+        assert False
+    except ValueError:
+        pass
+
+    import sys
+    a = orderedset(range(100000))
+    stats = a.stats()
+    assert stats['size'] == 100000
+    assert stats['capacity'] >= stats['size']
+    assert stats['bucket_count'] * stats['max_load_factor'] >= stats['size']
+    assert sys.getsizeof(a) > sys.getsizeof(orderedset()) + sum(stats['bytes'].values()) // 2
+    print(stats)
+    # Snapshots taken while the buckets move to a larger array.
+    a = orderedset()
+    for i in range(200000):
+        a.add(i)
+        if i % 1000 == 0:
+            stats = a.stats()
+            assert stats['mean_chain'] <= stats['max_chain'], (i, stats)
+
+    a = orderedset(range(1000000))
+    a.shrink_ratio = 0
+    for i in range(999999, 99999, -1):
+        a.discard(i)
+    r0 = rss()
+    a.compact()
+    r1 = rss()
+    assert list(a) == list(range(100000))
+    assert r0 == 0 or r1 < r0, (r0, r1)
+    print('compact after discarding 90%%: -%dKB' % ((r0 - r1) // 1024))
+
+    a = orderedset(range(1000000))
+    r0 = rss()
+    for i in range(999999, 99999, -1):
+        a.discard(i)
+    r1 = rss()
+    assert r0 == 0 or r1 < r0, (r0, r1)
+    print('automatic shrink after discarding 90%%: -%dKB' % ((r0 - r1) // 1024))
+    del a
+
+    # Inserting at the front splits the first leaf over and over, until the
+    # splits reach the root of a tree three levels deep.
+    a = orderedset()
+    for i in range(1500000):
+        a.insert(0, i)
+    n = len(a)
+    assert all(a[j] == n - 1 - j and a.index(n - 1 - j) == j for j in range(0, n, 9973))
+    for i in range(0, n, 7919):
+        a.move(i, n // 2)
+    b = list(a)
+    assert len(b) == n and all(a.index(b[j]) == j for j in range(0, n, 9973))